@@ -0,0 +1,45 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <disk.h>
+#include <disk_ext.h>
+
+/*
+ * Copy a mirrored disk onto one of its members, for instance after an image
+ * was restored from an old copy or written while it was out of the manifest.
+ */
+int main(int argc, char *argv[])
+{
+	char *end;
+	long member;
+	int ret;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <manifest> <member index>\n",
+			argv[0]);
+		exit(1);
+	}
+
+	member = strtol(argv[2], &end, 0);
+	if (*argv[2] == '\0' || *end != '\0' || member < 0 ||
+	    member > INT_MAX) {
+		fprintf(stderr, "Invalid member index '%s'\n", argv[2]);
+		exit(1);
+	}
+
+	if (block_disk_open(argv[1])) {
+		fprintf(stderr, "Cannot open '%s'\n", argv[1]);
+		exit(1);
+	}
+
+	ret = block_resync(member);
+	block_disk_close();
+	if (ret) {
+		fprintf(stderr, "Cannot resync member %ld of '%s'\n", member,
+			argv[1]);
+		exit(1);
+	}
+
+	return 0;
+}
@@ -0,0 +1,1531 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <disk.h>
+#include <disk_ext.h>
+#include <fs.h>
+#include <fs_ext.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+#define fs_bench_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	fs_bench_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+#define die_perror(msg)			\
+do {							\
+	perror(msg);				\
+	exit(1);					\
+} while (0)
+
+/* Layout constants of the on-disk format (see libfs/fs.c) */
+#define BENCH_BLOCK_SIZE 4096
+#define BENCH_SIGNATURE "ECS150FS"
+#define BENCH_FAT_EOC 0xFFFF
+#define BENCH_JOURNAL_MAGIC 0x4C4E524A
+
+/* Name of the file created on the benchmark disk */
+#define BENCH_FILENAME "bench"
+
+struct bench_arg {
+	int argc;
+	char **argv;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX || ret < 0)
+		die("invalid number '%s'", argv);
+	return (size_t)ret;
+}
+
+/*
+ * Format @diskname as an empty file system with @data_blk data blocks, the
+ * same way the reference fs_make.x tool does. If @journal_blk is not 0, a
+ * metadata journal of that many blocks is placed after the root directory.
+ */
+static void make_disk(const char *diskname, size_t data_blk,
+		      size_t journal_blk)
+{
+	uint8_t block[BENCH_BLOCK_SIZE];
+	size_t fat_blk_count, total_blk_count, i;
+	uint32_t magic;
+	uint16_t val;
+	int fd;
+
+	if (data_blk == 0 || data_blk >= BENCH_FAT_EOC)
+		die("invalid data block count %zu", data_blk);
+
+	fat_blk_count = (data_blk * 2 + BENCH_BLOCK_SIZE - 1) / BENCH_BLOCK_SIZE;
+	total_blk_count = 1 + fat_blk_count + 1 + journal_blk + data_blk;
+	if (total_blk_count > UINT16_MAX)
+		die("too many blocks (%zu)", total_blk_count);
+
+	fd = open(diskname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		die_perror("open");
+
+	/* Superblock */
+	memset(block, 0, sizeof(block));
+	memcpy(block, BENCH_SIGNATURE, 8);
+	val = total_blk_count;
+	memcpy(block + 8, &val, 2);
+	val = fat_blk_count + 1;
+	memcpy(block + 10, &val, 2);
+	val = fat_blk_count + 2 + journal_blk;
+	memcpy(block + 12, &val, 2);
+	val = data_blk;
+	memcpy(block + 14, &val, 2);
+	block[16] = fat_blk_count;
+	if (journal_blk) {
+		magic = BENCH_JOURNAL_MAGIC;
+		memcpy(block + 17, &magic, 4);
+		val = fat_blk_count + 2;
+		memcpy(block + 21, &val, 2);
+		val = journal_blk;
+		memcpy(block + 23, &val, 2);
+	}
+	if (write(fd, block, sizeof(block)) != sizeof(block))
+		die_perror("write");
+
+	/* FAT, whose first entry is always reserved */
+	for (i = 0; i < fat_blk_count; i++) {
+		memset(block, 0, sizeof(block));
+		if (i == 0)
+			block[0] = block[1] = 0xFF;
+		if (write(fd, block, sizeof(block)) != sizeof(block))
+			die_perror("write");
+	}
+
+	/* Empty root directory and journal, then sparse data blocks */
+	memset(block, 0, sizeof(block));
+	for (i = 0; i < 1 + journal_blk; i++) {
+		if (write(fd, block, sizeof(block)) != sizeof(block))
+			die_perror("write");
+	}
+	if (ftruncate(fd, total_blk_count * BENCH_BLOCK_SIZE))
+		die_perror("ftruncate");
+
+	close(fd);
+}
+
+/*
+ * Create the benchmark file on a freshly formatted disk and fill it with
+ * @size bytes. Leave the file system mounted and return the open descriptor.
+ */
+static int make_bench_file(const char *diskname, size_t size)
+{
+	size_t data_blk = size / BENCH_BLOCK_SIZE + 16;
+	char *buf;
+	int fd;
+
+	make_disk(diskname, data_blk, 0);
+
+	if (fs_mount(diskname))
+		die("Cannot mount disk");
+	if (fs_create(BENCH_FILENAME))
+		die("Cannot create file");
+	fd = fs_open(BENCH_FILENAME);
+	if (fd < 0)
+		die("Cannot open file");
+
+	buf = malloc(size);
+	if (!buf)
+		die_perror("malloc");
+	memset(buf, 0xA5, size);
+	if (fs_write(fd, buf, size) != (int)size)
+		die("Cannot fill file");
+	free(buf);
+
+	return fd;
+}
+
+/*
+ * Evict @diskname from the page cache, so that the next reads have to go to
+ * the storage device. Pages still mapped by the file system stay.
+ */
+static void evict_image(const char *diskname)
+{
+	int fd;
+
+	fd = open(diskname, O_RDONLY);
+	if (fd < 0)
+		die_perror("open");
+	if (fdatasync(fd) || posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED))
+		die_perror("posix_fadvise");
+	close(fd);
+}
+
+/* Write the mounted file system back and evict @diskname from the page cache */
+static void drop_page_cache(const char *diskname)
+{
+	if (fs_sync())
+		die("Cannot sync");
+	evict_image(diskname);
+}
+
+void bench_mkfs(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+
+	if (b_arg->argc < 2)
+		die("Usage: <diskname> <data block count> [journal block count]");
+
+	make_disk(b_arg->argv[0], get_argv(b_arg->argv[1]),
+		  b_arg->argc > 2 ? get_argv(b_arg->argv[2]) : 0);
+}
+
+void bench_randread(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	char buf[BENCH_BLOCK_SIZE];
+	size_t size, nreads, nblocks, i;
+	double start, elapsed;
+	int fd;
+
+	if (b_arg->argc < 3)
+		die("Usage: <diskname> <file size in MiB> <read count>");
+
+	size = get_argv(b_arg->argv[1]) << 20;
+	nreads = get_argv(b_arg->argv[2]);
+	nblocks = size / BENCH_BLOCK_SIZE;
+
+	fd = make_bench_file(b_arg->argv[0], size);
+
+	/* Random block-aligned 4 KiB reads, each preceded by a seek */
+	srand(150);
+	start = now();
+	for (i = 0; i < nreads; i++) {
+		if (fs_lseek(fd, (rand() % nblocks) * BENCH_BLOCK_SIZE))
+			die("Cannot seek");
+		if (fs_read(fd, buf, sizeof(buf)) != sizeof(buf))
+			die("Cannot read");
+	}
+	elapsed = now() - start;
+
+	printf("randread: %zu MiB file, %zu reads in %.3f s (%.1f us/read)\n",
+	       size >> 20, nreads, elapsed, elapsed * 1e6 / nreads);
+
+	fs_close(fd);
+	fs_umount();
+}
+
+void bench_journal(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const unsigned int batches[] = { 1, 4, 16, 64 };
+	char filename[FS_FILENAME_LEN];
+	size_t nops, jblocks, i, j;
+	double start, elapsed;
+
+	if (b_arg->argc < 3)
+		die("Usage: <diskname> <operation count> <journal block count>");
+
+	nops = get_argv(b_arg->argv[1]);
+	jblocks = get_argv(b_arg->argv[2]);
+	if (nops == 0)
+		die("invalid operation count");
+
+	/*
+	 * Create and delete files, committing the metadata every batch
+	 * operations. Each commit is made durable, so its cost is spread over
+	 * the operations of its batch.
+	 */
+	for (i = 0; i < ARRAY_SIZE(batches); i++) {
+		make_disk(b_arg->argv[0], 1024, jblocks);
+		if (fs_flush_config(batches[i]))
+			die("Cannot set flush interval");
+		if (fs_mount(b_arg->argv[0]))
+			die("Cannot mount disk");
+
+		start = now();
+		for (j = 0; j < nops; j++) {
+			snprintf(filename, sizeof(filename), "f%zu", j % 64);
+			if (j % 128 < 64 ? fs_create(filename) : fs_delete(filename))
+				die("Cannot create or delete '%s'", filename);
+		}
+		if (fs_sync())
+			die("Cannot sync");
+		elapsed = now() - start;
+
+		printf("journal: batch %2u, %zu ops in %.3f s (%.1f us/op)\n",
+		       batches[i], nops, elapsed, elapsed * 1e6 / nops);
+
+		if (fs_umount())
+			die("Cannot unmount disk");
+	}
+	fs_flush_config(FS_FLUSH_DEFAULT_INTERVAL);
+}
+
+void bench_records(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	char header[32], trailer[8], *payload;
+	struct iovec iov[3];
+	size_t nrecords, size, i;
+	double start, elapsed[2];
+	int fd, vectored;
+
+	if (b_arg->argc < 3)
+		die("Usage: <diskname> <record count> <payload size in bytes>");
+
+	nrecords = get_argv(b_arg->argv[1]);
+	size = get_argv(b_arg->argv[2]);
+	if (nrecords == 0)
+		die("invalid record count");
+
+	payload = malloc(size + 1);
+	if (!payload)
+		die_perror("malloc");
+	memset(header, 'H', sizeof(header));
+	memset(payload, 'P', size);
+	memset(trailer, 'T', sizeof(trailer));
+
+	/*
+	 * Append records made of a header, a payload and a trailer, either with
+	 * one fs_write() per part or with one fs_writev() per record.
+	 */
+	for (vectored = 0; vectored < 2; vectored++) {
+		make_disk(b_arg->argv[0], nrecords * (sizeof(header) + size +
+			  sizeof(trailer)) / BENCH_BLOCK_SIZE + 16, 0);
+		if (fs_mount(b_arg->argv[0]))
+			die("Cannot mount disk");
+		if (fs_create(BENCH_FILENAME))
+			die("Cannot create file");
+		fd = fs_open(BENCH_FILENAME);
+		if (fd < 0)
+			die("Cannot open file");
+
+		iov[0].iov_base = header;
+		iov[0].iov_len = sizeof(header);
+		iov[1].iov_base = payload;
+		iov[1].iov_len = size;
+		iov[2].iov_base = trailer;
+		iov[2].iov_len = sizeof(trailer);
+
+		start = now();
+		for (i = 0; i < nrecords; i++) {
+			if (vectored) {
+				if (fs_writev(fd, iov, 3) !=
+				    (int)(sizeof(header) + size + sizeof(trailer)))
+					die("Cannot write record");
+			} else {
+				if (fs_write(fd, header, sizeof(header)) !=
+				    sizeof(header) ||
+				    fs_write(fd, payload, size) != (int)size ||
+				    fs_write(fd, trailer, sizeof(trailer)) !=
+				    sizeof(trailer))
+					die("Cannot write record");
+			}
+		}
+		elapsed[vectored] = now() - start;
+
+		fs_close(fd);
+		if (fs_umount())
+			die("Cannot unmount disk");
+	}
+
+	printf("records: %zu records of %zu bytes, fs_write %.2f us/record, "
+	       "fs_writev %.2f us/record\n", nrecords,
+	       sizeof(header) + size + sizeof(trailer),
+	       elapsed[0] * 1e6 / nrecords, elapsed[1] * 1e6 / nrecords);
+
+	free(payload);
+}
+
+void bench_seqread(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	struct fs_cache_stats stats;
+	size_t size, chunk, done;
+	double start, elapsed;
+	char *buf;
+	int fd;
+
+	if (b_arg->argc < 3)
+		die("Usage: <diskname> <file size in MiB> <read size in bytes> "
+		    "[read-ahead blocks]");
+
+	size = get_argv(b_arg->argv[1]) << 20;
+	chunk = get_argv(b_arg->argv[2]);
+	if (chunk == 0 || chunk > size)
+		die("invalid read size %zu", chunk);
+	fs_readahead_config(b_arg->argc > 3 ? get_argv(b_arg->argv[3]) :
+			    FS_READAHEAD_DEFAULT_BLOCKS);
+
+	fd = make_bench_file(b_arg->argv[0], size);
+	buf = malloc(chunk);
+	if (!buf)
+		die_perror("malloc");
+
+	/* Read the whole file from the start, @chunk bytes at a time */
+	drop_page_cache(b_arg->argv[0]);
+	if (fs_lseek(fd, 0))
+		die("Cannot seek");
+	start = now();
+	for (done = 0; done + chunk <= size; done += chunk) {
+		if (fs_read(fd, buf, chunk) != (int)chunk)
+			die("Cannot read");
+	}
+	elapsed = now() - start;
+	if (fs_cache_stats(&stats))
+		die("Cannot get cache statistics");
+
+	printf("seqread: %zu MiB in %zu-byte reads, %.1f MiB/s, "
+	       "%llu blocks read ahead\n", size >> 20, chunk,
+	       (done >> 20) / elapsed, (unsigned long long)stats.prefetched);
+
+	free(buf);
+	fs_close(fd);
+	fs_umount();
+}
+
+void bench_seqwrite(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	size_t size, chunk, done;
+	double start, fs_time, raw_time;
+	char *buf;
+	int fd;
+
+	if (b_arg->argc < 3)
+		die("Usage: <diskname> <file size in MiB> <write size in bytes>");
+
+	size = get_argv(b_arg->argv[1]) << 20;
+	chunk = get_argv(b_arg->argv[2]);
+	if (chunk == 0 || chunk > size)
+		die("invalid write size %zu", chunk);
+
+	buf = malloc(chunk);
+	if (!buf)
+		die_perror("malloc");
+	memset(buf, 0x5A, chunk);
+
+	/* Sequential writes through the file system, including the write back */
+	make_disk(b_arg->argv[0], size / BENCH_BLOCK_SIZE + 16, 0);
+	if (fs_mount(b_arg->argv[0]))
+		die("Cannot mount disk");
+	if (fs_create(BENCH_FILENAME))
+		die("Cannot create file");
+	fd = fs_open(BENCH_FILENAME);
+	if (fd < 0)
+		die("Cannot open file");
+	start = now();
+	for (done = 0; done + chunk <= size; done += chunk) {
+		if (fs_write(fd, buf, chunk) != (int)chunk)
+			die("Cannot write");
+	}
+	fs_close(fd);
+	if (fs_umount())
+		die("Cannot unmount disk");
+	fs_time = now() - start;
+
+	/*
+	 * The same writes straight to the image file, for reference, made
+	 * durable as fs_umount() makes them
+	 */
+	fd = open(b_arg->argv[0], O_WRONLY);
+	if (fd < 0)
+		die_perror("open");
+	start = now();
+	for (done = 0; done + chunk <= size; done += chunk) {
+		if (write(fd, buf, chunk) != (ssize_t)chunk)
+			die_perror("write");
+	}
+	if (fdatasync(fd))
+		die_perror("fdatasync");
+	close(fd);
+	raw_time = now() - start;
+
+	printf("seqwrite: %zu MiB in %zu-byte writes, fs %.1f MiB/s, "
+	       "raw %.1f MiB/s\n", size >> 20, chunk,
+	       (done >> 20) / fs_time, (done >> 20) / raw_time);
+
+	free(buf);
+}
+
+/* Work of one stress thread: write its own file, then read it back */
+struct stress_arg {
+	int id;
+	size_t size;
+	size_t chunk;
+};
+
+static void *stress_thread(void *arg)
+{
+	struct stress_arg *s_arg = arg;
+	char filename[FS_FILENAME_LEN];
+	size_t done, i;
+	char *buf;
+	int fd;
+
+	buf = malloc(s_arg->chunk);
+	if (!buf)
+		die_perror("malloc");
+
+	snprintf(filename, sizeof(filename), "stress%d", s_arg->id);
+	fd = fs_open(filename);
+	if (fd < 0)
+		die("Cannot open '%s'", filename);
+
+	for (done = 0; done + s_arg->chunk <= s_arg->size; done += s_arg->chunk) {
+		memset(buf, s_arg->id + done / s_arg->chunk, s_arg->chunk);
+		if (fs_write(fd, buf, s_arg->chunk) != (int)s_arg->chunk)
+			die("Cannot write '%s'", filename);
+	}
+
+	if (fs_lseek(fd, 0))
+		die("Cannot seek '%s'", filename);
+	for (done = 0; done + s_arg->chunk <= s_arg->size; done += s_arg->chunk) {
+		if (fs_read(fd, buf, s_arg->chunk) != (int)s_arg->chunk)
+			die("Cannot read '%s'", filename);
+		for (i = 0; i < s_arg->chunk; i++) {
+			if (buf[i] != (char)(s_arg->id + done / s_arg->chunk))
+				die("Corrupted data in '%s' at %zu", filename,
+				    done + i);
+		}
+	}
+
+	fs_close(fd);
+	free(buf);
+	return NULL;
+}
+
+void bench_stress(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	struct stress_arg s_args[FS_OPEN_MAX_COUNT];
+	pthread_t threads[FS_OPEN_MAX_COUNT];
+	char filename[FS_FILENAME_LEN];
+	size_t size, chunk, max_threads, nthreads, i;
+	double start, elapsed, base = 0;
+
+	if (b_arg->argc < 4)
+		die("Usage: <diskname> <max threads> <file size in MiB> "
+		    "<I/O size in bytes>");
+
+	max_threads = get_argv(b_arg->argv[1]);
+	size = get_argv(b_arg->argv[2]) << 20;
+	chunk = get_argv(b_arg->argv[3]);
+	if (max_threads == 0 || max_threads > FS_OPEN_MAX_COUNT)
+		die("invalid thread count %zu", max_threads);
+	if (chunk == 0 || chunk > size)
+		die("invalid I/O size %zu", chunk);
+
+	/*
+	 * Each thread writes then reads back its own file. Doubling the number
+	 * of threads doubles the amount of work, so aggregate throughput shows
+	 * how well independent files scale.
+	 */
+	for (nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+		make_disk(b_arg->argv[0],
+			  nthreads * (size / BENCH_BLOCK_SIZE + 16), 0);
+		if (fs_mount(b_arg->argv[0]))
+			die("Cannot mount disk");
+		for (i = 0; i < nthreads; i++) {
+			snprintf(filename, sizeof(filename), "stress%zu", i);
+			if (fs_create(filename))
+				die("Cannot create '%s'", filename);
+		}
+
+		start = now();
+		for (i = 0; i < nthreads; i++) {
+			s_args[i].id = i;
+			s_args[i].size = size;
+			s_args[i].chunk = chunk;
+			if (pthread_create(&threads[i], NULL, stress_thread,
+					   &s_args[i]))
+				die("Cannot create thread");
+		}
+		for (i = 0; i < nthreads; i++)
+			pthread_join(threads[i], NULL);
+		elapsed = now() - start;
+
+		if (fs_umount())
+			die("Cannot unmount disk");
+
+		if (nthreads == 1)
+			base = elapsed;
+		printf("stress: %2zu threads, %.1f MiB/s, speedup %.2f\n",
+		       nthreads, 2.0 * nthreads * (size >> 20) / elapsed,
+		       nthreads * base / elapsed);
+	}
+}
+
+/* Name of member @i of the striped disk @manifest */
+static void member_name(char *name, const char *manifest, size_t i)
+{
+	snprintf(name, PATH_MAX, "%s.%zu", manifest, i);
+}
+
+/*
+ * Format @manifest as a disk striped over @nmembers images, with at least
+ * @data_blk data blocks. The file system is laid out in a plain image first,
+ * then copied block by block onto the striped disk.
+ */
+static void make_striped_disk(const char *manifest, size_t nmembers,
+			      size_t unit, size_t data_blk)
+{
+	char image[PATH_MAX], member[PATH_MAX];
+	size_t total, fat_blk_count, block, n, i;
+	const char *base;
+	char *buf;
+	FILE *f;
+	int fd;
+
+	/* The striped disk must hold exactly as many blocks as the file system */
+	for (;; data_blk++) {
+		fat_blk_count = (data_blk * 2 + BENCH_BLOCK_SIZE - 1) /
+				BENCH_BLOCK_SIZE;
+		total = 1 + fat_blk_count + 1 + data_blk;
+		if (total % (nmembers * unit) == 0)
+			break;
+	}
+
+	snprintf(image, sizeof(image), "%s.img", manifest);
+	make_disk(image, data_blk, 0);
+
+	f = fopen(manifest, "w");
+	if (!f)
+		die_perror("fopen");
+	fprintf(f, "stripe %zu\n", unit);
+	for (i = 0; i < nmembers; i++) {
+		member_name(member, manifest, i);
+		fd = open(member, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			die_perror("open");
+		if (ftruncate(fd, total / nmembers * BENCH_BLOCK_SIZE))
+			die_perror("ftruncate");
+		close(fd);
+
+		/* Members are found relative to the manifest */
+		base = strrchr(member, '/');
+		fprintf(f, "%s\n", base ? base + 1 : member);
+	}
+	fclose(f);
+
+	buf = malloc(256 * BENCH_BLOCK_SIZE);
+	fd = open(image, O_RDONLY);
+	if (!buf || fd < 0)
+		die_perror("open");
+	if (block_disk_open(manifest))
+		die("Cannot open '%s'", manifest);
+	for (block = 0; block < total; block += n) {
+		n = total - block < 256 ? total - block : 256;
+		if (pread(fd, buf, n * BENCH_BLOCK_SIZE,
+			  block * BENCH_BLOCK_SIZE) !=
+		    (ssize_t)(n * BENCH_BLOCK_SIZE))
+			die_perror("pread");
+		if (block_write_multi(block, n, buf))
+			die("Cannot write '%s'", manifest);
+	}
+	block_disk_close();
+	close(fd);
+	unlink(image);
+	free(buf);
+}
+
+void bench_stripe(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	char member[PATH_MAX];
+	size_t size, unit, max_members, nmembers, chunk, done, i;
+	double start, write_time, read_time;
+	char *buf;
+	int fd;
+
+	if (b_arg->argc < 4)
+		die("Usage: <manifest> <max members> <file size in MiB> "
+		    "<stripe unit in blocks>");
+
+	max_members = get_argv(b_arg->argv[1]);
+	size = get_argv(b_arg->argv[2]) << 20;
+	unit = get_argv(b_arg->argv[3]);
+	if (max_members == 0 || unit == 0)
+		die("invalid member count or stripe unit");
+
+	/* Sequential transfers span every member several times */
+	chunk = 1 << 20;
+	if (size < chunk)
+		die("file size must be at least 1 MiB");
+	buf = malloc(chunk);
+	if (!buf)
+		die_perror("malloc");
+	memset(buf, 0xA5, chunk);
+
+	for (nmembers = 1; nmembers <= max_members; nmembers *= 2) {
+		make_striped_disk(b_arg->argv[0], nmembers, unit,
+				  size / BENCH_BLOCK_SIZE + 16);
+		if (fs_mount(b_arg->argv[0]))
+			die("Cannot mount disk");
+		if (fs_create(BENCH_FILENAME))
+			die("Cannot create file");
+		fd = fs_open(BENCH_FILENAME);
+		if (fd < 0)
+			die("Cannot open file");
+
+		start = now();
+		for (done = 0; done + chunk <= size; done += chunk)
+			if (fs_write(fd, buf, chunk) != (int)chunk)
+				die("Cannot write file");
+		if (fs_sync())
+			die("Cannot sync");
+		write_time = now() - start;
+
+		/* Read back from the storage device */
+		for (i = 0; i < nmembers; i++) {
+			member_name(member, b_arg->argv[0], i);
+			evict_image(member);
+		}
+		start = now();
+		for (done = 0; done + chunk <= size; done += chunk)
+			if (fs_pread(fd, buf, chunk, done) != (int)chunk)
+				die("Cannot read file");
+		read_time = now() - start;
+
+		fs_close(fd);
+		if (fs_umount())
+			die("Cannot unmount disk");
+
+		printf("stripe: %2zu members, unit %zu blocks, write %.1f MiB/s, "
+		       "read %.1f MiB/s\n", nmembers, unit,
+		       (done >> 20) / write_time, (done >> 20) / read_time);
+
+		for (i = 0; i < nmembers; i++) {
+			member_name(member, b_arg->argv[0], i);
+			unlink(member);
+		}
+	}
+
+	unlink(b_arg->argv[0]);
+	free(buf);
+}
+
+/*
+ * Format @manifest as a disk mirrored over @nmembers images, with @data_blk
+ * data blocks. Every member starts as a copy of the same formatted image, so
+ * none is left out of sync by an earlier run.
+ */
+static void make_mirrored_disk(const char *manifest, const char *policy,
+			       size_t nmembers, size_t data_blk)
+{
+	char member[PATH_MAX], first[PATH_MAX], state[PATH_MAX];
+	char buf[64 * BENCH_BLOCK_SIZE];
+	const char *base;
+	int in, out;
+	ssize_t n;
+	FILE *f;
+	size_t i;
+
+	member_name(first, manifest, 0);
+	make_disk(first, data_blk, 0);
+	snprintf(state, sizeof(state), "%s.state", manifest);
+	if (unlink(state) && errno != ENOENT)
+		die_perror("unlink");
+
+	f = fopen(manifest, "w");
+	if (!f)
+		die_perror("fopen");
+	fprintf(f, "mirror %s\n", policy);
+	for (i = 0; i < nmembers; i++) {
+		member_name(member, manifest, i);
+		if (i > 0) {
+			in = open(first, O_RDONLY);
+			out = open(member, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (in < 0 || out < 0)
+				die_perror("open");
+			while ((n = read(in, buf, sizeof(buf))) > 0)
+				if (write(out, buf, n) != n)
+					die_perror("write");
+			if (n < 0)
+				die_perror("read");
+			close(in);
+			close(out);
+		}
+
+		/* Members are found relative to the manifest */
+		base = strrchr(member, '/');
+		fprintf(f, "%s\n", base ? base + 1 : member);
+	}
+	fclose(f);
+}
+
+/* Work of one mirror reader: random block reads of the benchmark file */
+struct mirror_arg {
+	int fd;
+	size_t nblocks;
+	size_t nreads;
+	unsigned int seed;
+};
+
+static void *mirror_thread(void *arg)
+{
+	struct mirror_arg *m_arg = arg;
+	char buf[BENCH_BLOCK_SIZE];
+	size_t i, block;
+
+	for (i = 0; i < m_arg->nreads; i++) {
+		block = rand_r(&m_arg->seed) % m_arg->nblocks;
+		if (fs_pread(m_arg->fd, buf, sizeof(buf),
+			     block * BENCH_BLOCK_SIZE) != sizeof(buf))
+			die("Cannot read file");
+	}
+
+	return NULL;
+}
+
+void bench_mirror(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const char *const policies[] = {
+		"shortest-queue",
+		"round-robin",
+	};
+	struct mirror_arg m_args[FS_OPEN_MAX_COUNT];
+	pthread_t threads[FS_OPEN_MAX_COUNT];
+	char member[PATH_MAX];
+	size_t size, nreads, nthreads, max_members, nmembers, chunk, done;
+	size_t p, i;
+	double start, elapsed;
+	char *buf;
+	int fd;
+
+	if (b_arg->argc < 5)
+		die("Usage: <manifest> <max members> <file size in MiB> "
+		    "<read count> <threads>");
+
+	max_members = get_argv(b_arg->argv[1]);
+	size = get_argv(b_arg->argv[2]) << 20;
+	nreads = get_argv(b_arg->argv[3]);
+	nthreads = get_argv(b_arg->argv[4]);
+	if (max_members == 0 || nreads == 0)
+		die("invalid member or read count");
+	if (nthreads == 0 || nthreads > FS_OPEN_MAX_COUNT)
+		die("invalid thread count %zu", nthreads);
+
+	chunk = 1 << 20;
+	if (size < chunk)
+		die("file size must be at least 1 MiB");
+	buf = malloc(chunk);
+	if (!buf)
+		die_perror("malloc");
+	memset(buf, 0xA5, chunk);
+
+	/* Every read goes to a member, not to the block cache */
+	fs_cache_config(0);
+
+	for (p = 0; p < ARRAY_SIZE(policies); p++) {
+		for (nmembers = 1; nmembers <= max_members; nmembers *= 2) {
+			make_mirrored_disk(b_arg->argv[0], policies[p],
+					   nmembers,
+					   size / BENCH_BLOCK_SIZE + 16);
+			if (fs_mount(b_arg->argv[0]))
+				die("Cannot mount disk");
+			if (fs_create(BENCH_FILENAME))
+				die("Cannot create file");
+			fd = fs_open(BENCH_FILENAME);
+			if (fd < 0)
+				die("Cannot open file");
+			for (done = 0; done + chunk <= size; done += chunk)
+				if (fs_write(fd, buf, chunk) != (int)chunk)
+					die("Cannot write file");
+			if (fs_sync())
+				die("Cannot sync");
+			for (i = 0; i < nmembers; i++) {
+				member_name(member, b_arg->argv[0], i);
+				evict_image(member);
+			}
+
+			start = now();
+			for (i = 0; i < nthreads; i++) {
+				m_args[i].fd = fd;
+				m_args[i].nblocks = size / BENCH_BLOCK_SIZE;
+				m_args[i].nreads = nreads / nthreads;
+				m_args[i].seed = i + 1;
+				if (pthread_create(&threads[i], NULL,
+						   mirror_thread, &m_args[i]))
+					die("Cannot create thread");
+			}
+			for (i = 0; i < nthreads; i++)
+				pthread_join(threads[i], NULL);
+			elapsed = now() - start;
+
+			fs_close(fd);
+			if (fs_umount())
+				die("Cannot unmount disk");
+
+			printf("mirror: %-14s %2zu members, %zu threads, "
+			       "%.0f reads/s\n", policies[p], nmembers,
+			       nthreads, nthreads * (nreads / nthreads) /
+			       elapsed);
+
+			for (i = 0; i < nmembers; i++) {
+				member_name(member, b_arg->argv[0], i);
+				unlink(member);
+			}
+		}
+	}
+
+	fs_cache_config(FS_CACHE_DEFAULT_BLOCKS);
+	unlink(b_arg->argv[0]);
+	free(buf);
+}
+
+/* Work of one volume thread: write then read back a file on its own disk */
+struct volume_arg {
+	char diskname[PATH_MAX];
+	struct fs_volume *fs;
+	size_t size;
+	size_t chunk;
+};
+
+static void *volume_thread(void *arg)
+{
+	struct volume_arg *v_arg = arg;
+	size_t done;
+	char *buf;
+	int fd;
+
+	buf = malloc(v_arg->chunk);
+	if (!buf)
+		die_perror("malloc");
+	memset(buf, 0x5A, v_arg->chunk);
+
+	fd = fs_open_h(v_arg->fs, BENCH_FILENAME);
+	if (fd < 0)
+		die("Cannot open '%s' on '%s'", BENCH_FILENAME,
+		    v_arg->diskname);
+
+	for (done = 0; done + v_arg->chunk <= v_arg->size;
+	     done += v_arg->chunk)
+		if (fs_write_h(v_arg->fs, fd, buf, v_arg->chunk) !=
+		    (int)v_arg->chunk)
+			die("Cannot write '%s'", v_arg->diskname);
+
+	for (done = 0; done + v_arg->chunk <= v_arg->size;
+	     done += v_arg->chunk)
+		if (fs_pread_h(v_arg->fs, fd, buf, v_arg->chunk, done) !=
+		    (int)v_arg->chunk)
+			die("Cannot read '%s'", v_arg->diskname);
+
+	fs_close_h(v_arg->fs, fd);
+	free(buf);
+	return NULL;
+}
+
+void bench_volumes(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	struct volume_arg *v_args;
+	pthread_t *threads;
+	size_t size, chunk, max_volumes, nvolumes, i;
+	double start, elapsed, base = 0;
+
+	if (b_arg->argc < 4)
+		die("Usage: <diskname prefix> <max volumes> "
+		    "<file size in MiB> <I/O size in bytes>");
+
+	max_volumes = get_argv(b_arg->argv[1]);
+	size = get_argv(b_arg->argv[2]) << 20;
+	chunk = get_argv(b_arg->argv[3]);
+	if (max_volumes == 0)
+		die("invalid volume count %zu", max_volumes);
+	if (chunk == 0 || chunk > size)
+		die("invalid I/O size %zu", chunk);
+
+	v_args = calloc(max_volumes, sizeof(*v_args));
+	threads = calloc(max_volumes, sizeof(*threads));
+	if (!v_args || !threads)
+		die_perror("calloc");
+
+	/*
+	 * Each thread works on its own disk image through its own volume.
+	 * Doubling the number of volumes doubles the amount of work, so
+	 * aggregate throughput shows how well independent volumes scale.
+	 */
+	for (nvolumes = 1; nvolumes <= max_volumes; nvolumes *= 2) {
+		for (i = 0; i < nvolumes; i++) {
+			snprintf(v_args[i].diskname,
+				 sizeof(v_args[i].diskname), "%s.%zu",
+				 b_arg->argv[0], i);
+			make_disk(v_args[i].diskname,
+				  size / BENCH_BLOCK_SIZE + 16, 0);
+			v_args[i].fs = fs_mount_h(v_args[i].diskname);
+			if (!v_args[i].fs)
+				die("Cannot mount '%s'", v_args[i].diskname);
+			if (fs_create_h(v_args[i].fs, BENCH_FILENAME))
+				die("Cannot create '%s' on '%s'",
+				    BENCH_FILENAME, v_args[i].diskname);
+			v_args[i].size = size;
+			v_args[i].chunk = chunk;
+		}
+
+		start = now();
+		for (i = 0; i < nvolumes; i++)
+			if (pthread_create(&threads[i], NULL, volume_thread,
+					   &v_args[i]))
+				die("Cannot create thread");
+		for (i = 0; i < nvolumes; i++)
+			pthread_join(threads[i], NULL);
+		elapsed = now() - start;
+
+		for (i = 0; i < nvolumes; i++) {
+			if (fs_umount_h(v_args[i].fs))
+				die("Cannot unmount '%s'", v_args[i].diskname);
+			unlink(v_args[i].diskname);
+		}
+
+		if (nvolumes == 1)
+			base = elapsed;
+		printf("volumes: %2zu volumes, %.1f MiB/s, speedup %.2f\n",
+		       nvolumes, 2.0 * nvolumes * (size >> 20) / elapsed,
+		       nvolumes * base / elapsed);
+	}
+
+	free(threads);
+	free(v_args);
+}
+
+/*
+ * Random 4 KiB reads of the benchmark file with @depth of them in flight.
+ * Return the elapsed time.
+ */
+static double aio_randread(int fd, size_t nblocks, size_t nreads,
+			   unsigned int depth, char *bufs)
+{
+	struct fs_aio_req reqs[FS_AIO_MAX_DEPTH];
+	struct fs_aio_req *ptrs[FS_AIO_MAX_DEPTH];
+	size_t issued = 0, done = 0;
+	double start;
+	unsigned int i;
+	int n;
+
+	if (fs_aio_setup(depth))
+		die("Cannot set up queue of depth %u", depth);
+
+	srand(150);
+	start = now();
+	for (i = 0; i < depth && issued < nreads; i++, issued++) {
+		reqs[i].opcode = FS_AIO_READ;
+		reqs[i].fd = fd;
+		reqs[i].buf = bufs + (size_t)i * BENCH_BLOCK_SIZE;
+		reqs[i].count = BENCH_BLOCK_SIZE;
+		reqs[i].offset = (rand() % nblocks) * BENCH_BLOCK_SIZE;
+		ptrs[i] = &reqs[i];
+	}
+	if (fs_aio_submit(ptrs, i) != (int)i)
+		die("Cannot submit");
+	while (done < nreads) {
+		n = fs_aio_reap(ptrs, 1, depth);
+		if (n <= 0)
+			die("Cannot reap");
+		done += n;
+		for (i = 0; i < (unsigned int)n; i++) {
+			if (ptrs[i]->result != BENCH_BLOCK_SIZE)
+				die("Cannot read");
+		}
+
+		/* Reuse the completed requests for the next reads */
+		for (i = 0; i < (unsigned int)n && issued < nreads;
+		     i++, issued++)
+			ptrs[i]->offset = (rand() % nblocks) * BENCH_BLOCK_SIZE;
+		if (i && fs_aio_submit(ptrs, i) != (int)i)
+			die("Cannot submit");
+	}
+
+	if (fs_aio_teardown())
+		die("Cannot tear down queue");
+	return now() - start;
+}
+
+void bench_aio(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	size_t size, nreads, nblocks;
+	double elapsed, base = 0;
+	unsigned int depth;
+	char *bufs;
+	int fd;
+
+	if (b_arg->argc < 3)
+		die("Usage: <diskname> <file size in MiB> <read count>");
+
+	size = get_argv(b_arg->argv[1]) << 20;
+	nreads = get_argv(b_arg->argv[2]);
+	nblocks = size / BENCH_BLOCK_SIZE;
+	if (nblocks == 0 || nreads == 0)
+		die("invalid file size or read count");
+
+	fd = make_bench_file(b_arg->argv[0], size);
+	bufs = malloc((size_t)FS_AIO_MAX_DEPTH * BENCH_BLOCK_SIZE);
+	if (!bufs)
+		die_perror("malloc");
+
+	for (depth = 1; depth <= 32; depth *= 2) {
+		drop_page_cache(b_arg->argv[0]);
+		elapsed = aio_randread(fd, nblocks, nreads, depth, bufs);
+		if (depth == 1)
+			base = elapsed;
+		printf("aio: depth %2u, %.0f reads/s, speedup %.2f\n", depth,
+		       nreads / elapsed, base / elapsed);
+	}
+
+	free(bufs);
+	fs_close(fd);
+	fs_umount();
+}
+
+void bench_backend(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const struct {
+		const char *name;
+		enum fs_io_backend backend;
+	} backends[] = {
+		{ "syscall",	FS_IO_SYSCALL },
+		{ "io_uring",	FS_IO_URING },
+	};
+	size_t size, count, nblocks, i, j;
+	double start, flush_time, read_time;
+	char *bufs;
+	int fd;
+
+	if (b_arg->argc < 3)
+		die("Usage: <diskname> <file size in MiB> <block count>");
+
+	size = get_argv(b_arg->argv[1]) << 20;
+	count = get_argv(b_arg->argv[2]);
+	nblocks = size / BENCH_BLOCK_SIZE;
+	if (count == 0 || count > nblocks / 2)
+		die("invalid block count %zu", count);
+
+	bufs = malloc((size_t)FS_AIO_MAX_DEPTH * BENCH_BLOCK_SIZE);
+	if (!bufs)
+		die_perror("malloc");
+	memset(bufs, 0x5A, (size_t)FS_AIO_MAX_DEPTH * BENCH_BLOCK_SIZE);
+
+	for (i = 0; i < ARRAY_SIZE(backends); i++) {
+		if (fs_io_config(backends[i].backend) ||
+		    fs_cache_config(count))
+			die("Cannot configure %s", backends[i].name);
+		fd = make_bench_file(b_arg->argv[0], size);
+		drop_page_cache(b_arg->argv[0]);
+
+		/* Dirty @count scattered blocks, then write them back */
+		srand(150);
+		for (j = 0; j < count; j++) {
+			if (fs_pwrite(fd, bufs, BENCH_BLOCK_SIZE,
+				      2 * (rand() % (nblocks / 2)) *
+				      BENCH_BLOCK_SIZE) != BENCH_BLOCK_SIZE)
+				die("Cannot write");
+		}
+		start = now();
+		if (fs_sync())
+			die("Cannot sync");
+		flush_time = now() - start;
+
+		drop_page_cache(b_arg->argv[0]);
+		read_time = aio_randread(fd, nblocks, count, 16, bufs);
+
+		printf("backend: %-8s flush of %zu scattered blocks %.2f ms, "
+		       "%.0f reads/s at depth 16\n", backends[i].name, count,
+		       flush_time * 1e3, count / read_time);
+
+		fs_close(fd);
+		fs_umount();
+	}
+
+	fs_io_config(FS_IO_SYSCALL);
+	fs_cache_config(FS_CACHE_DEFAULT_BLOCKS);
+	free(bufs);
+}
+
+/*
+ * Read @total bytes of the benchmark file in @chunk-byte reads, from the start
+ * or at random offsets. Return the elapsed time.
+ */
+static double read_pass(int fd, size_t size, size_t total, size_t chunk,
+			int random, char *buf)
+{
+	size_t done, offset = 0;
+	double start;
+
+	srand(150);
+	start = now();
+	for (done = 0; done + chunk <= total; done += chunk) {
+		if (random)
+			offset = (rand() % (size / chunk)) * chunk;
+		if (fs_pread(fd, buf, chunk, offset) != (int)chunk)
+			die("Cannot read");
+		offset = (offset + chunk) % size;
+	}
+	return now() - start;
+}
+
+void bench_mmap(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const struct {
+		const char *name;
+		enum fs_io_backend backend;
+	} backends[] = {
+		{ "syscall",	FS_IO_SYSCALL },
+		{ "mmap",	FS_IO_MMAP },
+	};
+	static const size_t chunks[] = { 100, 4096 };
+	size_t size, nreads, i, j;
+	double elapsed;
+	char buf[BENCH_BLOCK_SIZE];
+	int fd;
+
+	if (b_arg->argc < 3)
+		die("Usage: <diskname> <file size in MiB> <random read count>");
+
+	size = get_argv(b_arg->argv[1]) << 20;
+	nreads = get_argv(b_arg->argv[2]);
+	if (size == 0 || nreads == 0)
+		die("invalid file size or read count");
+
+	for (i = 0; i < ARRAY_SIZE(backends); i++) {
+		if (fs_io_config(backends[i].backend))
+			die("Cannot configure %s", backends[i].name);
+		fd = make_bench_file(b_arg->argv[0], size);
+
+		/* The first pass finds the image out of the page cache */
+		if (fs_close(fd) || fs_umount())
+			die("Cannot unmount");
+		evict_image(b_arg->argv[0]);
+		if (fs_mount(b_arg->argv[0]))
+			die("Cannot mount disk");
+		fd = fs_open(BENCH_FILENAME);
+		if (fd < 0)
+			die("Cannot open file");
+		elapsed = read_pass(fd, size, size, BENCH_BLOCK_SIZE, 0, buf);
+		printf("mmap: %-8s sequential %5zu-byte reads, cold %.1f MiB/s\n",
+		       backends[i].name, (size_t)BENCH_BLOCK_SIZE,
+		       (size >> 20) / elapsed);
+
+		for (j = 0; j < ARRAY_SIZE(chunks); j++) {
+			elapsed = read_pass(fd, size, size, chunks[j], 0, buf);
+			printf("mmap: %-8s sequential %5zu-byte reads, warm "
+			       "%.1f MiB/s\n", backends[i].name, chunks[j],
+			       (size >> 20) / elapsed);
+			elapsed = read_pass(fd, size, nreads * chunks[j],
+					    chunks[j], 1, buf);
+			printf("mmap: %-8s random     %5zu-byte reads, warm "
+			       "%.2f us/read\n", backends[i].name, chunks[j],
+			       elapsed * 1e6 / nreads);
+		}
+
+		fs_close(fd);
+		fs_umount();
+	}
+
+	fs_io_config(FS_IO_SYSCALL);
+}
+
+/* Resident set size of the process, in KiB */
+static size_t rss_kib(void)
+{
+	char line[128];
+	size_t kib = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/status", "r");
+	if (!f)
+		die_perror("fopen");
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "VmRSS: %zu kB", &kib) == 1)
+			break;
+	fclose(f);
+
+	return kib;
+}
+
+/* Amount of @diskname held in the page cache, in KiB */
+static size_t page_cache_kib(const char *diskname)
+{
+	size_t pages, resident = 0, i;
+	long page_size = sysconf(_SC_PAGESIZE);
+	unsigned char *vec;
+	struct stat st;
+	void *base;
+	int fd;
+
+	fd = open(diskname, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st))
+		die_perror("open");
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED)
+		die_perror("mmap");
+	pages = (st.st_size + page_size - 1) / page_size;
+	vec = malloc(pages);
+	if (!vec)
+		die_perror("malloc");
+	if (mincore(base, st.st_size, vec))
+		die_perror("mincore");
+	for (i = 0; i < pages; i++)
+		resident += vec[i] & 1;
+
+	free(vec);
+	munmap(base, st.st_size);
+	close(fd);
+
+	return resident * page_size / 1024;
+}
+
+void bench_direct(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const struct {
+		const char *name;
+		enum fs_io_backend backend;
+	} backends[] = {
+		{ "buffered",	FS_IO_SYSCALL },
+		{ "direct",	FS_IO_DIRECT },
+	};
+	size_t size, nreads, rss, i;
+	double cold, warm, random;
+	char buf[BENCH_BLOCK_SIZE];
+	int fd;
+
+	if (b_arg->argc < 3)
+		die("Usage: <diskname> <file size in MiB> <random read count>");
+
+	size = get_argv(b_arg->argv[1]) << 20;
+	nreads = get_argv(b_arg->argv[2]);
+	if (size == 0 || nreads == 0)
+		die("invalid file size or read count");
+
+	for (i = 0; i < ARRAY_SIZE(backends); i++) {
+		if (fs_io_config(backends[i].backend))
+			die("Cannot configure %s", backends[i].name);
+		fd = make_bench_file(b_arg->argv[0], size);
+
+		/* Start from an image out of the page cache */
+		if (fs_close(fd) || fs_umount())
+			die("Cannot unmount");
+		evict_image(b_arg->argv[0]);
+		if (fs_mount(b_arg->argv[0]))
+			die("Cannot mount disk");
+		fd = fs_open(BENCH_FILENAME);
+		if (fd < 0)
+			die("Cannot open file");
+
+		cold = read_pass(fd, size, size, BENCH_BLOCK_SIZE, 0, buf);
+		warm = read_pass(fd, size, size, BENCH_BLOCK_SIZE, 0, buf);
+		random = read_pass(fd, size, nreads * BENCH_BLOCK_SIZE,
+				   BENCH_BLOCK_SIZE, 1, buf);
+		rss = rss_kib();
+
+		printf("direct: %-8s sequential cold %.1f MiB/s, warm %.1f "
+		       "MiB/s, random %.2f us/read\n", backends[i].name,
+		       (size >> 20) / cold, (size >> 20) / warm,
+		       random * 1e6 / nreads);
+		printf("direct: %-8s RSS %zu KiB, image in page cache %zu "
+		       "KiB\n", backends[i].name, rss,
+		       page_cache_kib(b_arg->argv[0]));
+
+		fs_close(fd);
+		fs_umount();
+	}
+
+	fs_io_config(FS_IO_SYSCALL);
+}
+
+/*
+ * Poll the free counts of the largest disk after a lazy mount, first from a
+ * freshly formatted disk, whose FAT is read by the first call, then from the
+ * summary the unmount left in the superblock.
+ */
+void bench_info(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const char *const sources[] = { "rescan", "summary" };
+	struct fs_info_stats stats;
+	size_t calls, i, j;
+	double start, first, total;
+
+	if (b_arg->argc < 2)
+		die("Usage: <diskname> <call count>");
+
+	calls = get_argv(b_arg->argv[1]);
+	if (calls == 0)
+		die("invalid call count %zu", calls);
+
+	make_disk(b_arg->argv[0], 65501, 0);
+	if (fs_fat_config(FS_FAT_LAZY))
+		die("Cannot configure lazy FAT");
+
+	for (i = 0; i < ARRAY_SIZE(sources); i++) {
+		evict_image(b_arg->argv[0]);
+		if (fs_mount(b_arg->argv[0]))
+			die("Cannot mount disk");
+
+		start = now();
+		if (fs_info_stats(&stats))
+			die("Cannot get info");
+		first = now() - start;
+
+		start = now();
+		for (j = 0; j < calls; j++) {
+			if (fs_info_stats(&stats))
+				die("Cannot get info");
+		}
+		total = now() - start;
+
+		printf("info: %-7s first call %8.1f us, then %6.1f ns per call, "
+		       "%zu/%zu blocks free\n", sources[i], first * 1e6,
+		       total / calls * 1e9, stats.fat_free,
+		       stats.data_blk_count);
+
+		if (fs_umount())
+			die("Cannot unmount disk");
+	}
+
+	fs_fat_config(FS_FAT_EAGER);
+}
+
+/*
+ * Mount and unmount a cold disk of each size under both FAT modes. The first
+ * unmount leaves the free block summary a lazy mount reports from.
+ */
+void bench_mount(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const struct {
+		const char *name;
+		enum fs_fat_mode mode;
+	} modes[] = {
+		{ "eager",	FS_FAT_EAGER },
+		{ "lazy",	FS_FAT_LAZY },
+	};
+	/* The largest disk has as many blocks as a 16-bit count allows */
+	static const size_t sizes[] = { 1024, 8192, 32768, 65501 };
+	size_t runs, i, j, k;
+	double start, total;
+
+	if (b_arg->argc < 2)
+		die("Usage: <diskname> <runs>");
+
+	runs = get_argv(b_arg->argv[1]);
+	if (runs == 0)
+		die("invalid run count %zu", runs);
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		make_disk(b_arg->argv[0], sizes[i], 0);
+		if (fs_mount(b_arg->argv[0]) || fs_umount())
+			die("Cannot mount disk");
+
+		for (j = 0; j < ARRAY_SIZE(modes); j++) {
+			if (fs_fat_config(modes[j].mode))
+				die("Cannot configure %s", modes[j].name);
+
+			total = 0;
+			for (k = 0; k < runs; k++) {
+				evict_image(b_arg->argv[0]);
+				start = now();
+				if (fs_mount(b_arg->argv[0]))
+					die("Cannot mount disk");
+				total += now() - start;
+				if (fs_umount())
+					die("Cannot unmount disk");
+			}
+
+			printf("mount: %-5s %5zu data blocks %8.1f us\n",
+			       modes[j].name, sizes[i], total / runs * 1e6);
+		}
+	}
+
+	fs_fat_config(FS_FAT_EAGER);
+}
+
+static struct {
+	const char *name;
+	void(*func)(void *);
+} commands[] = {
+	{ "aio",	bench_aio },
+	{ "backend",	bench_backend },
+	{ "direct",	bench_direct },
+	{ "info",	bench_info },
+	{ "journal",	bench_journal },
+	{ "mirror",	bench_mirror },
+	{ "mkfs",	bench_mkfs },
+	{ "mmap",	bench_mmap },
+	{ "mount",	bench_mount },
+	{ "randread",	bench_randread },
+	{ "records",	bench_records },
+	{ "seqread",	bench_seqread },
+	{ "seqwrite",	bench_seqwrite },
+	{ "stress",	bench_stress },
+	{ "stripe",	bench_stripe },
+	{ "volumes",	bench_volumes },
+};
+
+void usage(char *program)
+{
+	size_t i;
+	fprintf(stderr, "Usage: %s <command> [<arg>]\n", program);
+	fprintf(stderr, "Possible commands are:\n");
+	for (i = 0; i < ARRAY_SIZE(commands); i++)
+		fprintf(stderr, "\t%s\n", commands[i].name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	size_t i;
+	char *program;
+	char *cmd;
+	struct bench_arg arg;
+
+	program = argv[0];
+
+	if (argc == 1)
+		usage(program);
+
+	/* Skip argv[0] */
+	argc--;
+	argv++;
+
+	cmd = argv[0];
+	arg.argc = --argc;
+	arg.argv = &argv[1];
+
+	for (i = 0; i < ARRAY_SIZE(commands); i++) {
+		if (!strcmp(cmd, commands[i].name)) {
+			commands[i].func(&arg);
+			break;
+		}
+	}
+	if (i == ARRAY_SIZE(commands)) {
+		fs_bench_error("invalid command '%s'", cmd);
+		usage(program);
+	}
+
+	return 0;
+}
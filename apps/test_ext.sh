@@ -0,0 +1,206 @@
+#!/bin/bash
+
+# Extended file system calls and disk layouts, each checked by reading the data
+# back. Every section formats its own disk and removes its files when done.
+
+fail() {
+    echo "FAIL: ${*}"
+    exit 1
+}
+
+# Print the content of file $2 on disk $1, without the header of cat
+content() {
+    ./test_fs.x cat "${1}" "${2}" | tail -n +3
+}
+
+# fs_fallocate(): a write lands in preallocated blocks, which stay allocated
+# without growing the file
+./fs_bench.x mkfs alloc.fs 100 || fail "cannot format disk"
+cat <<END_SCRIPT > alloc.script
+MOUNT
+CREATE	alloc
+OPEN	alloc
+FALLOCATE	4
+WRITE	DATA	hello world
+CLOSE
+UMOUNT
+END_SCRIPT
+./test_fs.x script alloc.fs alloc.script > /dev/null ||
+    fail "cannot run script"
+[ "$(content alloc.fs alloc)" = "hello world" ] ||
+    fail "write into preallocated blocks lost"
+./test_fs.x stat alloc.fs alloc | grep -q "is 11 bytes" ||
+    fail "preallocation changed the file size"
+./test_fs.x info alloc.fs | grep -q "^fat_free_ratio=95/100$" ||
+    fail "preallocated blocks not kept"
+rm alloc.fs alloc.script
+
+# fs_pread() and fs_pwrite(): positional transfers leave the file offset
+# alone, overwrite in place and may extend the file from its end
+./fs_bench.x mkfs pos.fs 100 || fail "cannot format disk"
+cat <<END_SCRIPT > pos.script
+MOUNT
+CREATE	pos
+OPEN	pos
+WRITE	DATA	hello world
+PWRITE	6	there
+PWRITE	11	!
+PREAD	0	hello there!
+PREAD	4	o th
+WRITE	DATA	?
+CLOSE
+UMOUNT
+END_SCRIPT
+./test_fs.x script pos.fs pos.script > pos.out || fail "cannot run script"
+grep -q "unexpected" pos.out && fail "$(grep unexpected pos.out)"
+[ "$(grep -c "correct" pos.out)" -eq 2 ] || fail "missing read back"
+[ "$(content pos.fs pos)" = "hello there?" ] ||
+    fail "positional writes lost or moved the file offset"
+rm pos.fs pos.script pos.out
+
+# fs_readv() and fs_writev(): each transfer is split over three buffers
+./fs_bench.x mkfs vec.fs 100 || fail "cannot format disk"
+cat <<END_SCRIPT > vec.script
+MOUNT
+CREATE	vec
+OPEN	vec
+WRITEV	0123456789ab
+WRITEV	cdefghijklmnop
+SEEK	0
+READV	0123456789abcdefghijklmnop
+SEEK	10
+READV	abcdef
+CLOSE
+UMOUNT
+END_SCRIPT
+./test_fs.x script vec.fs vec.script > vec.out || fail "cannot run script"
+grep -q "unexpected" vec.out && fail "$(grep unexpected vec.out)"
+[ "$(grep -c "correct" vec.out)" -eq 2 ] || fail "missing read back"
+[ "$(content vec.fs vec)" = "0123456789abcdefghijklmnop" ] ||
+    fail "vectored writes lost"
+rm vec.fs vec.script vec.out
+
+# fs_aio_submit() and fs_aio_reap(): writes, reads and a sync in flight at
+# once, each checked on completion, then the written blocks read back
+./fs_bench.x mkfs aio.fs 100 || fail "cannot format disk"
+printf 'MOUNT\nCREATE\taio\nOPEN\taio\nAIO\t32\nCLOSE\nUMOUNT\n' > aio.script
+./test_fs.x script aio.fs aio.script | grep -q "^AIO successful.$" ||
+    fail "asynchronous transfers failed"
+for ((i = 0; i < 32; i++)); do
+    letter=Z
+    [ ${i} -lt 16 ] && letter=$(printf "\\$(printf %o $((97 + i % 26)))")
+    head -c 4096 /dev/zero | tr '\0' "${letter}"
+done > aio.expected
+content aio.fs aio | cmp -s - aio.expected ||
+    fail "asynchronous writes lost"
+rm aio.fs aio.script aio.expected
+
+# fs_mount_h(): two volumes mounted at once keep their data apart, and neither
+# can be unmounted while it has an asynchronous request queue
+./fs_bench.x mkfs vol0.fs 100 || fail "cannot format disk"
+./fs_bench.x mkfs vol1.fs 100 || fail "cannot format disk"
+./test_fs.x volumes vol0.fs vol1.fs | grep -q "^Volumes successful.$" ||
+    fail "volumes mixed up"
+[ "$(content vol0.fs volume)" = "vol0.fs" ] || fail "first volume lost"
+[ "$(content vol1.fs volume)" = "vol1.fs" ] || fail "second volume lost"
+rm vol0.fs vol1.fs
+
+# Striping: 100 blocks in units of 2 blocks over two 50-block members. Logical
+# block b is block (b / 4) * 2 + b % 2 of member (b / 2) % 2.
+seq 1 4000 > stripe.data
+./fs_bench.x mkfs stripe.fs 97 || fail "cannot format disk"
+for ((u = 0; u < 50; u++)); do
+    dd if=stripe.fs of=stripe$((u % 2)).img bs=4096 skip=$((u * 2)) \
+       seek=$((u / 2 * 2)) count=2 conv=notrunc status=none
+done
+printf 'stripe 2\nstripe0.img\nstripe1.img\n' > stripe.disk
+./test_fs.x add stripe.disk stripe.data > /dev/null ||
+    fail "cannot add to stripe"
+content stripe.disk stripe.data | cmp -s - stripe.data ||
+    fail "striped disk read back differs"
+rm stripe.fs
+for ((u = 0; u < 50; u++)); do
+    dd if=stripe$((u % 2)).img of=stripe.fs bs=4096 skip=$((u / 2 * 2)) \
+       seek=$((u * 2)) count=2 conv=notrunc status=none
+done
+content stripe.fs stripe.data | cmp -s - stripe.data ||
+    fail "blocks not where the stripe mapping puts them"
+rm stripe.data stripe.fs stripe0.img stripe1.img stripe.disk
+
+# Mirroring: member 1, recorded out of sync in the state file, misses a write
+# until it is resynchronized, then holds the data of both writes
+seq 1 4000 > mirror.data
+seq 4000 -1 1 > mirror.late
+./fs_bench.x mkfs mirror0.img 100 || fail "cannot format disk"
+cp mirror0.img mirror1.img
+printf 'mirror\nmirror0.img\nmirror1.img\n' > mirror.disk
+printf 'mirror\nmirror1.img\n' > member.disk
+./test_fs.x add mirror.disk mirror.data > /dev/null ||
+    fail "cannot add to mirror"
+printf 'members 2\nstale 1\n' > mirror.disk.state
+./test_fs.x add mirror.disk mirror.late > /dev/null ||
+    fail "cannot add to mirror"
+./test_fs.x cat member.disk mirror.late > /dev/null 2>&1 &&
+    fail "stale member written"
+[ -f mirror.disk.state ] || fail "stale member forgotten"
+./disk_resync.x mirror.disk 1 || fail "cannot resync member"
+[ -f mirror.disk.state ] && fail "resynchronized member still stale"
+content member.disk mirror.data | cmp -s - mirror.data ||
+    fail "resynchronized member differs"
+content member.disk mirror.late | cmp -s - mirror.late ||
+    fail "resynchronized member differs"
+rm mirror.data mirror.late mirror0.img mirror1.img mirror.disk member.disk
+
+# fs_fat_config(): a lazy mount reports the free counts of the summary left by
+# the last unmount, a delete and a write then load the whole FAT, and an eager
+# mount afterwards reports the same counts as the lazy one
+seq 1 3000 > lazy.data
+./fs_bench.x mkfs lazy.fs 100 || fail "cannot format disk"
+./test_fs.x add lazy.fs lazy.data > /dev/null || fail "cannot add file"
+cat <<END_SCRIPT > lazy.script
+FAT	LAZY
+MOUNT
+INFO
+DELETE	lazy.data
+CREATE	lazy
+OPEN	lazy
+WRITE	DATA	hello
+CLOSE
+INFO
+UMOUNT
+END_SCRIPT
+./test_fs.x script lazy.fs lazy.script > lazy.out || fail "cannot run script"
+[ "$(grep _free_ratio lazy.out | head -n 2 | tr '\n' ' ')" = \
+  "fat_free_ratio=95/100 rdir_free_ratio=127/128 " ] ||
+    fail "lazy mount reports wrong counts"
+[ "$(grep _free_ratio lazy.out | tail -n 2 | tr '\n' ' ')" = \
+  "fat_free_ratio=98/100 rdir_free_ratio=127/128 " ] ||
+    fail "counts wrong after the FAT was loaded"
+[ "$(./test_fs.x info lazy.fs | grep _free_ratio | tr '\n' ' ')" = \
+  "fat_free_ratio=98/100 rdir_free_ratio=127/128 " ] ||
+    fail "eager mount disagrees with the lazy one"
+[ "$(content lazy.fs lazy)" = "hello" ] || fail "lazy mount lost a write"
+rm lazy.data lazy.fs lazy.script lazy.out
+
+# fs_info_stats() and the summary: a lazy mount trusts a summary that agrees
+# with the root directory, and reads the whole FAT when it does not. The free
+# block count sits at byte 29 of the superblock, the free entry count at 31.
+seq 1 3000 > stats.data
+./fs_bench.x mkfs stats.fs 100 || fail "cannot format disk"
+./test_fs.x add stats.fs stats.data > /dev/null || fail "cannot add file"
+printf 'FAT\tLAZY\nMOUNT\nINFO\nSTATS\nUMOUNT\n' > stats.script
+printf '\x32\x00' | dd of=stats.fs bs=1 seek=29 conv=notrunc status=none
+./test_fs.x script stats.fs stats.script > stats.out ||
+    fail "cannot run script"
+[ "$(grep -c "^fat_free_ratio=50/100$" stats.out)" -eq 2 ] ||
+    fail "summary not used by a lazy mount"
+printf '\x64' | dd of=stats.fs bs=1 seek=31 conv=notrunc status=none
+./test_fs.x script stats.fs stats.script > stats.out ||
+    fail "cannot run script"
+[ "$(grep -c "^fat_free_ratio=95/100$" stats.out)" -eq 2 ] ||
+    fail "summary disagreeing with the root directory trusted"
+grep -A 7 "^FS Info:$" stats.out | split -l 8 - stats.part.
+cmp -s stats.part.aa stats.part.ab || fail "fs_info_stats() differs"
+rm stats.data stats.fs stats.script stats.out stats.part.aa stats.part.ab
+
+echo "Extension tests passed!"
@@ -10,6 +10,7 @@
 #include <unistd.h>
 
 #include <fs.h>
+#include <fs_ext.h>
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
@@ -34,6 +35,119 @@ struct thread_arg {
 	char **argv;
 };
 
+/* Largest number of blocks transferred by the AIO script command */
+#define AIO_BLOCKS 64
+#define AIO_BLOCK_SIZE 4096
+
+/* Submit @nreqs requests, and reap them all as the queue makes room */
+static int aio_run(struct fs_aio_req **reqs, int nreqs)
+{
+	struct fs_aio_req *done[AIO_BLOCKS + 2];
+	int submitted = 0, reaped = 0, n;
+
+	while (reaped < nreqs) {
+		n = fs_aio_submit(reqs + submitted, nreqs - submitted);
+		if (n < 0)
+			return -1;
+		submitted += n;
+
+		n = fs_aio_reap(done, 1, ARRAY_SIZE(done));
+		if (n < 0)
+			return -1;
+		reaped += n;
+	}
+
+	return 0;
+}
+
+/* Tell whether each byte of the block @buf is @c */
+static int aio_filled(const char *buf, char c)
+{
+	int i;
+
+	for (i = 0; i < AIO_BLOCK_SIZE; i++)
+		if (buf[i] != c)
+			return 0;
+
+	return 1;
+}
+
+/*
+ * Fill the file @fd with @nblocks blocks of 'Z', then overwrite the first half
+ * with a letter per block while reading the second half and syncing, all
+ * through the asynchronous queue. Check the result of every request, then read
+ * the first half back through the queue as well.
+ */
+static int aio_check(int fd, int nblocks)
+{
+	static char bufs[AIO_BLOCKS][AIO_BLOCK_SIZE];
+	struct fs_aio_req reqs[AIO_BLOCKS + 2], *ptrs[AIO_BLOCKS + 2];
+	int nwrites = nblocks / 2, nreqs = 0, ret = 0, i;
+
+	memset(bufs[0], 'Z', AIO_BLOCK_SIZE);
+	for (i = 0; i < nblocks; i++)
+		if (fs_write(fd, bufs[0], AIO_BLOCK_SIZE) != AIO_BLOCK_SIZE)
+			return -1;
+
+	if (fs_aio_setup(8))
+		return -1;
+
+	/* Writes and reads of distinct blocks, with a sync among them */
+	for (i = 0; i < nblocks; i++) {
+		if (i == nwrites) {
+			memset(&reqs[nreqs], 0, sizeof(reqs[nreqs]));
+			reqs[nreqs].opcode = FS_AIO_SYNC;
+			reqs[nreqs].result = -1;
+			ptrs[nreqs] = &reqs[nreqs];
+			nreqs++;
+		}
+		memset(bufs[i], i < nwrites ? 'a' + i % 26 : 0, AIO_BLOCK_SIZE);
+		reqs[nreqs].opcode = i < nwrites ? FS_AIO_WRITE : FS_AIO_READ;
+		reqs[nreqs].fd = fd;
+		reqs[nreqs].buf = bufs[i];
+		reqs[nreqs].count = AIO_BLOCK_SIZE;
+		reqs[nreqs].offset = (size_t)i * AIO_BLOCK_SIZE;
+		reqs[nreqs].user_data = bufs[i];
+		reqs[nreqs].result = -1;
+		ptrs[nreqs] = &reqs[nreqs];
+		nreqs++;
+	}
+	if (aio_run(ptrs, nreqs))
+		ret = -1;
+	for (i = 0; i < nreqs && !ret; i++) {
+		if (reqs[i].opcode == FS_AIO_SYNC)
+			ret = reqs[i].result == 0 ? 0 : -1;
+		else if (reqs[i].result != AIO_BLOCK_SIZE)
+			ret = -1;
+		else if (reqs[i].opcode == FS_AIO_READ &&
+			 !aio_filled(reqs[i].user_data, 'Z'))
+			ret = -1;
+	}
+
+	/* Read the written blocks back */
+	for (i = 0; i < nwrites && !ret; i++) {
+		memset(bufs[i], 0, AIO_BLOCK_SIZE);
+		reqs[i].opcode = FS_AIO_READ;
+		reqs[i].fd = fd;
+		reqs[i].buf = bufs[i];
+		reqs[i].count = AIO_BLOCK_SIZE;
+		reqs[i].offset = (size_t)i * AIO_BLOCK_SIZE;
+		reqs[i].result = -1;
+		ptrs[i] = &reqs[i];
+	}
+	if (!ret && aio_run(ptrs, nwrites))
+		ret = -1;
+	for (i = 0; i < nwrites && !ret; i++)
+		if (reqs[i].result != AIO_BLOCK_SIZE ||
+		    !aio_filled(bufs[i], 'a' + i % 26))
+			ret = -1;
+
+	if (fs_aio_teardown())
+		ret = -1;
+
+	return ret;
+}
+
 void thread_fs_script(void *arg)
 {
 	struct thread_arg *t_arg = arg;
@@ -45,6 +159,7 @@ void thread_fs_script(void *arg)
 	char *command_args[total_command_parts];
 	int offset;
 	char mounted = 0;
+	struct fs_info_stats stats;
 
 	char line_buffer[1024];
 	int command_index = 1;
@@ -102,6 +217,20 @@ void thread_fs_script(void *arg)
 				mounted = 0;
 			}
 
+		} else if (strcmp(command, "SYNC") == 0) {
+			if (fs_sync()) {
+				fs_umount();
+				die("Cannot sync");
+			}
+
+			printf("SYNC successful.\n");
+
+		} else if (strcmp(command, "CRASH") == 0) {
+			/* Leave without unmounting, as a crash right here would */
+			printf("CRASH successful.\n");
+			fflush(stdout);
+			_exit(0);
+
 		} else if (strcmp(command, "CREATE") == 0) {
 			fs_filename = command_args[1];
 
@@ -258,6 +387,123 @@ void thread_fs_script(void *arg)
 			if(file_loaded){
 				free(data);
 			}
+
+		} else if (strcmp(command, "PWRITE") == 0) {
+			offset = atoi(command_args[1]);
+			data = command_args[2];
+			data_size = strlen(data);
+
+			count = fs_pwrite(fs_fd, data, data_size, offset);
+			if (count != data_size) {
+				fs_umount();
+				die("pwrite error");
+			}
+			printf("Wrote %d bytes to file at %d.\n", count, offset);
+
+		} else if (strcmp(command, "PREAD") == 0) {
+			offset = atoi(command_args[1]);
+			data = command_args[2];
+			data_size = strlen(data);
+
+			read_buf = calloc(data_size + 1, sizeof(char));
+			count = fs_pread(fs_fd, read_buf, data_size, offset);
+			if (count < 0) {
+				fs_umount();
+				die("pread error");
+			}
+
+			if (memcmp(data, read_buf, data_size + 1) == 0)
+				printf("Read %d bytes from file. Compared %d correct.\n", count, data_size);
+			else
+				printf("Read unexpected data! %s read vs given %s\n", read_buf, data);
+			free(read_buf);
+
+		} else if (strcmp(command, "WRITEV") == 0 ||
+			   strcmp(command, "READV") == 0) {
+			/* Transfer the data in three pieces of a vector */
+			struct iovec iov[3];
+			int i, piece;
+
+			data = command_args[1];
+			data_size = strlen(data);
+			read_buf = calloc(data_size + 1, sizeof(char));
+			piece = data_size / 3;
+			for (i = 0; i < 3; i++) {
+				iov[i].iov_base = (command[0] == 'W' ? data : read_buf) + i * piece;
+				iov[i].iov_len = i < 2 ? piece : data_size - 2 * piece;
+			}
+
+			if (command[0] == 'W') {
+				count = fs_writev(fs_fd, iov, 3);
+				if (count != data_size) {
+					fs_umount();
+					die("writev error");
+				}
+				printf("Wrote %d bytes to file.\n", count);
+			} else {
+				count = fs_readv(fs_fd, iov, 3);
+				if (count < 0) {
+					fs_umount();
+					die("readv error");
+				}
+				if (memcmp(data, read_buf, data_size + 1) == 0)
+					printf("Read %d bytes from file. Compared %d correct.\n", count, data_size);
+				else
+					printf("Read unexpected data! %s read vs given %s\n", read_buf, data);
+			}
+			free(read_buf);
+
+		} else if (strcmp(command, "AIO") == 0) {
+			count = atoi(command_args[1]);
+
+			if (count < 2 || count > AIO_BLOCKS ||
+			    aio_check(fs_fd, count)) {
+				fs_umount();
+				die("Asynchronous transfers failed");
+			}
+
+			printf("AIO successful.\n");
+
+		} else if (strcmp(command, "FALLOCATE") == 0) {
+			count = atoi(command_args[1]);
+
+			if (fs_fallocate(fs_fd, count)) {
+				fs_umount();
+				die("Cannot preallocate blocks");
+			}
+
+			printf("FALLOCATE successful.\n");
+
+		} else if (strcmp(command, "FAT") == 0) {
+			if (fs_fat_config(strcmp(command_args[1], "LAZY") == 0 ?
+					  FS_FAT_LAZY : FS_FAT_EAGER))
+				die("Cannot set FAT mode");
+
+			printf("FAT successful.\n");
+
+		} else if (strcmp(command, "INFO") == 0) {
+			if (fs_info()) {
+				fs_umount();
+				die("Cannot get info");
+			}
+
+		} else if (strcmp(command, "STATS") == 0) {
+			/* Same format as INFO, so that both can be compared */
+			if (fs_info_stats(&stats)) {
+				fs_umount();
+				die("Cannot get stats");
+			}
+
+			printf("FS Info:\n");
+			printf("total_blk_count=%zu\n", stats.total_blk_count);
+			printf("fat_blk_count=%zu\n", stats.fat_blk_count);
+			printf("rdir_blk=%zu\n", stats.rdir_blk);
+			printf("data_blk=%zu\n", stats.data_blk);
+			printf("data_blk_count=%zu\n", stats.data_blk_count);
+			printf("fat_free_ratio=%zu/%zu\n", stats.fat_free,
+			       stats.data_blk_count);
+			printf("rdir_free_ratio=%zu/%d\n", stats.rdir_free,
+			       FS_FILE_MAX_COUNT);
 		}
 	}
 
@@ -503,6 +749,70 @@ void thread_fs_info(void *arg)
 		die("Cannot unmount diskname");
 }
 
+void thread_fs_volumes(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	struct fs_volume *fs[2];
+	int fs_fd[2];
+	char buf[256];
+	size_t len;
+	int i;
+
+	if (t_arg->argc < 2)
+		die("Usage: <diskname> <diskname>");
+
+	for (i = 0; i < 2; i++) {
+		fs[i] = fs_mount_h(t_arg->argv[i]);
+		if (!fs[i])
+			die("Cannot mount %s", t_arg->argv[i]);
+	}
+
+	/* Interleave the writes, each volume stores its own disk name */
+	for (i = 0; i < 2; i++) {
+		if (fs_create_h(fs[i], "volume"))
+			die("Cannot create file on %s", t_arg->argv[i]);
+		fs_fd[i] = fs_open_h(fs[i], "volume");
+		if (fs_fd[i] < 0)
+			die("Cannot open file on %s", t_arg->argv[i]);
+	}
+	for (i = 0; i < 2; i++) {
+		len = strlen(t_arg->argv[i]);
+		if (fs_write_h(fs[i], fs_fd[i], t_arg->argv[i], len) != (int)len)
+			die("Cannot write to %s", t_arg->argv[i]);
+	}
+	for (i = 0; i < 2; i++) {
+		if (fs_write_h(fs[i], fs_fd[i], "\n", 1) != 1)
+			die("Cannot write to %s", t_arg->argv[i]);
+	}
+
+	/* Each volume reads back its own data only */
+	for (i = 0; i < 2; i++) {
+		len = strlen(t_arg->argv[i]) + 1;
+		if (fs_lseek_h(fs[i], fs_fd[i], 0))
+			die("Cannot seek on %s", t_arg->argv[i]);
+		if (fs_read_h(fs[i], fs_fd[i], buf, sizeof(buf)) != (int)len ||
+		    memcmp(buf, t_arg->argv[i], len - 1) || buf[len - 1] != '\n')
+			die("Wrong data read back from %s", t_arg->argv[i]);
+		if (fs_close_h(fs[i], fs_fd[i]))
+			die("Cannot close file on %s", t_arg->argv[i]);
+	}
+
+	/* A volume cannot go while it has an asynchronous request queue */
+	if (fs_aio_setup_h(fs[0], 1))
+		die("Cannot set up queue on %s", t_arg->argv[0]);
+	if (!fs_umount_h(fs[0]))
+		die("Unmounted %s with a queue", t_arg->argv[0]);
+	if (fs_aio_teardown_h(fs[0]))
+		die("Cannot tear down queue on %s", t_arg->argv[0]);
+
+	for (i = 0; i < 2; i++) {
+		if (fs_umount_h(fs[i]))
+			die("Cannot unmount %s", t_arg->argv[i]);
+	}
+
+	printf("Volumes successful.\n");
+}
+
 size_t get_argv(char *argv)
 {
 	long int ret = strtol(argv, NULL, 0);
@@ -521,7 +831,8 @@ static struct {
 	{ "rm",		thread_fs_rm },
 	{ "cat",	thread_fs_cat },
 	{ "stat",	thread_fs_stat },
-	{ "script",	thread_fs_script }
+	{ "script",	thread_fs_script },
+	{ "volumes",	thread_fs_volumes }
 };
 
 void usage(char *program)
@@ -0,0 +1,43 @@
+#!/bin/bash
+
+# Crash recovery of journaled disks. A script creates and writes a file,
+# syncs, then stops without unmounting. Copying back the metadata home blocks
+# from before the script tears the transaction after its commit, so the next
+# mount must replay it. Corrupting a logged image as well tears it before its
+# commit, so the next mount must ignore it.
+
+fail() {
+    echo "FAIL: ${*}"
+    exit 1
+}
+
+# 100 data blocks: superblock, one FAT block, root directory, then the journal
+./fs_bench.x mkfs journal.fs 100 8 || fail "cannot format disk"
+cp journal.fs before.fs
+
+printf 'MOUNT\nCREATE\tjfile\nOPEN\tjfile\nWRITE\tDATA\tjournaled\n' \
+       > journal.script
+printf 'CLOSE\nSYNC\nCRASH\n' >> journal.script
+./test_fs.x script journal.fs journal.script > /dev/null ||
+    fail "cannot run script"
+
+# Committed but not written home: the file comes back on replay
+cp journal.fs torn.fs
+dd if=before.fs of=torn.fs bs=4096 count=3 conv=notrunc status=none
+./test_fs.x cat torn.fs jfile | grep -q "^journaled$" ||
+    fail "committed transaction not replayed"
+./test_fs.x ls torn.fs | grep -q "file: jfile, size: 9," ||
+    fail "replayed transaction not written home"
+
+# Not committed: the disk stays as it was before the script
+cp journal.fs torn.fs
+dd if=before.fs of=torn.fs bs=4096 count=3 conv=notrunc status=none
+dd if=/dev/zero of=torn.fs bs=4096 seek=4 count=1 conv=notrunc status=none
+./test_fs.x ls torn.fs | grep -q "jfile" &&
+    fail "torn transaction replayed"
+./test_fs.x info torn.fs | grep -q "^fat_free_ratio=99/100$" ||
+    fail "torn transaction changed the FAT"
+
+echo "Journal recovery tests passed!"
+
+rm journal.fs before.fs torn.fs journal.script
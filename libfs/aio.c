@@ -0,0 +1,324 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aio.h"
+#include "fs.h"
+#include "fs_ext.h"
+
+//ring of request pointers
+struct aio_ring {
+  struct fs_aio_req **slots;
+  unsigned int head;
+  unsigned int count;
+};
+
+//queue struct, a submission ring served by workers feeding a completion ring
+struct aio_queue {
+  struct fs_volume *fs;
+  bool stopping;
+  unsigned int depth;
+  unsigned int inflight;
+  struct aio_ring sq;
+  struct aio_ring cq;
+  pthread_t *workers;
+  unsigned int nworkers;
+  pthread_cond_t submitted;
+  pthread_cond_t completed;
+  struct aio_queue *next;
+};
+
+//queues of every volume, the one of fs_mount() has no volume handle
+static struct aio_queue *queues;
+
+//protects the list and the queues, workers wait on submitted and reapers on
+//completed of their queue
+static pthread_mutex_t aio_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct aio_queue *find_queue(struct fs_volume *fs) {
+
+  struct aio_queue *queue = queues;
+  while (queue != NULL && queue->fs != fs) {
+    queue = queue->next;
+  }
+  return queue;
+}
+
+static void ring_push(struct aio_queue *queue, struct aio_ring *ring,
+                      struct fs_aio_req *req) {
+
+  ring->slots[(ring->head + ring->count) % queue->depth] = req;
+  ring->count++;
+}
+
+static struct fs_aio_req *ring_pop(struct aio_queue *queue,
+                                   struct aio_ring *ring) {
+
+  struct fs_aio_req *req = ring->slots[ring->head];
+  ring->head = (ring->head + 1) % queue->depth;
+  ring->count--;
+  return req;
+}
+
+static int run_request(struct fs_volume *fs, struct fs_aio_req *req) {
+
+  //each request is the positional call it stands for, on the queue's volume
+  switch (req->opcode) {
+  case FS_AIO_READ:
+    if (fs == NULL) {
+      return fs_pread(req->fd, req->buf, req->count, req->offset);
+    }
+    return fs_pread_h(fs, req->fd, req->buf, req->count, req->offset);
+  case FS_AIO_WRITE:
+    if (fs == NULL) {
+      return fs_pwrite(req->fd, req->buf, req->count, req->offset);
+    }
+    return fs_pwrite_h(fs, req->fd, req->buf, req->count, req->offset);
+  case FS_AIO_SYNC:
+    return fs == NULL ? fs_sync() : fs_sync_h(fs);
+  }
+
+  return -1;
+}
+
+static void *worker(void *arg) {
+
+  struct aio_queue *queue = arg;
+  pthread_mutex_lock(&aio_lock);
+  while (true) {
+
+    //wait for a request, or for the queue to be torn down once drained
+    while (queue->sq.count == 0 && !queue->stopping) {
+      pthread_cond_wait(&queue->submitted, &aio_lock);
+    }
+    if (queue->sq.count == 0) {
+      break;
+    }
+
+    //run it without the lock so that workers overlap
+    struct fs_aio_req *req = ring_pop(queue, &queue->sq);
+    pthread_mutex_unlock(&aio_lock);
+    req->result = run_request(queue->fs, req);
+    pthread_mutex_lock(&aio_lock);
+
+    ring_push(queue, &queue->cq, req);
+    pthread_cond_broadcast(&queue->completed);
+  }
+  pthread_mutex_unlock(&aio_lock);
+
+  return NULL;
+}
+
+static void free_queue(struct aio_queue *queue) {
+
+  pthread_cond_destroy(&queue->submitted);
+  pthread_cond_destroy(&queue->completed);
+  free(queue->sq.slots);
+  free(queue->cq.slots);
+  free(queue->workers);
+  free(queue);
+}
+
+static void unlink_queue(struct aio_queue *queue) {
+
+  struct aio_queue **iter = &queues;
+  while (*iter != queue) {
+    iter = &(*iter)->next;
+  }
+  *iter = queue->next;
+}
+
+static int aio_teardown(struct fs_volume *fs) {
+
+  pthread_mutex_lock(&aio_lock);
+  struct aio_queue *queue = find_queue(fs);
+  if (queue == NULL || queue->stopping || queue->inflight > 0) {
+    pthread_mutex_unlock(&aio_lock);
+    return -1;
+  }
+  queue->stopping = true;
+  pthread_cond_broadcast(&queue->submitted);
+  pthread_mutex_unlock(&aio_lock);
+
+  for (unsigned int i = 0; i < queue->nworkers; i++) {
+    pthread_join(queue->workers[i], NULL);
+  }
+
+  pthread_mutex_lock(&aio_lock);
+  unlink_queue(queue);
+  pthread_mutex_unlock(&aio_lock);
+  free_queue(queue);
+  return 0;
+}
+
+static int aio_setup(struct fs_volume *fs, unsigned int depth) {
+
+  if (depth == 0 || depth > FS_AIO_MAX_DEPTH) {
+    return -1;
+  }
+
+  //both rings hold every request that can be in flight
+  struct aio_queue *queue = calloc(1, sizeof(*queue));
+  if (queue == NULL) {
+    return -1;
+  }
+  queue->fs = fs;
+  queue->depth = depth;
+  queue->sq.slots = calloc(depth, sizeof(*queue->sq.slots));
+  queue->cq.slots = calloc(depth, sizeof(*queue->cq.slots));
+  queue->workers = calloc(depth, sizeof(*queue->workers));
+  pthread_cond_init(&queue->submitted, NULL);
+  pthread_cond_init(&queue->completed, NULL);
+  if (queue->sq.slots == NULL || queue->cq.slots == NULL ||
+      queue->workers == NULL) {
+    free_queue(queue);
+    return -1;
+  }
+
+  //a volume has one queue at a time
+  pthread_mutex_lock(&aio_lock);
+  if (find_queue(fs) != NULL) {
+    pthread_mutex_unlock(&aio_lock);
+    free_queue(queue);
+    return -1;
+  }
+  queue->next = queues;
+  queues = queue;
+
+  //one worker per request that can be in flight
+  while (queue->nworkers < depth) {
+    if (pthread_create(&queue->workers[queue->nworkers], NULL, worker,
+                       queue)) {
+      break;
+    }
+    queue->nworkers++;
+  }
+  pthread_mutex_unlock(&aio_lock);
+
+  //without any worker nothing would ever complete
+  if (queue->nworkers == 0) {
+    aio_teardown(fs);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int aio_submit(struct fs_volume *fs, struct fs_aio_req **reqs,
+                      unsigned int nreqs) {
+
+  pthread_mutex_lock(&aio_lock);
+  struct aio_queue *queue = find_queue(fs);
+  if (queue == NULL || queue->stopping || (reqs == NULL && nreqs > 0)) {
+    pthread_mutex_unlock(&aio_lock);
+    return -1;
+  }
+
+  //queue as many requests as there is room for
+  unsigned int count = 0;
+  while (count < nreqs && queue->inflight < queue->depth) {
+    ring_push(queue, &queue->sq, reqs[count]);
+    queue->inflight++;
+    count++;
+  }
+  if (count > 0) {
+    pthread_cond_broadcast(&queue->submitted);
+  }
+  pthread_mutex_unlock(&aio_lock);
+
+  return count;
+}
+
+static int aio_reap(struct fs_volume *fs, struct fs_aio_req **reqs,
+                    unsigned int min, unsigned int max) {
+
+  pthread_mutex_lock(&aio_lock);
+  struct aio_queue *queue = find_queue(fs);
+  if (queue == NULL || (reqs == NULL && max > 0)) {
+    pthread_mutex_unlock(&aio_lock);
+    return -1;
+  }
+
+  //never wait for more requests than are in flight
+  if (min > max) {
+    min = max;
+  }
+  if (min > queue->inflight) {
+    min = queue->inflight;
+  }
+  while (queue->cq.count < min) {
+    pthread_cond_wait(&queue->completed, &aio_lock);
+  }
+
+  unsigned int count = 0;
+  while (count < max && queue->cq.count > 0) {
+    reqs[count++] = ring_pop(queue, &queue->cq);
+    queue->inflight--;
+  }
+  pthread_mutex_unlock(&aio_lock);
+
+  return count;
+}
+
+bool aio_busy(struct fs_volume *fs) {
+
+  pthread_mutex_lock(&aio_lock);
+  bool busy = find_queue(fs) != NULL;
+  pthread_mutex_unlock(&aio_lock);
+  return busy;
+}
+
+int fs_aio_setup(unsigned int depth) {
+
+  return aio_setup(NULL, depth);
+}
+
+int fs_aio_teardown(void) {
+
+  return aio_teardown(NULL);
+}
+
+int fs_aio_submit(struct fs_aio_req **reqs, unsigned int nreqs) {
+
+  return aio_submit(NULL, reqs, nreqs);
+}
+
+int fs_aio_reap(struct fs_aio_req **reqs, unsigned int min, unsigned int max) {
+
+  return aio_reap(NULL, reqs, min, max);
+}
+
+int fs_aio_setup_h(struct fs_volume *fs, unsigned int depth) {
+
+  if (fs == NULL) {
+    return -1;
+  }
+  return aio_setup(fs, depth);
+}
+
+int fs_aio_teardown_h(struct fs_volume *fs) {
+
+  if (fs == NULL) {
+    return -1;
+  }
+  return aio_teardown(fs);
+}
+
+int fs_aio_submit_h(struct fs_volume *fs, struct fs_aio_req **reqs,
+                    unsigned int nreqs) {
+
+  if (fs == NULL) {
+    return -1;
+  }
+  return aio_submit(fs, reqs, nreqs);
+}
+
+int fs_aio_reap_h(struct fs_volume *fs, struct fs_aio_req **reqs,
+                  unsigned int min, unsigned int max) {
+
+  if (fs == NULL) {
+    return -1;
+  }
+  return aio_reap(fs, reqs, min, max);
+}
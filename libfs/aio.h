@@ -0,0 +1,22 @@
+#ifndef _AIO_H
+#define _AIO_H
+
+/*
+ * Asynchronous request queues of aio.c, one per volume. fs.c asks about them
+ * before it lets a volume go, since queued requests still refer to it.
+ */
+
+#include <stdbool.h>
+
+struct fs_volume;
+
+/**
+ * aio_busy - Tell whether a volume has an asynchronous request queue
+ * @fs: Volume, or NULL for the file system of fs_mount()
+ *
+ * Return: true if a queue was set up on @fs and not torn down yet. false
+ * otherwise.
+ */
+bool aio_busy(struct fs_volume *fs);
+
+#endif /* _AIO_H */
@@ -0,0 +1,319 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "alloc.h"
+#include "fs_ext.h"
+
+#define WORD_BITS 64
+
+//reservation window struct, blocks start to start + len - 1 are held
+struct alloc_window {
+  size_t start;
+  size_t len;
+};
+
+//free-space map struct, one per mounted disk, a set bit marks a free block
+struct free_map {
+  enum fs_alloc_policy policy;
+  size_t window_len;
+
+  uint64_t *words;
+  size_t nwords;
+  size_t nblocks;
+  size_t free;
+
+  //no word before this one has a free bit
+  size_t first_word;
+
+  //next-fit position for files without blocks yet
+  size_t rotor;
+
+  //reservation windows, one per owner
+  struct alloc_window *windows;
+  size_t nowners;
+  size_t reserved;
+};
+
+static bool is_free(struct free_map *map, size_t block) {
+
+  return block < map->nblocks &&
+         (map->words[block / WORD_BITS] >> (block % WORD_BITS)) & 1;
+}
+
+static size_t next_free(struct free_map *map, size_t block) {
+
+  //find the first free block at or after block
+  if (block >= map->nblocks) {
+    return map->nblocks;
+  }
+  size_t word = block / WORD_BITS;
+  uint64_t bits = map->words[word] & (~(uint64_t)0 << (block % WORD_BITS));
+  while (bits == 0) {
+    if (++word == map->nwords) {
+      return map->nblocks;
+    }
+    bits = map->words[word];
+  }
+
+  return word * WORD_BITS + __builtin_ctzll(bits);
+}
+
+static size_t next_used(struct free_map *map, size_t block) {
+
+  //find the first block in use at or after block
+  if (block >= map->nblocks) {
+    return map->nblocks;
+  }
+  size_t word = block / WORD_BITS;
+  uint64_t bits = ~map->words[word] & (~(uint64_t)0 << (block % WORD_BITS));
+  while (bits == 0) {
+    if (++word == map->nwords) {
+      return map->nblocks;
+    }
+    bits = ~map->words[word];
+  }
+
+  size_t used = word * WORD_BITS + __builtin_ctzll(bits);
+  return used < map->nblocks ? used : map->nblocks;
+}
+
+static void take_range(struct free_map *map, size_t start, size_t len) {
+
+  //clear the bits of every block in the range
+  for (size_t block = start; block < start + len; block++) {
+    map->words[block / WORD_BITS] &= ~((uint64_t)1 << (block % WORD_BITS));
+  }
+  map->free -= len;
+  map->rotor = start + len < map->nblocks ? start + len : 0;
+}
+
+static size_t take_first(struct free_map *map) {
+
+  //skip the words without any free bit
+  while (map->first_word < map->nwords && map->words[map->first_word] == 0) {
+    map->first_word++;
+  }
+  if (map->first_word == map->nwords) {
+    return ALLOC_NONE;
+  }
+
+  //take the lowest free bit of the word
+  size_t block = map->first_word * WORD_BITS +
+                 __builtin_ctzll(map->words[map->first_word]);
+  take_range(map, block, 1);
+  return block;
+}
+
+static size_t find_run(struct free_map *map, size_t want, size_t goal,
+                       size_t *len) {
+
+  //walk the free extents, starting at goal for next-fit
+  size_t best = ALLOC_NONE;
+  size_t best_len = 0;
+  size_t largest = ALLOC_NONE;
+  size_t largest_len = 0;
+  size_t first = map->policy == FS_ALLOC_NEXT_FIT ? goal : 0;
+  size_t from = first;
+  bool wrapped = false;
+  while (true) {
+
+    //after wrapping around, stop where the search started
+    size_t start = next_free(map, from);
+    if (wrapped && start >= first) {
+      start = map->nblocks;
+    }
+    if (start == map->nblocks) {
+      if (wrapped || first == 0) {
+        break;
+      }
+      wrapped = true;
+      from = 0;
+      continue;
+    }
+    size_t end = next_used(map, start);
+
+    //remember the largest extent in case none is big enough
+    if (end - start > largest_len) {
+      largest = start;
+      largest_len = end - start;
+    }
+
+    //first and next fit stop at the first big enough extent, best fit at the
+    //smallest one
+    if (end - start >= want) {
+      if (map->policy != FS_ALLOC_BEST_FIT) {
+        *len = want;
+        return start;
+      }
+      if (best == ALLOC_NONE || end - start < best_len) {
+        best = start;
+        best_len = end - start;
+      }
+    }
+    from = end;
+  }
+
+  if (best != ALLOC_NONE) {
+    *len = want;
+    return best;
+  }
+
+  *len = largest_len;
+  return largest;
+}
+
+static size_t continue_run(struct free_map *map, size_t tail, size_t want,
+                           size_t *len) {
+
+  //extend the file in place if the block after its tail is free
+  if (tail == ALLOC_NONE || !is_free(map, tail + 1)) {
+    return ALLOC_NONE;
+  }
+  size_t end = next_used(map, tail + 1);
+  *len = end - (tail + 1) < want ? end - (tail + 1) : want;
+  return tail + 1;
+}
+
+static void release_range(struct free_map *map, size_t start, size_t len) {
+
+  for (size_t block = start; block < start + len; block++) {
+    alloc_release(map, block);
+  }
+}
+
+struct free_map *alloc_init(size_t nblocks, size_t nowners,
+                            enum fs_alloc_policy policy, size_t window) {
+
+  struct free_map *map = calloc(1, sizeof(*map));
+  if (map == NULL) {
+    return NULL;
+  }
+  map->policy = policy;
+  map->window_len = window;
+
+  //every block starts in use until released
+  map->nwords = (nblocks + WORD_BITS - 1) / WORD_BITS;
+  map->words = calloc(map->nwords ? map->nwords : 1, sizeof(*map->words));
+  map->windows = calloc(nowners ? nowners : 1, sizeof(*map->windows));
+  if (map->words == NULL || map->windows == NULL) {
+    alloc_destroy(map);
+    return NULL;
+  }
+  map->nblocks = nblocks;
+  map->nowners = nowners;
+  map->first_word = map->nwords;
+
+  return map;
+}
+
+void alloc_destroy(struct free_map *map) {
+
+  free(map->words);
+  free(map->windows);
+  free(map);
+}
+
+static size_t alloc_block_once(struct free_map *map, int owner, size_t tail) {
+
+  //take from the reservation window first
+  struct alloc_window *window = &map->windows[owner];
+  if (window->len > 0) {
+    size_t block = window->start;
+    window->start++;
+    window->len--;
+    map->reserved--;
+    return block;
+  }
+
+  //plain first fit keeps the layout of the reference implementation
+  if (map->policy == FS_ALLOC_FIRST_FIT && map->window_len == 0) {
+    return take_first(map);
+  }
+
+  //otherwise grab a run and keep the blocks after the first as a window
+  size_t want = map->window_len + 1;
+  size_t len = 0;
+  size_t start = continue_run(map, tail, want, &len);
+  if (start == ALLOC_NONE) {
+    start = find_run(map, want, tail == ALLOC_NONE ? map->rotor : tail + 1,
+                     &len);
+  }
+  if (start == ALLOC_NONE) {
+    return ALLOC_NONE;
+  }
+  take_range(map, start, len);
+  window->start = start + 1;
+  window->len = len - 1;
+  map->reserved += len - 1;
+
+  return start;
+}
+
+size_t alloc_block(struct free_map *map, int owner, size_t tail) {
+
+  size_t block = alloc_block_once(map, owner, tail);
+  if (block != ALLOC_NONE || map->reserved == 0) {
+    return block;
+  }
+
+  //the disk is full apart from windows, give them back and retry
+  for (size_t i = 0; i < map->nowners; i++) {
+    alloc_release_window(map, i);
+  }
+  return alloc_block_once(map, owner, tail);
+}
+
+size_t alloc_run(struct free_map *map, int owner, size_t tail, size_t want,
+                 size_t *len) {
+
+  //a run replaces the window, which may well sit right after the tail
+  alloc_release_window(map, owner);
+
+  size_t start = continue_run(map, tail, want, len);
+  if (start == ALLOC_NONE) {
+    start = find_run(map, want, tail == ALLOC_NONE ? map->rotor : tail + 1,
+                     len);
+  }
+  if (start == ALLOC_NONE && map->reserved > 0) {
+    for (size_t i = 0; i < map->nowners; i++) {
+      alloc_release_window(map, i);
+    }
+    start = find_run(map, want, tail == ALLOC_NONE ? map->rotor : tail + 1,
+                     len);
+  }
+  if (start == ALLOC_NONE) {
+    return ALLOC_NONE;
+  }
+
+  take_range(map, start, *len);
+  return start;
+}
+
+void alloc_release(struct free_map *map, size_t block) {
+
+  //set the bit and remember that its word has room
+  size_t word = block / WORD_BITS;
+  uint64_t bit = (uint64_t)1 << (block % WORD_BITS);
+  if (block >= map->nblocks || (map->words[word] & bit)) {
+    return;
+  }
+
+  map->words[word] |= bit;
+  map->free++;
+  if (word < map->first_word) {
+    map->first_word = word;
+  }
+}
+
+void alloc_release_window(struct free_map *map, int owner) {
+
+  struct alloc_window *window = &map->windows[owner];
+  release_range(map, window->start, window->len);
+  map->reserved -= window->len;
+  window->len = 0;
+}
+
+size_t alloc_free_count(struct free_map *map) {
+
+  return map->free + map->reserved;
+}
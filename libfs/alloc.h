@@ -0,0 +1,104 @@
+#ifndef _ALLOC_H
+#define _ALLOC_H
+
+/*
+ * In-memory free-space map of the data blocks of a mounted disk and the
+ * allocation policies built on top of it. The map mirrors which FAT entries
+ * are 0 so that allocation and free-space accounting never scan the FAT.
+ *
+ * Files are identified by an owner number (their root directory entry). An
+ * owner can hold a reservation window: free blocks following its last block
+ * that are kept out of the free map so that other files cannot interleave
+ * with it. Windows are never written to disk.
+ */
+
+#include <stdbool.h>
+#include <stddef.h> /* for size_t definition */
+
+#include "fs_ext.h"
+
+/** Returned by the allocation functions when no data block is free */
+#define ALLOC_NONE ((size_t)-1)
+
+struct free_map;
+
+/**
+ * alloc_init - Set up the free-space map
+ * @nblocks: Number of data blocks on the disk
+ * @nowners: Number of owners that can hold a reservation window
+ * @policy: Allocation policy, see fs_alloc_config()
+ * @window: Reservation window size in blocks, 0 for none
+ *
+ * All blocks start out in use; alloc_release() the free ones afterwards.
+ *
+ * Return: NULL if the map cannot be allocated. The new map otherwise.
+ */
+struct free_map *alloc_init(size_t nblocks, size_t nowners,
+                            enum fs_alloc_policy policy, size_t window);
+
+/**
+ * alloc_destroy - Release a free-space map and every reservation window
+ * @map: Map to release
+ */
+void alloc_destroy(struct free_map *map);
+
+/**
+ * alloc_block - Allocate one data block for a file
+ * @map: Free-space map of the disk
+ * @owner: Owner allocating the block
+ * @tail: Last data block of the owner's file, or %ALLOC_NONE if it is empty
+ *
+ * Pick the block according to the configured policy, from the owner's
+ * reservation window first. When the disk is otherwise full, the windows of
+ * the other owners are given back before giving up.
+ *
+ * Return: %ALLOC_NONE if every data block is in use. Otherwise the index of the
+ * block, which is now marked in use.
+ */
+size_t alloc_block(struct free_map *map, int owner, size_t tail);
+
+/**
+ * alloc_run - Allocate a run of consecutive data blocks for a file
+ * @map: Free-space map of the disk
+ * @owner: Owner allocating the run
+ * @tail: Last data block of the owner's file, or %ALLOC_NONE if it is empty
+ * @want: Number of blocks wanted
+ * @len: Filled with the number of blocks actually allocated
+ *
+ * Continue the file right after @tail when possible, otherwise pick a run of
+ * free blocks according to the configured policy. If no run of @want blocks is
+ * free, the largest free run is returned instead. The owner's reservation
+ * window is given back first.
+ *
+ * Return: %ALLOC_NONE if every data block is in use. Otherwise the index of the
+ * first block of the run, whose @len blocks are now marked in use.
+ */
+size_t alloc_run(struct free_map *map, int owner, size_t tail, size_t want,
+                 size_t *len);
+
+/**
+ * alloc_release - Mark a data block free
+ * @map: Free-space map of the disk
+ * @block: Index of the data block
+ */
+void alloc_release(struct free_map *map, size_t block);
+
+/**
+ * alloc_release_window - Give back the reservation window of an owner
+ * @map: Free-space map of the disk
+ * @owner: Owner of the window
+ */
+void alloc_release_window(struct free_map *map, int owner);
+
+/**
+ * alloc_free_count - Get the number of free data blocks
+ * @map: Free-space map of the disk
+ *
+ * Blocks held in reservation windows count as free since they do not belong
+ * to any file.
+ *
+ * Return: the number of free data blocks.
+ */
+size_t alloc_free_count(struct free_map *map);
+
+#endif /* _ALLOC_H */
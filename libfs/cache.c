@@ -0,0 +1,588 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "cache.h"
+#include "disk.h"
+#include "disk_ext.h"
+#include "fs_ext.h"
+
+#define NO_ENTRY -1
+
+//share of the cache, from the least recently used end, written back at once
+//when a dirty entry is evicted
+#define CACHE_EVICT_SHARE 4
+
+//cache entry struct, linked both in a hash bucket and in the lru list
+struct cache_entry {
+  size_t block;
+  bool dirty;
+  int hnext;
+  int prev;
+  int next;
+  uint8_t *data;
+};
+
+//cache struct, one per mounted disk
+struct block_cache {
+  struct disk *disk;
+  size_t capacity;
+  size_t used;
+  size_t dirty;
+  struct cache_entry *entries;
+  uint8_t *data;
+  int *buckets;
+  size_t bucket_mask;
+  int free_head;
+  int lru_head;
+  int lru_tail;
+  struct cache_entry **scratch_entry;
+  struct iovec *scratch_iov;
+  struct block_io *scratch_io;
+  struct fs_cache_stats stats;
+
+  //serializes every access to the cache, never held while blocks are read
+  //from the disk, but held while dirty blocks are written back on eviction
+  //and flush
+  pthread_mutex_t lock;
+};
+
+static size_t hash_block(struct block_cache *cache, size_t block) {
+
+  //multiplicative hash spreads consecutive blocks over the buckets
+  return (block * 2654435761u) & cache->bucket_mask;
+}
+
+static int lookup(struct block_cache *cache, size_t block) {
+
+  //walk the bucket chain looking for the block
+  int idx = cache->buckets[hash_block(cache, block)];
+  while (idx != NO_ENTRY && cache->entries[idx].block != block) {
+    idx = cache->entries[idx].hnext;
+  }
+
+  return idx;
+}
+
+static void hash_insert(struct block_cache *cache, int idx) {
+
+  size_t bucket = hash_block(cache, cache->entries[idx].block);
+  cache->entries[idx].hnext = cache->buckets[bucket];
+  cache->buckets[bucket] = idx;
+}
+
+static void hash_remove(struct block_cache *cache, int idx) {
+
+  //find the link pointing at the entry and skip over it
+  int *link = &cache->buckets[hash_block(cache, cache->entries[idx].block)];
+  while (*link != idx) {
+    link = &cache->entries[*link].hnext;
+  }
+  *link = cache->entries[idx].hnext;
+}
+
+static void lru_unlink(struct block_cache *cache, int idx) {
+
+  struct cache_entry *entry = &cache->entries[idx];
+  if (entry->prev != NO_ENTRY) {
+    cache->entries[entry->prev].next = entry->next;
+  } else {
+    cache->lru_head = entry->next;
+  }
+  if (entry->next != NO_ENTRY) {
+    cache->entries[entry->next].prev = entry->prev;
+  } else {
+    cache->lru_tail = entry->prev;
+  }
+}
+
+static void lru_push_front(struct block_cache *cache, int idx) {
+
+  struct cache_entry *entry = &cache->entries[idx];
+  entry->prev = NO_ENTRY;
+  entry->next = cache->lru_head;
+  if (cache->lru_head != NO_ENTRY) {
+    cache->entries[cache->lru_head].prev = idx;
+  } else {
+    cache->lru_tail = idx;
+  }
+  cache->lru_head = idx;
+}
+
+static void touch(struct block_cache *cache, int idx) {
+
+  //move entry to the most recently used end
+  if (cache->lru_head != idx) {
+    lru_unlink(cache, idx);
+    lru_push_front(cache, idx);
+  }
+}
+
+static void mark_dirty(struct block_cache *cache, int idx) {
+
+  if (!cache->entries[idx].dirty) {
+    cache->entries[idx].dirty = true;
+    cache->dirty++;
+  }
+}
+
+static void mark_clean(struct block_cache *cache, int idx) {
+
+  if (cache->entries[idx].dirty) {
+    cache->entries[idx].dirty = false;
+    cache->dirty--;
+  }
+}
+
+static void drop_entry(struct block_cache *cache, int idx) {
+
+  //forget the block and give the entry back to the free list
+  mark_clean(cache, idx);
+  hash_remove(cache, idx);
+  lru_unlink(cache, idx);
+  cache->entries[idx].hnext = cache->free_head;
+  cache->free_head = idx;
+  cache->used--;
+}
+
+static int compare_block(const void *a, const void *b) {
+
+  size_t block_a = (*(struct cache_entry *const *)a)->block;
+  size_t block_b = (*(struct cache_entry *const *)b)->block;
+  return (block_a > block_b) - (block_a < block_b);
+}
+
+static int write_entries(struct block_cache *cache, size_t count) {
+
+  //sort the dirty entries gathered in the scratch array by block
+  qsort(cache->scratch_entry, count, sizeof(*cache->scratch_entry),
+        compare_block);
+
+  //describe every run of consecutive blocks as one vectored transfer
+  size_t nruns = 0;
+  size_t i = 0;
+  while (i < count) {
+
+    size_t run = 0;
+    size_t first = cache->scratch_entry[i]->block;
+    while (i + run < count &&
+           cache->scratch_entry[i + run]->block == first + run) {
+      struct cache_entry *entry = cache->scratch_entry[i + run];
+      cache->scratch_iov[i + run].iov_base = entry->data;
+      cache->scratch_iov[i + run].iov_len = BLOCK_SIZE;
+      run++;
+    }
+
+    cache->scratch_io[nruns].block = first;
+    cache->scratch_io[nruns].iov = &cache->scratch_iov[i];
+    cache->scratch_io[nruns].iovcnt = run;
+    nruns++;
+    i += run;
+  }
+
+  //and write the runs back as one batch
+  if (disk_writev_batch(cache->disk, cache->scratch_io, nruns) == -1) {
+    return -1;
+  }
+  for (i = 0; i < count; i++) {
+    mark_clean(cache, cache->scratch_entry[i] - cache->entries);
+  }
+  cache->stats.writebacks += count;
+
+  return 0;
+}
+
+static int flush_all(struct block_cache *cache) {
+
+  //write back every dirty entry
+  size_t count = 0;
+  for (int idx = cache->lru_head; idx != NO_ENTRY;
+       idx = cache->entries[idx].next) {
+    if (cache->entries[idx].dirty) {
+      cache->scratch_entry[count++] = &cache->entries[idx];
+    }
+  }
+
+  return write_entries(cache, count);
+}
+
+static int flush_tail(struct block_cache *cache) {
+
+  //write back the dirty entries among the least recently used ones, so that
+  //the next evictions are free and blocks written in order go out as runs
+  size_t scan = cache->capacity / CACHE_EVICT_SHARE + 1;
+  size_t count = 0;
+  for (int idx = cache->lru_tail; idx != NO_ENTRY && scan > 0;
+       idx = cache->entries[idx].prev, scan--) {
+    if (cache->entries[idx].dirty) {
+      cache->scratch_entry[count++] = &cache->entries[idx];
+    }
+  }
+
+  return write_entries(cache, count);
+}
+
+static int get_entry(struct block_cache *cache, size_t block) {
+
+  //take a free entry, or evict the least recently used one
+  int idx = cache->free_head;
+  if (idx != NO_ENTRY) {
+
+    cache->free_head = cache->entries[idx].hnext;
+  } else {
+
+    idx = cache->lru_tail;
+    if (cache->entries[idx].dirty && flush_tail(cache) == -1) {
+      return NO_ENTRY;
+    }
+    drop_entry(cache, idx);
+    cache->free_head = cache->entries[idx].hnext;
+    cache->stats.evictions++;
+  }
+
+  //bind the entry to its new block
+  cache->entries[idx].block = block;
+  cache->entries[idx].dirty = false;
+  hash_insert(cache, idx);
+  lru_push_front(cache, idx);
+  cache->used++;
+
+  return idx;
+}
+
+struct block_cache *cache_init(struct disk *disk, size_t capacity) {
+
+  //start from an empty cache with fresh counters
+  struct block_cache *cache = calloc(1, sizeof(*cache));
+  if (cache == NULL) {
+    return NULL;
+  }
+  pthread_mutex_init(&cache->lock, NULL);
+  cache->disk = disk;
+  cache->capacity = capacity;
+
+  //a mapped disk is served from the page cache directly, a second copy of
+  //its blocks would only cost memory and copies
+  if (disk_map(disk, 0) != NULL) {
+    cache->capacity = 0;
+  }
+  cache->free_head = NO_ENTRY;
+  cache->lru_head = NO_ENTRY;
+  cache->lru_tail = NO_ENTRY;
+  cache->stats.capacity = cache->capacity;
+  if (cache->capacity == 0) {
+    return cache;
+  }
+
+  //size the hash table to the next power of two above twice the capacity
+  size_t nbuckets = 1;
+  while (nbuckets < 2 * cache->capacity) {
+    nbuckets <<= 1;
+  }
+  cache->bucket_mask = nbuckets - 1;
+
+  //blocks are aligned so that direct transfers use them in place
+  void *data = NULL;
+  if (posix_memalign(&data, BLOCK_SIZE, cache->capacity * BLOCK_SIZE) != 0) {
+    data = NULL;
+  }
+  cache->data = data;
+  cache->entries = calloc(cache->capacity, sizeof(*cache->entries));
+  cache->buckets = malloc(nbuckets * sizeof(*cache->buckets));
+  cache->scratch_entry = malloc(cache->capacity *
+                                sizeof(*cache->scratch_entry));
+  cache->scratch_iov = malloc(cache->capacity * sizeof(*cache->scratch_iov));
+  cache->scratch_io = malloc(cache->capacity * sizeof(*cache->scratch_io));
+  if (cache->entries == NULL || cache->data == NULL || cache->buckets == NULL ||
+      cache->scratch_entry == NULL || cache->scratch_iov == NULL ||
+      cache->scratch_io == NULL) {
+    cache_destroy(cache);
+    return NULL;
+  }
+
+  //every bucket starts empty and every entry starts free
+  for (size_t i = 0; i < nbuckets; i++) {
+    cache->buckets[i] = NO_ENTRY;
+  }
+  for (size_t i = cache->capacity; i > 0; i--) {
+    cache->entries[i - 1].data = cache->data + (i - 1) * BLOCK_SIZE;
+    cache->entries[i - 1].hnext = cache->free_head;
+    cache->free_head = i - 1;
+  }
+
+  //every block transfer of the cache uses its own data, the backend may be
+  //able to set it up once for all, if not transfers work all the same
+  disk_register_buffer(disk, cache->data, cache->capacity * BLOCK_SIZE);
+
+  return cache;
+}
+
+void cache_destroy(struct block_cache *cache) {
+
+  if (cache->data != NULL) {
+    disk_unregister_buffer(cache->disk);
+  }
+  free(cache->entries);
+  free(cache->data);
+  free(cache->buckets);
+  free(cache->scratch_entry);
+  free(cache->scratch_iov);
+  free(cache->scratch_io);
+  pthread_mutex_destroy(&cache->lock);
+  free(cache);
+}
+
+int cache_flush(struct block_cache *cache) {
+
+  pthread_mutex_lock(&cache->lock);
+  int ret = flush_all(cache);
+  pthread_mutex_unlock(&cache->lock);
+  return ret;
+}
+
+static bool copy_cached(struct block_cache *cache, size_t block, void *buf) {
+
+  //serve the block from the cache if present
+  int idx = lookup(cache, block);
+  if (idx == NO_ENTRY) {
+    return false;
+  }
+
+  cache->stats.hits++;
+  touch(cache, idx);
+  memcpy(buf, cache->entries[idx].data, BLOCK_SIZE);
+  return true;
+}
+
+static bool insert_clean(struct block_cache *cache, size_t block,
+                         const void *buf) {
+
+  //keep a copy of a block just read, unless another reader already did
+  if (lookup(cache, block) != NO_ENTRY) {
+    return false;
+  }
+  int idx = get_entry(cache, block);
+  if (idx == NO_ENTRY) {
+    return false;
+  }
+  memcpy(cache->entries[idx].data, buf, BLOCK_SIZE);
+  return true;
+}
+
+int cache_read(struct block_cache *cache, size_t block, void *buf) {
+
+  if (cache->capacity == 0) {
+    return disk_read(cache->disk, block, buf);
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  bool hit = copy_cached(cache, block, buf);
+  if (!hit) {
+    cache->stats.misses++;
+  }
+  pthread_mutex_unlock(&cache->lock);
+  if (hit) {
+    return 0;
+  }
+
+  //the block has no cached copy, so the disk holds its latest content and it
+  //can be read without the lock
+  if (disk_read(cache->disk, block, buf) == -1) {
+    return -1;
+  }
+  pthread_mutex_lock(&cache->lock);
+  insert_clean(cache, block, buf);
+  pthread_mutex_unlock(&cache->lock);
+  return 0;
+}
+
+static int write_block(struct block_cache *cache, size_t block,
+                       const void *buf) {
+
+  //overwrite the cached copy, or bind a new entry to the block
+  int idx = lookup(cache, block);
+  if (idx != NO_ENTRY) {
+
+    cache->stats.hits++;
+    touch(cache, idx);
+  } else {
+
+    cache->stats.misses++;
+    idx = get_entry(cache, block);
+    if (idx == NO_ENTRY) {
+      return -1;
+    }
+  }
+
+  memcpy(cache->entries[idx].data, buf, BLOCK_SIZE);
+  mark_dirty(cache, idx);
+  return 0;
+}
+
+int cache_write(struct block_cache *cache, size_t block, const void *buf) {
+
+  if (cache->capacity == 0) {
+    return disk_write(cache->disk, block, buf);
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  int ret = write_block(cache, block, buf);
+  pthread_mutex_unlock(&cache->lock);
+  return ret;
+}
+
+static int write_back_range(struct block_cache *cache, size_t block,
+                            size_t nblocks) {
+
+  //write dirty cached copies back so that the disk holds the latest content
+  for (size_t i = 0; i < nblocks; i++) {
+    int idx = lookup(cache, block + i);
+    if (idx != NO_ENTRY && cache->entries[idx].dirty) {
+      if (disk_write(cache->disk, block + i, cache->entries[idx].data) == -1) {
+        return -1;
+      }
+      mark_clean(cache, idx);
+      cache->stats.writebacks++;
+    }
+  }
+
+  return 0;
+}
+
+static void drop_range(struct block_cache *cache, size_t block,
+                       size_t nblocks) {
+
+  //forget cached copies, even dirty ones, of blocks about to be overwritten
+  for (size_t i = 0; i < nblocks; i++) {
+    int idx = lookup(cache, block + i);
+    if (idx != NO_ENTRY) {
+      drop_entry(cache, idx);
+    }
+  }
+}
+
+int cache_read_multi(struct block_cache *cache, size_t block, size_t nblocks,
+                     void *buf) {
+
+  if (cache->capacity == 0) {
+    return disk_read_multi(cache->disk, block, nblocks, buf);
+  }
+
+  //copy cached blocks out, which may be all of them
+  pthread_mutex_lock(&cache->lock);
+  bool bypass = 2 * nblocks > cache->capacity;
+  size_t hits = 0;
+  for (size_t i = 0; !bypass && i < nblocks; i++) {
+    if (copy_cached(cache, block + i, (uint8_t *)buf + i * BLOCK_SIZE)) {
+      hits++;
+    }
+  }
+  cache->stats.misses += nblocks - hits;
+  if (hits == nblocks) {
+    pthread_mutex_unlock(&cache->lock);
+    return 0;
+  }
+
+  //otherwise read the whole run without the lock once the disk holds the
+  //latest copies, readers never race with writers of the same blocks
+  int ret = write_back_range(cache, block, nblocks);
+  pthread_mutex_unlock(&cache->lock);
+  if (ret == -1 || disk_read_multi(cache->disk, block, nblocks, buf) == -1) {
+    return -1;
+  }
+
+  //runs too large to fit comfortably in the cache are not kept
+  if (!bypass) {
+    pthread_mutex_lock(&cache->lock);
+    for (size_t i = 0; i < nblocks; i++) {
+      insert_clean(cache, block + i, (uint8_t *)buf + i * BLOCK_SIZE);
+    }
+    pthread_mutex_unlock(&cache->lock);
+  }
+  return 0;
+}
+
+int cache_write_multi(struct block_cache *cache, size_t block, size_t nblocks,
+                      const void *buf) {
+
+  if (cache->capacity == 0) {
+    return disk_write_multi(cache->disk, block, nblocks, buf);
+  }
+
+  //large runs go to the disk directly, replacing any cached copies
+  pthread_mutex_lock(&cache->lock);
+  if (2 * nblocks > cache->capacity) {
+
+    drop_range(cache, block, nblocks);
+    pthread_mutex_unlock(&cache->lock);
+    return disk_write_multi(cache->disk, block, nblocks, buf);
+  }
+
+  int ret = 0;
+  for (size_t i = 0; ret == 0 && i < nblocks; i++) {
+    ret = write_block(cache, block + i, (const uint8_t *)buf + i * BLOCK_SIZE);
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return ret;
+}
+
+int cache_prefetch(struct block_cache *cache, size_t block, size_t nblocks) {
+
+  if (nblocks > cache->capacity / 2) {
+    nblocks = cache->capacity / 2;
+  }
+  if (nblocks == 0) {
+    return 0;
+  }
+
+  //aligned so that direct transfers read into it in place
+  void *buf = NULL;
+  if (posix_memalign(&buf, BLOCK_SIZE, nblocks * BLOCK_SIZE) != 0) {
+    return -1;
+  }
+
+  int ret = 0;
+  size_t i = 0;
+  pthread_mutex_lock(&cache->lock);
+  while (ret == 0 && i < nblocks) {
+
+    //skip blocks that are already cached
+    if (lookup(cache, block + i) != NO_ENTRY) {
+      i++;
+      continue;
+    }
+
+    //read the run of missing blocks without the lock, as cache_read() does,
+    //then cache the blocks no other reader or writer cached meanwhile
+    size_t run = 1;
+    while (i + run < nblocks && lookup(cache, block + i + run) == NO_ENTRY) {
+      run++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    ret = disk_read_multi(cache->disk, block + i, run, buf);
+    pthread_mutex_lock(&cache->lock);
+    for (size_t j = 0; ret == 0 && j < run; j++) {
+      if (insert_clean(cache, block + i + j,
+                       (uint8_t *)buf + j * BLOCK_SIZE)) {
+        cache->stats.prefetched++;
+      }
+    }
+    i += run;
+  }
+  pthread_mutex_unlock(&cache->lock);
+
+  free(buf);
+  return ret;
+}
+
+void cache_stats(struct block_cache *cache, struct fs_cache_stats *stats) {
+
+  pthread_mutex_lock(&cache->lock);
+  *stats = cache->stats;
+  stats->used = cache->used;
+  stats->dirty = cache->dirty;
+  pthread_mutex_unlock(&cache->lock);
+}
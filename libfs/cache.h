@@ -0,0 +1,130 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+/*
+ * Write-back block cache sitting between fs.c and disk.c, one per mounted
+ * disk. Blocks are addressed by their disk block index, exactly like
+ * disk_read() and disk_write(), so callers can switch from one to the other
+ * freely.
+ *
+ * Transfers may be issued from several threads at once. Callers must not
+ * access the same block concurrently when at least one of them writes it.
+ */
+
+#include <stddef.h> /* for size_t definition */
+
+struct block_cache;
+struct disk;
+struct fs_cache_stats;
+
+/**
+ * cache_init - Set up a block cache for a freshly opened disk
+ * @disk: Disk whose blocks are cached
+ * @capacity: Number of cached blocks, see fs_cache_config()
+ *
+ * Allocate @capacity cache entries with fresh statistics. A capacity of 0 turns
+ * every cache call into a direct call to the disk.
+ *
+ * Return: NULL if the cache cannot be allocated. The new cache otherwise.
+ */
+struct block_cache *cache_init(struct disk *disk, size_t capacity);
+
+/**
+ * cache_destroy - Release a block cache
+ * @cache: Cache to release
+ *
+ * Free every cache entry without writing anything back. Callers must
+ * cache_flush() first if dirty blocks must reach the disk.
+ */
+void cache_destroy(struct block_cache *cache);
+
+/**
+ * cache_flush - Write back every dirty block
+ * @cache: Cache to go through
+ *
+ * Dirty blocks are written in increasing block order, physically consecutive
+ * ones with a single vectored transfer.
+ *
+ * Return: -1 if a block could not be written. 0 otherwise.
+ */
+int cache_flush(struct block_cache *cache);
+
+/**
+ * cache_read - Read a block through the cache
+ * @cache: Cache to go through
+ * @block: Index of the block to read from
+ * @buf: Data buffer to be filled with content of block
+ *
+ * Return: -1 if the block could not be read. 0 otherwise.
+ */
+int cache_read(struct block_cache *cache, size_t block, void *buf);
+
+/**
+ * cache_write - Write a block through the cache
+ * @cache: Cache to go through
+ * @block: Index of the block to write to
+ * @buf: Data buffer to write in the block
+ *
+ * The block is only marked dirty; it reaches the disk when evicted or
+ * flushed.
+ *
+ * Return: -1 if an evicted dirty block could not be written. 0 otherwise.
+ */
+int cache_write(struct block_cache *cache, size_t block, const void *buf);
+
+/**
+ * cache_read_multi - Read consecutive blocks through the cache
+ * @cache: Cache to go through
+ * @block: Index of the first block to read from
+ * @nblocks: Number of consecutive blocks to read
+ * @buf: Data buffer to be filled with content of blocks
+ *
+ * Unless every block is cached, the whole run is fetched from the disk with
+ * one transfer, once dirty cached copies of its blocks have been written back,
+ * and the missing blocks are then kept in the cache. Runs too large to fit
+ * comfortably in the cache are not kept. Blocks missing from the cache are
+ * read without holding the cache lock, so reads from several threads overlap.
+ *
+ * Return: -1 if the blocks could not be read. 0 otherwise.
+ */
+int cache_read_multi(struct block_cache *cache, size_t block, size_t nblocks,
+                     void *buf);
+
+/**
+ * cache_write_multi - Write consecutive blocks through the cache
+ * @cache: Cache to go through
+ * @block: Index of the first block to write to
+ * @nblocks: Number of consecutive blocks to write
+ * @buf: Data buffer to write in the blocks
+ *
+ * Runs too large to fit comfortably in the cache are written to the disk
+ * directly and replace any cached copies.
+ *
+ * Return: -1 if the blocks could not be written. 0 otherwise.
+ */
+int cache_write_multi(struct block_cache *cache, size_t block, size_t nblocks,
+                      const void *buf);
+
+/**
+ * cache_prefetch - Load consecutive blocks into the cache ahead of use
+ * @cache: Cache to go through
+ * @block: Index of the first block to load
+ * @nblocks: Number of consecutive blocks to load
+ *
+ * Blocks already cached are left alone and runs of missing blocks are fetched
+ * with one transfer each, during which other callers can use the cache. At
+ * most half the cache is filled, so that a prefetch never evicts the blocks of
+ * the one before it, and nothing is loaded when caching is disabled.
+ *
+ * Return: -1 if the blocks could not be read. 0 otherwise.
+ */
+int cache_prefetch(struct block_cache *cache, size_t block, size_t nblocks);
+
+/**
+ * cache_stats - Get the statistics of a cache
+ * @cache: Cache to look at
+ * @stats: Structure to be filled with the statistics
+ */
+void cache_stats(struct block_cache *cache, struct fs_cache_stats *stats);
+
+#endif /* _CACHE_H */
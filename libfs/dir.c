@@ -0,0 +1,144 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dir.h"
+#include "fs.h"
+
+//hash table size, a power of two at least twice the number of files
+#define DIR_TABLE_SIZE (2 * FS_FILE_MAX_COUNT)
+
+#define SLOT_EMPTY -1
+#define SLOT_DELETED -2
+
+//hash table entry, keeping its own copy of the name
+struct dir_entry {
+  char filename[FS_FILENAME_LEN];
+  int slot;
+};
+
+//directory index struct, one per mounted disk
+struct dir_index {
+  struct dir_entry table[DIR_TABLE_SIZE];
+  int deleted;
+  int free_slots[FS_FILE_MAX_COUNT];
+  int free_count;
+};
+
+static uint32_t hash_name(const char *filename) {
+
+  //fnv-1a over the name
+  uint32_t hash = 2166136261u;
+  while (*filename) {
+    hash = (hash ^ (uint8_t)*filename++) * 16777619u;
+  }
+
+  return hash;
+}
+
+static int probe(struct dir_index *dir, const char *filename) {
+
+  //linear probing until the name or an empty entry
+  uint32_t pos = hash_name(filename) & (DIR_TABLE_SIZE - 1);
+  while (dir->table[pos].slot != SLOT_EMPTY) {
+    if (dir->table[pos].slot != SLOT_DELETED &&
+        strncmp(dir->table[pos].filename, filename, FS_FILENAME_LEN) == 0) {
+      return pos;
+    }
+    pos = (pos + 1) & (DIR_TABLE_SIZE - 1);
+  }
+
+  return -1;
+}
+
+static void rehash(struct dir_index *dir) {
+
+  //reinsert every live entry to get rid of deleted markers
+  struct dir_entry live[FS_FILE_MAX_COUNT];
+  int count = 0;
+  for (int i = 0; i < DIR_TABLE_SIZE; i++) {
+    if (dir->table[i].slot >= 0) {
+      live[count++] = dir->table[i];
+    }
+    dir->table[i].slot = SLOT_EMPTY;
+  }
+  dir->deleted = 0;
+
+  for (int i = 0; i < count; i++) {
+    dir_index_insert(dir, live[i].filename, live[i].slot);
+  }
+}
+
+struct dir_index *dir_index_init(void) {
+
+  struct dir_index *dir = malloc(sizeof(*dir));
+  if (dir == NULL) {
+    return NULL;
+  }
+  for (int i = 0; i < DIR_TABLE_SIZE; i++) {
+    dir->table[i].slot = SLOT_EMPTY;
+  }
+  dir->deleted = 0;
+  dir->free_count = 0;
+  return dir;
+}
+
+void dir_index_destroy(struct dir_index *dir) {
+
+  free(dir);
+}
+
+int dir_index_find(struct dir_index *dir, const char *filename) {
+
+  int pos = probe(dir, filename);
+  return pos == -1 ? -1 : dir->table[pos].slot;
+}
+
+void dir_index_insert(struct dir_index *dir, const char *filename, int slot) {
+
+  //reuse the first empty or deleted entry on the probe sequence
+  uint32_t pos = hash_name(filename) & (DIR_TABLE_SIZE - 1);
+  while (dir->table[pos].slot >= 0) {
+    pos = (pos + 1) & (DIR_TABLE_SIZE - 1);
+  }
+  if (dir->table[pos].slot == SLOT_DELETED) {
+    dir->deleted--;
+  }
+
+  strncpy(dir->table[pos].filename, filename, FS_FILENAME_LEN);
+  dir->table[pos].slot = slot;
+}
+
+void dir_index_remove(struct dir_index *dir, const char *filename) {
+
+  int pos = probe(dir, filename);
+  if (pos == -1) {
+    return;
+  }
+
+  //mark deleted so later probes keep going, rehash once markers pile up
+  dir->table[pos].slot = SLOT_DELETED;
+  dir->deleted++;
+  if (dir->deleted > DIR_TABLE_SIZE / 4) {
+    rehash(dir);
+  }
+}
+
+int dir_slot_take(struct dir_index *dir) {
+
+  if (dir->free_count == 0) {
+    return -1;
+  }
+
+  return dir->free_slots[--dir->free_count];
+}
+
+void dir_slot_release(struct dir_index *dir, int slot) {
+
+  dir->free_slots[dir->free_count++] = slot;
+}
+
+int dir_slot_free_count(struct dir_index *dir) {
+
+  return dir->free_count;
+}
@@ -0,0 +1,78 @@
+#ifndef _DIR_H
+#define _DIR_H
+
+/*
+ * In-memory index over the root directory of a mounted disk: an
+ * open-addressing hash table mapping file names to root directory entries, and
+ * a stack of the free entries. Both are rebuilt at mount time and kept in step
+ * by create and delete, so neither operation has to scan the root directory.
+ */
+
+struct dir_index;
+
+/**
+ * dir_index_init - Create the index of an empty directory
+ *
+ * Every root directory entry starts out in use; dir_slot_release() the free
+ * ones and dir_index_insert() the used ones afterwards.
+ *
+ * Return: NULL if the index cannot be allocated. The new index otherwise.
+ */
+struct dir_index *dir_index_init(void);
+
+/**
+ * dir_index_destroy - Release an index
+ * @dir: Index to release
+ */
+void dir_index_destroy(struct dir_index *dir);
+
+/**
+ * dir_index_find - Look a file up by name
+ * @dir: Index of the directory
+ * @filename: NULL-terminated file name
+ *
+ * Return: -1 if no file is named @filename. Otherwise the index of its root
+ * directory entry.
+ */
+int dir_index_find(struct dir_index *dir, const char *filename);
+
+/**
+ * dir_index_insert - Add a file to the index
+ * @dir: Index of the directory
+ * @filename: NULL-terminated file name, shorter than %FS_FILENAME_LEN
+ * @slot: Index of the file's root directory entry
+ */
+void dir_index_insert(struct dir_index *dir, const char *filename, int slot);
+
+/**
+ * dir_index_remove - Remove a file from the index
+ * @dir: Index of the directory
+ * @filename: NULL-terminated file name
+ */
+void dir_index_remove(struct dir_index *dir, const char *filename);
+
+/**
+ * dir_slot_take - Take a free root directory entry
+ * @dir: Index of the directory
+ *
+ * Return: -1 if the root directory is full. Otherwise the index of the entry,
+ * which is no longer considered free.
+ */
+int dir_slot_take(struct dir_index *dir);
+
+/**
+ * dir_slot_release - Mark a root directory entry free
+ * @dir: Index of the directory
+ * @slot: Index of the root directory entry
+ */
+void dir_slot_release(struct dir_index *dir, int slot);
+
+/**
+ * dir_slot_free_count - Get the number of free root directory entries
+ * @dir: Index of the directory
+ *
+ * Return: the number of free entries.
+ */
+int dir_slot_free_count(struct dir_index *dir);
+
+#endif /* _DIR_H */
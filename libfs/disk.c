@@ -1,147 +1,644 @@
 #include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
-/**
- * WARNING: YOU ARE NOT ALLOWED TO MODIFY THIS FILE!
+/*
+ * Virtual disks: an image file, or a manifest whose members make up a striped
+ * or mirrored disk. Each opened disk is a struct disk, whose backend carries
+ * out positional single-block, multi-block and vectored transfers. The
+ * block_*() functions of disk.h and disk_ext.h work on a single open disk.
  */
 
 #include "disk.h"
+#include "disk_backend.h"
+#include "disk_ext.h"
 
 #define block_error(fmt, ...) \
 	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
 
-/* Invalid file descriptor */
-#define INVALID_FD -1
+/* Maximum number of entries per vectored syscall (POSIX minimum on Linux) */
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
-/* Disk instance description */
-struct disk {
-	/* File descriptor */
-	int fd;
-	/* Block count */
-	size_t bcount;
+/* Disk of the block_*() functions, NULL while none is open */
+static struct disk *disk;
+
+/*
+ * Positional transfers: the file offset of @d->fd is never used, so a block
+ * costs a single syscall and concurrent callers do not race on a shared seek
+ * position. Short transfers are resumed until the whole range is done.
+ */
+int disk_pread(struct disk *d, void *buf, size_t len, off_t off)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = pread(d->fd, buf, len, off);
+		if (ret < 0) {
+			perror("pread");
+			return -1;
+		}
+		if (ret == 0) {
+			block_error("unexpected end of disk at offset %jd",
+				    (intmax_t)off);
+			return -1;
+		}
+		buf = (char *)buf + ret;
+		len -= ret;
+		off += ret;
+	}
+
+	return 0;
+}
+
+int disk_pwrite(struct disk *d, const void *buf, size_t len, off_t off)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = pwrite(d->fd, buf, len, off);
+		if (ret < 0) {
+			perror("pwrite");
+			return -1;
+		}
+		if (ret == 0) {
+			block_error("no progress writing at offset %jd",
+				    (intmax_t)off);
+			return -1;
+		}
+		buf = (const char *)buf + ret;
+		len -= ret;
+		off += ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Vectored variants. Entries that were only partially transferred by a short
+ * preadv()/pwritev() are completed with the scalar helpers before resuming
+ * with the remaining entries.
+ */
+int disk_preadv(struct disk *d, const struct iovec *iov, int iovcnt,
+		off_t off)
+{
+	ssize_t ret;
+
+	while (iovcnt > 0) {
+		ret = preadv(d->fd, iov, iovcnt < IOV_MAX ? iovcnt : IOV_MAX,
+			     off);
+		if (ret < 0) {
+			perror("preadv");
+			return -1;
+		}
+		if (ret == 0) {
+			block_error("unexpected end of disk at offset %jd",
+				    (intmax_t)off);
+			return -1;
+		}
+		off += ret;
+
+		/* Skip the entries that were fully transferred */
+		while (iovcnt > 0 && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (ret > 0) {
+			if (disk_pread(d, (char *)iov->iov_base + ret,
+				       iov->iov_len - ret, off))
+				return -1;
+			off += iov->iov_len - ret;
+			iov++;
+			iovcnt--;
+		}
+	}
+
+	return 0;
+}
+
+int disk_pwritev(struct disk *d, const struct iovec *iov, int iovcnt,
+		 off_t off)
+{
+	ssize_t ret;
+
+	while (iovcnt > 0) {
+		ret = pwritev(d->fd, iov, iovcnt < IOV_MAX ? iovcnt : IOV_MAX,
+			      off);
+		if (ret < 0) {
+			perror("pwritev");
+			return -1;
+		}
+		if (ret == 0) {
+			block_error("no progress writing at offset %jd",
+				    (intmax_t)off);
+			return -1;
+		}
+		off += ret;
+
+		/* Skip the entries that were fully transferred */
+		while (iovcnt > 0 && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (ret > 0) {
+			if (disk_pwrite(d, (const char *)iov->iov_base + ret,
+					iov->iov_len - ret, off))
+				return -1;
+			off += iov->iov_len - ret;
+			iov++;
+			iovcnt--;
+		}
+	}
+
+	return 0;
+}
+
+static int disk_fsync(struct disk *d)
+{
+	if (fdatasync(d->fd) < 0) {
+		perror("fdatasync");
+		return -1;
+	}
+
+	return 0;
+}
+
+const struct disk_ops disk_syscall_ops = {
+	.read = disk_pread,
+	.write = disk_pwrite,
+	.readv = disk_preadv,
+	.writev = disk_pwritev,
+	.sync = disk_fsync,
 };
 
-/* Currently open virtual disk (invalid by default) */
-static struct disk disk = { .fd = INVALID_FD };
+/*
+ * Check that the vector @iov describes whole blocks and that they fit on @d
+ * when starting at @block. Return the number of blocks, or -1.
+ */
+static ssize_t disk_iov_blocks(struct disk *d, size_t block,
+			       const struct iovec *iov, int iovcnt)
+{
+	size_t len = 0;
+	int i;
 
-int block_disk_open(const char *diskname)
+	if (iovcnt < 0 || (iovcnt > 0 && !iov)) {
+		block_error("invalid io vector");
+		return -1;
+	}
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	if (len % BLOCK_SIZE != 0) {
+		block_error("length '%zu' is not multiple of '%d'",
+			    len, BLOCK_SIZE);
+		return -1;
+	}
+
+	if (block >= d->bcount || len / BLOCK_SIZE > d->bcount - block) {
+		block_error("block range out of bounds (%zu+%zu/%zu)",
+			    block, len / BLOCK_SIZE, d->bcount);
+		return -1;
+	}
+
+	return len / BLOCK_SIZE;
+}
+
+/*
+ * Check every transfer of a batch up front, so that a batch is either rejected
+ * or handed to the backend as a whole.
+ */
+static int disk_batch_check(struct disk *d, const struct block_io *ios,
+			    int nios)
 {
+	int i;
+
+	if (nios < 0 || (nios > 0 && !ios)) {
+		block_error("invalid batch");
+		return -1;
+	}
+
+	for (i = 0; i < nios; i++)
+		if (disk_iov_blocks(d, ios[i].block, ios[i].iov,
+				    ios[i].iovcnt) < 0)
+			return -1;
+
+	return 0;
+}
+
+struct disk *disk_open_depth(const char *diskname, enum block_backend backend,
+			     int depth)
+{
+	struct disk *d;
 	int fd;
 	struct stat st;
 
 	if (!diskname) {
 		block_error("invalid file diskname");
-		return -1;
+		return NULL;
 	}
 
-	if (disk.fd != INVALID_FD) {
-		block_error("disk already open");
-		return -1;
+	if (backend != BLOCK_BACKEND_SYSCALL &&
+	    backend != BLOCK_BACKEND_IO_URING &&
+	    backend != BLOCK_BACKEND_MMAP &&
+	    backend != BLOCK_BACKEND_DIRECT) {
+		block_error("invalid backend '%d'", backend);
+		return NULL;
 	}
 
 	if ((fd = open(diskname, O_RDWR, 0644)) < 0) {
 		perror("open");
-		return -1;
+		return NULL;
+	}
+
+	/* A manifest describes a disk made of other disks */
+	if (disk_manifest_probe(fd)) {
+		close(fd);
+		return disk_manifest_open(diskname, backend, depth);
 	}
 
 	if (fstat(fd, &st)) {
 		perror("fstat");
-		return -1;
+		close(fd);
+		return NULL;
 	}
 
 	/* The disk image's size should be a multiple of the block size */
 	if (st.st_size % BLOCK_SIZE != 0) {
 		block_error("size '%zu' is not multiple of '%d'",
 			    st.st_size, BLOCK_SIZE);
+		close(fd);
+		return NULL;
+	}
+
+	d = malloc(sizeof(*d));
+	if (!d) {
+		perror("malloc");
+		close(fd);
+		return NULL;
+	}
+
+	d->fd = fd;
+	d->bcount = st.st_size / BLOCK_SIZE;
+	d->backend = BLOCK_BACKEND_SYSCALL;
+	d->ops = &disk_syscall_ops;
+	d->priv = NULL;
+
+	/* Other backends take over if they can, else system calls remain */
+	if (backend == BLOCK_BACKEND_IO_URING)
+		disk_uring_open(d);
+	else if (backend == BLOCK_BACKEND_MMAP)
+		disk_mmap_open(d);
+	else if (backend == BLOCK_BACKEND_DIRECT)
+		disk_direct_open(d);
+
+	return d;
+}
+
+struct disk *disk_open(const char *diskname, enum block_backend backend)
+{
+	return disk_open_depth(diskname, backend, 0);
+}
+
+int disk_close(struct disk *d)
+{
+	if (!d) {
+		block_error("no disk currently open");
 		return -1;
 	}
 
-	disk.fd = fd;
-	disk.bcount = st.st_size / BLOCK_SIZE;
+	if (d->ops->close)
+		d->ops->close(d);
+	if (d->fd >= 0)
+		close(d->fd);
+	free(d);
 
 	return 0;
 }
 
-int block_disk_close(void)
+int disk_count(struct disk *d)
+{
+	if (!d) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	return d->bcount;
+}
+
+int disk_backend(struct disk *d)
 {
-	if (disk.fd == INVALID_FD) {
+	if (!d) {
 		block_error("no disk currently open");
 		return -1;
 	}
 
-	close(disk.fd);
+	return d->backend;
+}
 
-	disk.fd = INVALID_FD;
+const void *disk_map(struct disk *d, size_t block)
+{
+	if (!d || block >= d->bcount || !d->ops->map)
+		return NULL;
 
-	return 0;
+	return d->ops->map(d, block);
 }
 
-int block_disk_count(void)
+int disk_register_buffer(struct disk *d, void *buf, size_t len)
 {
-	if (disk.fd == INVALID_FD) {
+	if (!d) {
 		block_error("no disk currently open");
 		return -1;
 	}
 
-	return disk.bcount;
+	if (!d->ops->register_buffer)
+		return 0;
+
+	return d->ops->register_buffer(d, buf, len);
 }
 
-int block_write(size_t block, const void *buf)
+void disk_unregister_buffer(struct disk *d)
 {
-	if (disk.fd == INVALID_FD) {
+	if (d && d->ops->unregister_buffer)
+		d->ops->unregister_buffer(d);
+}
+
+int disk_write(struct disk *d, size_t block, const void *buf)
+{
+	if (!d) {
 		block_error("no disk currently open");
 		return -1;
 	}
 
-	if (block >= disk.bcount) {
+	if (block >= d->bcount) {
 		block_error("block index out of bounds (%zu/%zu)",
-			    block, disk.bcount);
+			    block, d->bcount);
 		return -1;
 	}
 
-	/* Move to the specified block number */
-	if (lseek(disk.fd, block * BLOCK_SIZE, SEEK_SET) < 0) {
-		perror("lseek");
+	/* Perform the actual write into the disk image */
+	return d->ops->write(d, buf, BLOCK_SIZE, (off_t)block * BLOCK_SIZE);
+}
+
+int disk_read(struct disk *d, size_t block, void *buf)
+{
+	if (!d) {
+		block_error("no disk currently open");
 		return -1;
 	}
 
-	/* Perform the actual write into the disk image */
-	if (write(disk.fd, buf, BLOCK_SIZE) < 0) {
-		perror("write");
+	if (block >= d->bcount) {
+		block_error("block index out of bounds (%zu/%zu)",
+			    block, d->bcount);
 		return -1;
 	}
 
-	return 0;
+	/* Perform the actual read from the disk image */
+	return d->ops->read(d, buf, BLOCK_SIZE, (off_t)block * BLOCK_SIZE);
 }
 
-int block_read(size_t block, void *buf)
+int disk_read_multi(struct disk *d, size_t block, size_t nblocks, void *buf)
 {
-	if (disk.fd == INVALID_FD) {
+	if (!d) {
 		block_error("no disk currently open");
 		return -1;
 	}
 
-	if (block >= disk.bcount) {
-		block_error("block index out of bounds (%zu/%zu)",
-			    block, disk.bcount);
+	if (block >= d->bcount || nblocks > d->bcount - block) {
+		block_error("block range out of bounds (%zu+%zu/%zu)",
+			    block, nblocks, d->bcount);
 		return -1;
 	}
 
-	/* Move to the specified block number */
-	if (lseek(disk.fd, block * BLOCK_SIZE, SEEK_SET) < 0) {
-		perror("lseek");
+	return d->ops->read(d, buf, nblocks * BLOCK_SIZE,
+			    (off_t)block * BLOCK_SIZE);
+}
+
+int disk_write_multi(struct disk *d, size_t block, size_t nblocks,
+		     const void *buf)
+{
+	if (!d) {
+		block_error("no disk currently open");
 		return -1;
 	}
 
-	/* Perform the actual read from the disk image */
-	if (read(disk.fd, buf, BLOCK_SIZE) < 0) {
-		perror("read");
+	if (block >= d->bcount || nblocks > d->bcount - block) {
+		block_error("block range out of bounds (%zu+%zu/%zu)",
+			    block, nblocks, d->bcount);
 		return -1;
 	}
+
+	return d->ops->write(d, buf, nblocks * BLOCK_SIZE,
+			     (off_t)block * BLOCK_SIZE);
+}
+
+int disk_readv(struct disk *d, size_t block, const struct iovec *iov,
+	       int iovcnt)
+{
+	if (!d) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	if (disk_iov_blocks(d, block, iov, iovcnt) < 0)
+		return -1;
+
+	return d->ops->readv(d, iov, iovcnt, (off_t)block * BLOCK_SIZE);
+}
+
+int disk_writev(struct disk *d, size_t block, const struct iovec *iov,
+		int iovcnt)
+{
+	if (!d) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	if (disk_iov_blocks(d, block, iov, iovcnt) < 0)
+		return -1;
+
+	return d->ops->writev(d, iov, iovcnt, (off_t)block * BLOCK_SIZE);
+}
+
+static int disk_batch(struct disk *d, const struct block_io *ios, int nios,
+		      bool write)
+{
+	int i;
+
+	if (!d) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	if (disk_batch_check(d, ios, nios) < 0)
+		return -1;
+
+	if (d->ops->batch)
+		return d->ops->batch(d, ios, nios, write);
+
+	/* Backends without batching run the transfers in turn */
+	for (i = 0; i < nios; i++) {
+		const struct iovec *iov = ios[i].iov;
+		off_t off = (off_t)ios[i].block * BLOCK_SIZE;
+		int ret;
+
+		if (write)
+			ret = d->ops->writev(d, iov, ios[i].iovcnt, off);
+		else
+			ret = d->ops->readv(d, iov, ios[i].iovcnt, off);
+		if (ret)
+			return -1;
+	}
+
 	return 0;
 }
 
+int disk_readv_batch(struct disk *d, const struct block_io *ios, int nios)
+{
+	return disk_batch(d, ios, nios, false);
+}
+
+int disk_writev_batch(struct disk *d, const struct block_io *ios, int nios)
+{
+	return disk_batch(d, ios, nios, true);
+}
+
+int disk_sync(struct disk *d)
+{
+	if (!d) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	return d->ops->sync(d);
+}
+
+int disk_resync(struct disk *d, int member)
+{
+	if (!d) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	if (!d->ops->resync) {
+		block_error("disk is not mirrored");
+		return -1;
+	}
+
+	return d->ops->resync(d, member);
+}
+
+/*
+ * The block_*() functions of disk.h and disk_ext.h work on a single disk,
+ * opened and closed with block_disk_open() and block_disk_close().
+ */
+int block_disk_open_backend(const char *diskname, enum block_backend backend)
+{
+	if (disk) {
+		block_error("disk already open");
+		return -1;
+	}
+
+	disk = disk_open(diskname, backend);
+	return disk ? 0 : -1;
+}
+
+int block_disk_open(const char *diskname)
+{
+	return block_disk_open_backend(diskname, BLOCK_BACKEND_SYSCALL);
+}
+
+int block_disk_close(void)
+{
+	int ret = disk_close(disk);
+
+	disk = NULL;
+	return ret;
+}
+
+int block_disk_count(void)
+{
+	return disk_count(disk);
+}
+
+int block_disk_backend(void)
+{
+	return disk_backend(disk);
+}
+
+const void *block_map(size_t block)
+{
+	return disk_map(disk, block);
+}
+
+int block_register_buffer(void *buf, size_t len)
+{
+	return disk_register_buffer(disk, buf, len);
+}
+
+void block_unregister_buffer(void)
+{
+	disk_unregister_buffer(disk);
+}
+
+int block_write(size_t block, const void *buf)
+{
+	return disk_write(disk, block, buf);
+}
+
+int block_read(size_t block, void *buf)
+{
+	return disk_read(disk, block, buf);
+}
+
+int block_read_multi(size_t block, size_t nblocks, void *buf)
+{
+	return disk_read_multi(disk, block, nblocks, buf);
+}
+
+int block_write_multi(size_t block, size_t nblocks, const void *buf)
+{
+	return disk_write_multi(disk, block, nblocks, buf);
+}
+
+int block_readv(size_t block, const struct iovec *iov, int iovcnt)
+{
+	return disk_readv(disk, block, iov, iovcnt);
+}
+
+int block_writev(size_t block, const struct iovec *iov, int iovcnt)
+{
+	return disk_writev(disk, block, iov, iovcnt);
+}
+
+int block_readv_batch(const struct block_io *ios, int nios)
+{
+	return disk_readv_batch(disk, ios, nios);
+}
+
+int block_writev_batch(const struct block_io *ios, int nios)
+{
+	return disk_writev_batch(disk, ios, nios);
+}
+
+int block_sync(void)
+{
+	return disk_sync(disk);
+}
+
+int block_resync(int member)
+{
+	return disk_resync(disk, member);
+}
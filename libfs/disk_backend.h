@@ -0,0 +1,190 @@
+#ifndef _DISK_BACKEND_H
+#define _DISK_BACKEND_H
+
+/*
+ * Internal interface between the generic block layer of disk.c and the
+ * backends that move blocks to and from the disk image. disk.c validates every
+ * request (open disk, block bounds, whole blocks) before handing it to the
+ * backend, so backends only deal with byte ranges that fit in the image.
+ *
+ * Backend operations may be called from several threads at once.
+ */
+
+#include <stdbool.h> /* for bool definition */
+#include <stddef.h> /* for size_t definition */
+#include <sys/types.h> /* for off_t definition */
+#include <sys/uio.h> /* for struct iovec definition */
+
+#include "disk_ext.h"
+
+struct disk;
+
+/**
+ * struct disk_ops - Backend operations
+ * @read: Read @len bytes at offset @off into @buf
+ * @write: Write @len bytes of @buf at offset @off
+ * @readv: Read consecutive bytes at offset @off into the buffers of @iov
+ * @writev: Write the buffers of @iov as consecutive bytes at offset @off
+ * @batch: Optional. Run the independent transfers of @ios, reading if @write
+ * is false, as one batch. Without it, transfers run one after the other.
+ * @sync: Make every completed write durable
+ * @map: Optional. Address of @block in memory, consecutive blocks following
+ * it, for backends that keep the whole image mapped
+ * @register_buffer: Optional. Hint that @buf will be used for many transfers
+ * @unregister_buffer: Optional. Forget the buffer given to @register_buffer
+ * @resync: Optional. Bring member @member of a disk made of copies back in
+ * sync with the others
+ * @close: Optional. Release the backend state, the file is closed afterwards
+ *
+ * Every operation but @map and @close returns -1 on failure and 0 otherwise.
+ */
+struct disk_ops {
+	int (*read)(struct disk *d, void *buf, size_t len, off_t off);
+	int (*write)(struct disk *d, const void *buf, size_t len, off_t off);
+	int (*readv)(struct disk *d, const struct iovec *iov, int iovcnt,
+		     off_t off);
+	int (*writev)(struct disk *d, const struct iovec *iov, int iovcnt,
+		      off_t off);
+	int (*batch)(struct disk *d, const struct block_io *ios, int nios,
+		     bool write);
+	int (*sync)(struct disk *d);
+	const void *(*map)(struct disk *d, size_t block);
+	int (*register_buffer)(struct disk *d, void *buf, size_t len);
+	void (*unregister_buffer)(struct disk *d);
+	int (*resync)(struct disk *d, int member);
+	void (*close)(struct disk *d);
+};
+
+/**
+ * struct disk - Disk instance description
+ * @fd: File descriptor of the disk image, -1 for disks made of other disks
+ * @bcount: Block count
+ * @backend: Backend in use
+ * @ops: Operations of the backend in use
+ * @priv: Backend state
+ */
+struct disk {
+	int fd;
+	size_t bcount;
+	enum block_backend backend;
+	const struct disk_ops *ops;
+	void *priv;
+};
+
+/* Plain positional system calls, also used by other backends as a fallback */
+extern const struct disk_ops disk_syscall_ops;
+
+int disk_pread(struct disk *d, void *buf, size_t len, off_t off);
+int disk_pwrite(struct disk *d, const void *buf, size_t len, off_t off);
+int disk_preadv(struct disk *d, const struct iovec *iov, int iovcnt,
+		off_t off);
+int disk_pwritev(struct disk *d, const struct iovec *iov, int iovcnt,
+		 off_t off);
+
+/**
+ * disk_uring_open - Switch an open disk to the io_uring backend
+ * @d: Disk whose @fd and @bcount are set
+ *
+ * Return: -1 if io_uring is not supported by the build or by the running
+ * kernel, in which case @d is left untouched. 0 otherwise.
+ */
+int disk_uring_open(struct disk *d);
+
+/**
+ * disk_mmap_open - Switch an open disk to the mmap backend
+ * @d: Disk whose @fd and @bcount are set
+ *
+ * Return: -1 if the image cannot be mapped, in which case @d is left
+ * untouched. 0 otherwise.
+ */
+int disk_mmap_open(struct disk *d);
+
+/**
+ * disk_direct_open - Switch an open disk to the O_DIRECT backend
+ * @d: Disk whose @fd and @bcount are set
+ *
+ * Return: -1 if the file system of the image does not support direct
+ * transfers, in which case @d is left untouched. 0 otherwise.
+ */
+int disk_direct_open(struct disk *d);
+
+/* Deepest nesting of manifests, which may list other manifests as members */
+#define DISK_MANIFEST_MAX_DEPTH 4
+
+/**
+ * disk_open_depth - Open a disk listed @depth manifests deep
+ * @diskname: Name of the virtual disk file or manifest
+ * @backend: Backend to transfer blocks with
+ * @depth: Number of manifests leading to @diskname, 0 for disk_open()
+ *
+ * Return: NULL on failure. The new disk otherwise.
+ */
+struct disk *disk_open_depth(const char *diskname, enum block_backend backend,
+			     int depth);
+
+/**
+ * disk_manifest_probe - Tell whether a file is a disk manifest
+ * @fd: File descriptor of the file
+ *
+ * Return: true if the file starts like a manifest. false otherwise.
+ */
+bool disk_manifest_probe(int fd);
+
+/**
+ * disk_manifest_open - Open the disk described by a manifest
+ * @manifest: Name of the manifest
+ * @backend: Backend the member disks transfer blocks with
+ * @depth: Number of manifests leading to @manifest
+ *
+ * Return: NULL if the manifest is invalid or if a member cannot be opened. The
+ * new disk otherwise.
+ */
+struct disk *disk_manifest_open(const char *manifest,
+				enum block_backend backend, int depth);
+
+/**
+ * disk_stripe_open - Make a disk striped over other disks
+ * @d: Disk to set up, whose @fd is -1
+ * @members: Array of @nmembers open disks
+ * @nmembers: Number of member disks
+ * @unit: Stripe unit, in blocks
+ *
+ * On success, @d owns @members and closes them with itself.
+ *
+ * Return: -1 if the members are too small for a single stripe unit, or if the
+ * workers cannot be started, in which case @members are left untouched. 0
+ * otherwise.
+ */
+int disk_stripe_open(struct disk *d, struct disk **members, int nmembers,
+		     size_t unit);
+
+/**
+ * enum disk_mirror_policy - Ways of spreading reads over mirrored members
+ * @DISK_MIRROR_SHORTEST_QUEUE: Member with the fewest reads in flight
+ * @DISK_MIRROR_ROUND_ROBIN: Members in turn
+ */
+enum disk_mirror_policy {
+	DISK_MIRROR_SHORTEST_QUEUE,
+	DISK_MIRROR_ROUND_ROBIN,
+};
+
+/**
+ * disk_mirror_open - Make a disk mirrored over other disks
+ * @d: Disk to set up, whose @fd is -1
+ * @members: Array of @nmembers open disks holding the same blocks
+ * @nmembers: Number of member disks
+ * @policy: Policy picking the member each read goes to
+ * @state_path: File recording the members out of sync, or NULL to assume every
+ * member in sync and record nothing
+ *
+ * On success, @d owns @members and closes them with itself. Members listed in
+ * @state_path are left out until resynchronized.
+ *
+ * Return: -1 if a member is empty, if memory runs out, if @state_path cannot be
+ * read or does not describe @nmembers members, or if it leaves no member in
+ * sync, in which case @members are left untouched. 0 otherwise.
+ */
+int disk_mirror_open(struct disk *d, struct disk **members, int nmembers,
+		     enum disk_mirror_policy policy, const char *state_path);
+
+#endif /* _DISK_BACKEND_H */
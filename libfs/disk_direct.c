@@ -0,0 +1,241 @@
+#define _GNU_SOURCE /* for O_DIRECT */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "disk.h"
+#include "disk_backend.h"
+
+/*
+ * Direct transfers skip the page cache, so blocks are cached once, by libfs.
+ * They need buffers aligned like the offsets, which are always whole blocks.
+ * Aligned buffers are used in place, others go through a small pool of
+ * aligned bounce buffers.
+ */
+
+/* Alignment of the buffers of direct transfers */
+#define DIRECT_ALIGN BLOCK_SIZE
+
+/* Number of bounce buffers, and blocks per buffer */
+#define DIRECT_POOL_BUFFERS 8
+#define DIRECT_BUFFER_BLOCKS 16
+#define DIRECT_BUFFER_SIZE (DIRECT_BUFFER_BLOCKS * BLOCK_SIZE)
+
+/* Bounce buffer pool, callers wait for a buffer when all are in use */
+struct direct_pool {
+	char *mem;
+	char *free[DIRECT_POOL_BUFFERS];
+	int nfree;
+	pthread_mutex_t lock;
+	pthread_cond_t available;
+};
+
+static char *pool_get(struct direct_pool *p)
+{
+	char *buf;
+
+	pthread_mutex_lock(&p->lock);
+	while (p->nfree == 0)
+		pthread_cond_wait(&p->available, &p->lock);
+	buf = p->free[--p->nfree];
+	pthread_mutex_unlock(&p->lock);
+
+	return buf;
+}
+
+static void pool_put(struct direct_pool *p, char *buf)
+{
+	pthread_mutex_lock(&p->lock);
+	p->free[p->nfree++] = buf;
+	pthread_cond_signal(&p->available);
+	pthread_mutex_unlock(&p->lock);
+}
+
+static bool direct_aligned(const void *buf, size_t len)
+{
+	return ((uintptr_t)buf | len) % DIRECT_ALIGN == 0;
+}
+
+static bool direct_iov_aligned(const struct iovec *iov, int iovcnt)
+{
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		if (!direct_aligned(iov[i].iov_base, iov[i].iov_len))
+			return false;
+
+	return true;
+}
+
+/*
+ * Copy @len bytes between @bounce and the buffers of *@iov, starting @*skip
+ * bytes into the first one, and move *@iov and *@skip past them.
+ */
+static void direct_copy(const struct iovec **iov, size_t *skip, char *bounce,
+			size_t len, bool to_iov)
+{
+	size_t done = 0, n;
+
+	while (done < len) {
+		n = (*iov)->iov_len - *skip;
+		if (n > len - done)
+			n = len - done;
+
+		if (to_iov)
+			memcpy((char *)(*iov)->iov_base + *skip, bounce + done,
+			       n);
+		else
+			memcpy(bounce + done, (char *)(*iov)->iov_base + *skip,
+			       n);
+		done += n;
+		*skip += n;
+		if (*skip == (*iov)->iov_len) {
+			(*iov)++;
+			*skip = 0;
+		}
+	}
+}
+
+/* Transfer an unaligned vector through a bounce buffer, a buffer at a time */
+static int direct_bounce(struct disk *d, const struct iovec *iov, int iovcnt,
+			 off_t off, bool write)
+{
+	struct direct_pool *p = d->priv;
+	size_t len = 0, skip = 0, n;
+	char *bounce;
+	int i, ret = 0;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	bounce = pool_get(p);
+	while (ret == 0 && len > 0) {
+		n = len < DIRECT_BUFFER_SIZE ? len : DIRECT_BUFFER_SIZE;
+		if (write) {
+			direct_copy(&iov, &skip, bounce, n, false);
+			ret = disk_pwrite(d, bounce, n, off);
+		} else {
+			ret = disk_pread(d, bounce, n, off);
+			if (ret == 0)
+				direct_copy(&iov, &skip, bounce, n, true);
+		}
+		len -= n;
+		off += n;
+	}
+	pool_put(p, bounce);
+
+	return ret;
+}
+
+static int direct_readv(struct disk *d, const struct iovec *iov, int iovcnt,
+			off_t off)
+{
+	if (direct_iov_aligned(iov, iovcnt))
+		return disk_preadv(d, iov, iovcnt, off);
+
+	return direct_bounce(d, iov, iovcnt, off, false);
+}
+
+static int direct_writev(struct disk *d, const struct iovec *iov, int iovcnt,
+			 off_t off)
+{
+	if (direct_iov_aligned(iov, iovcnt))
+		return disk_pwritev(d, iov, iovcnt, off);
+
+	return direct_bounce(d, iov, iovcnt, off, true);
+}
+
+static int direct_read(struct disk *d, void *buf, size_t len, off_t off)
+{
+	struct iovec iov = { .iov_base = buf, .iov_len = len };
+
+	return direct_readv(d, &iov, 1, off);
+}
+
+static int direct_write(struct disk *d, const void *buf, size_t len, off_t off)
+{
+	struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+
+	return direct_writev(d, &iov, 1, off);
+}
+
+static int direct_sync(struct disk *d)
+{
+	/* Direct writes may still sit in the device's own cache */
+	return disk_syscall_ops.sync(d);
+}
+
+static void direct_free(struct direct_pool *p)
+{
+	free(p->mem);
+	free(p);
+}
+
+static void direct_close(struct disk *d)
+{
+	struct direct_pool *p = d->priv;
+
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->available);
+	direct_free(p);
+	d->priv = NULL;
+}
+
+static const struct disk_ops disk_direct_ops = {
+	.read = direct_read,
+	.write = direct_write,
+	.readv = direct_readv,
+	.writev = direct_writev,
+	.sync = direct_sync,
+	.close = direct_close,
+};
+
+int disk_direct_open(struct disk *d)
+{
+	struct direct_pool *p;
+	void *mem;
+	int flags, i;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return -1;
+	if (posix_memalign(&mem, DIRECT_ALIGN,
+			   DIRECT_POOL_BUFFERS * DIRECT_BUFFER_SIZE)) {
+		free(p);
+		return -1;
+	}
+	p->mem = mem;
+
+	/* Some file systems take the flag but fail direct transfers, try one */
+	flags = fcntl(d->fd, F_GETFL);
+	if (flags < 0 || fcntl(d->fd, F_SETFL, flags | O_DIRECT) < 0) {
+		direct_free(p);
+		return -1;
+	}
+	if (d->bcount > 0 &&
+	    pread(d->fd, p->mem, BLOCK_SIZE, 0) != BLOCK_SIZE) {
+		fcntl(d->fd, F_SETFL, flags);
+		direct_free(p);
+		return -1;
+	}
+
+	for (i = 0; i < DIRECT_POOL_BUFFERS; i++)
+		p->free[i] = p->mem + i * DIRECT_BUFFER_SIZE;
+	p->nfree = DIRECT_POOL_BUFFERS;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->available, NULL);
+
+	d->backend = BLOCK_BACKEND_DIRECT;
+	d->ops = &disk_direct_ops;
+	d->priv = p;
+
+	return 0;
+}
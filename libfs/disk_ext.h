@@ -0,0 +1,289 @@
+#ifndef _DISK_EXT_H
+#define _DISK_EXT_H
+
+/*
+ * Extensions to the block interface of disk.h. These operate on the same
+ * virtual disk as block_read() and block_write() and follow the same error
+ * conventions.
+ */
+
+#include <stddef.h> /* for size_t definition */
+#include <sys/uio.h> /* for struct iovec definition */
+
+/**
+ * enum block_backend - Ways of transferring blocks to and from the disk image
+ * @BLOCK_BACKEND_SYSCALL: One positional system call per transfer
+ * @BLOCK_BACKEND_IO_URING: io_uring submission and completion rings, with the
+ * image registered as a fixed file. Batches of transfers are submitted with a
+ * single system call, which also waits for their completion.
+ * @BLOCK_BACKEND_MMAP: The whole image mapped in memory, transfers are copies
+ * and blocks can be read in place with block_map(). Written blocks reach the
+ * image on block_sync() and block_disk_close().
+ * @BLOCK_BACKEND_DIRECT: One positional system call per transfer, bypassing
+ * the page cache with O_DIRECT. Buffers aligned on %BLOCK_SIZE are transferred
+ * in place, others through an internal pool of aligned bounce buffers.
+ */
+enum block_backend {
+	BLOCK_BACKEND_SYSCALL,
+	BLOCK_BACKEND_IO_URING,
+	BLOCK_BACKEND_MMAP,
+	BLOCK_BACKEND_DIRECT,
+};
+
+/**
+ * block_disk_open_backend - Open a virtual disk file with a given backend
+ * @diskname: Name of the virtual disk file
+ * @backend: Backend to transfer blocks with
+ *
+ * Like block_disk_open(), which uses %BLOCK_BACKEND_SYSCALL. A backend that
+ * was left out of the build or that the running kernel does not support falls
+ * back to %BLOCK_BACKEND_SYSCALL, see block_disk_backend().
+ *
+ * @diskname may also be a manifest, a text file describing a disk striped
+ * over other virtual disk files. Its first line is "stripe <unit>", with a
+ * stripe unit in blocks, and each following line the path of a member,
+ * relative to the directory of the manifest unless absolute. Logical blocks go
+ * to the members one stripe unit at a time, in turn, and transfers spanning
+ * several members run on all of them in parallel. Each member holds as many
+ * whole stripe units as the smallest one, and uses @backend.
+ *
+ * A manifest whose first line is "mirror", optionally followed by
+ * "shortest-queue" (the default) or "round-robin", describes a disk mirrored
+ * over its members instead. Every member holds a full copy of the disk, which
+ * is as large as the smallest member. Writes go to every member, and each read
+ * to a single one, picked by the given policy: the member with the fewest
+ * reads in flight, or the members in turn. A member whose transfer fails is
+ * left out until block_resync() brings it back, and recorded in a file named
+ * after the manifest with ".state" appended, so that it stays left out when
+ * the disk is opened again. Disks made of other disks cannot be mapped with
+ * block_map(), and report %BLOCK_BACKEND_SYSCALL when their members are
+ * mapped.
+ *
+ * Return: -1 on failure to open the virtual disk file or one of the members of
+ * a manifest, if the manifest is invalid, or if @backend is invalid. 0
+ * otherwise.
+ */
+int block_disk_open_backend(const char *diskname, enum block_backend backend);
+
+/**
+ * block_disk_backend - Get the backend of the open virtual disk
+ *
+ * Return: -1 if there was no virtual disk file opened. The backend in use
+ * otherwise.
+ */
+int block_disk_backend(void);
+
+/**
+ * block_map - Get the address of a block in memory
+ * @block: Index of the block
+ *
+ * With %BLOCK_BACKEND_MMAP, the content of @block can be read in place at the
+ * returned address, and that of the blocks following it right after. The
+ * address stays valid until block_disk_close(), and reflects every
+ * block_write() as soon as it returns.
+ *
+ * Return: NULL if there was no virtual disk file opened, if @block is out of
+ * bounds, or if the backend does not map the image. The address of @block
+ * otherwise.
+ */
+const void *block_map(size_t block);
+
+/**
+ * block_register_buffer - Declare a buffer used for many transfers
+ * @buf: Start of the buffer
+ * @len: Length of the buffer
+ *
+ * Let the backend prepare @buf for transfers, io_uring pins its pages once
+ * instead of on every transfer. Transfers from or to any part of @buf then
+ * take a faster path, other buffers keep working as before. A new buffer
+ * replaces the previous one. @buf must not be freed before
+ * block_unregister_buffer() or block_disk_close().
+ *
+ * Return: -1 if there was no virtual disk file opened, or if the backend could
+ * not prepare the buffer. 0 otherwise, including for backends that have
+ * nothing to prepare.
+ */
+int block_register_buffer(void *buf, size_t len);
+
+/**
+ * block_unregister_buffer - Forget the buffer given to block_register_buffer()
+ */
+void block_unregister_buffer(void);
+
+/**
+ * struct block_io - One transfer of a batch
+ * @block: Index of the first block to transfer
+ * @iov: Array of buffers, as for block_readv() and block_writev()
+ * @iovcnt: Number of entries in @iov
+ */
+struct block_io {
+	size_t block;
+	const struct iovec *iov;
+	int iovcnt;
+};
+
+/**
+ * block_readv_batch - Run several block_readv() at once
+ * @ios: Transfers to run
+ * @nios: Number of entries in @ios
+ *
+ * The transfers run in no particular order and possibly concurrently, so they
+ * must not overlap each other.
+ *
+ * Return: -1 if any transfer is invalid or fails, in which case any of them may
+ * have been done. 0 otherwise.
+ */
+int block_readv_batch(const struct block_io *ios, int nios);
+
+/**
+ * block_writev_batch - Run several block_writev() at once
+ * @ios: Transfers to run
+ * @nios: Number of entries in @ios
+ *
+ * Like block_readv_batch(), for writes.
+ *
+ * Return: -1 if any transfer is invalid or fails, in which case any of them may
+ * have been done. 0 otherwise.
+ */
+int block_writev_batch(const struct block_io *ios, int nios);
+
+/**
+ * block_read_multi - Read consecutive blocks from disk
+ * @block: Index of the first block to read from
+ * @nblocks: Number of consecutive blocks to read
+ * @buf: Data buffer to be filled with content of blocks
+ *
+ * Read the content of virtual disk's blocks @block to @block + @nblocks - 1
+ * (@nblocks * %BLOCK_SIZE bytes) into buffer @buf with a single positional
+ * transfer.
+ *
+ * Return: -1 if the block range is out of bounds or inaccessible, or if the
+ * reading operation fails. 0 otherwise.
+ */
+int block_read_multi(size_t block, size_t nblocks, void *buf);
+
+/**
+ * block_write_multi - Write consecutive blocks to disk
+ * @block: Index of the first block to write to
+ * @nblocks: Number of consecutive blocks to write
+ * @buf: Data buffer to write in the blocks
+ *
+ * Write the content of buffer @buf (@nblocks * %BLOCK_SIZE bytes) in the
+ * virtual disk's blocks @block to @block + @nblocks - 1 with a single
+ * positional transfer.
+ *
+ * Return: -1 if the block range is out of bounds or inaccessible, or if the
+ * writing operation fails. 0 otherwise.
+ */
+int block_write_multi(size_t block, size_t nblocks, const void *buf);
+
+/**
+ * block_readv - Read consecutive blocks from disk into a buffer vector
+ * @block: Index of the first block to read from
+ * @iov: Array of buffers to be filled with content of blocks
+ * @iovcnt: Number of entries in @iov
+ *
+ * Read consecutive blocks starting at @block and scatter them over the
+ * buffers of @iov, in order, as a single vectored transfer. Buffers may be of
+ * any length as long as their total length is a multiple of %BLOCK_SIZE, so a
+ * run of blocks can land partly in bounce buffers and partly in place.
+ *
+ * Return: -1 if the total length is not a multiple of %BLOCK_SIZE, if the block
+ * range is out of bounds or inaccessible, or if the reading operation fails. 0
+ * otherwise.
+ */
+int block_readv(size_t block, const struct iovec *iov, int iovcnt);
+
+/**
+ * block_writev - Write consecutive blocks to disk from a buffer vector
+ * @block: Index of the first block to write to
+ * @iov: Array of buffers to write in the blocks
+ * @iovcnt: Number of entries in @iov
+ *
+ * Gather the buffers of @iov, in order, and write them in consecutive blocks
+ * starting at @block as a single vectored transfer. The total length of the
+ * buffers must be a multiple of %BLOCK_SIZE.
+ *
+ * Return: -1 if the total length is not a multiple of %BLOCK_SIZE, if the block
+ * range is out of bounds or inaccessible, or if the writing operation fails. 0
+ * otherwise.
+ */
+int block_writev(size_t block, const struct iovec *iov, int iovcnt);
+
+/**
+ * block_sync - Make written blocks durable
+ *
+ * Wait until every block written so far has reached stable storage. Blocks
+ * written after block_sync() returns are ordered after the ones before it.
+ *
+ * Return: -1 if there was no virtual disk file opened, or if the
+ * synchronization fails. 0 otherwise.
+ */
+int block_sync(void);
+
+/**
+ * block_resync - Bring a member of a mirrored disk back in sync
+ * @member: Index of the member, in the order of the manifest
+ *
+ * Copy every block of the disk onto @member from another member that is in
+ * sync, then make the copy durable. Transfers may go on meanwhile: @member
+ * receives writes during the copy, but no reads until it is done. A member
+ * left behind outside of the disk, such as an image restored from an old copy,
+ * has to be resynchronized before the disk is used, since every member not
+ * recorded out of sync is assumed in sync when the disk is opened.
+ *
+ * Return: -1 if there was no virtual disk file opened, if it is not
+ * mirrored, if @member is invalid, if no other member is in sync, or if the
+ * copy fails, in which case @member stays out of sync. 0 otherwise.
+ */
+int block_resync(int member);
+
+/*
+ * Several disks can be open at once through disk handles. Every block_*()
+ * function has a disk_*() counterpart taking the disk as first argument, with
+ * the same behavior and return values. The block_*() functions work on a disk
+ * of their own, which no handle refers to.
+ */
+struct disk;
+
+/**
+ * disk_open - Open a virtual disk file as a new disk handle
+ * @diskname: Name of the virtual disk file
+ * @backend: Backend to transfer blocks with
+ *
+ * Like block_disk_open_backend(), except that any number of disks can be open
+ * at once.
+ *
+ * Return: NULL on failure to open the virtual disk file, or if @backend is
+ * invalid. The new disk otherwise.
+ */
+struct disk *disk_open(const char *diskname, enum block_backend backend);
+
+/**
+ * disk_close - Close a disk handle
+ * @d: Disk returned by disk_open(), no longer valid afterwards
+ *
+ * Return: -1 if @d is NULL. 0 otherwise.
+ */
+int disk_close(struct disk *d);
+
+int disk_count(struct disk *d);
+int disk_backend(struct disk *d);
+const void *disk_map(struct disk *d, size_t block);
+int disk_register_buffer(struct disk *d, void *buf, size_t len);
+void disk_unregister_buffer(struct disk *d);
+int disk_read(struct disk *d, size_t block, void *buf);
+int disk_write(struct disk *d, size_t block, const void *buf);
+int disk_read_multi(struct disk *d, size_t block, size_t nblocks, void *buf);
+int disk_write_multi(struct disk *d, size_t block, size_t nblocks,
+		     const void *buf);
+int disk_readv(struct disk *d, size_t block, const struct iovec *iov,
+	       int iovcnt);
+int disk_writev(struct disk *d, size_t block, const struct iovec *iov,
+		int iovcnt);
+int disk_readv_batch(struct disk *d, const struct block_io *ios, int nios);
+int disk_writev_batch(struct disk *d, const struct block_io *ios, int nios);
+int disk_sync(struct disk *d);
+int disk_resync(struct disk *d, int member);
+
+#endif /* _DISK_EXT_H */
@@ -0,0 +1,199 @@
+#include <ctype.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "disk.h"
+#include "disk_backend.h"
+
+#define manifest_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+/*
+ * A manifest is a text file describing a disk made of other disks. Its first
+ * line gives the layout, each following line the path of a member. Relative
+ * paths start from the directory of the manifest, and a member may be a
+ * manifest itself. Empty lines and lines starting with '#' are skipped.
+ *
+ *	stripe <stripe unit in blocks>
+ *	<member>
+ *	...
+ *
+ * or
+ *
+ *	mirror [shortest-queue|round-robin]
+ *	<member>
+ *	...
+ *
+ * A mirrored disk records its members out of sync next to the manifest, in a
+ * file named after it with MANIFEST_STATE appended.
+ */
+
+/* Start of the first line of a striped and of a mirrored disk manifest */
+#define MANIFEST_STRIPE "stripe "
+#define MANIFEST_MIRROR "mirror"
+
+/* Suffix of the state file of a mirrored disk */
+#define MANIFEST_STATE ".state"
+
+/* Layout described by a manifest */
+struct manifest_layout {
+	bool mirror;
+	size_t unit;
+	enum disk_mirror_policy policy;
+};
+
+bool disk_manifest_probe(int fd)
+{
+	char head[sizeof(MANIFEST_STRIPE) - 1];
+	ssize_t len;
+
+	len = pread(fd, head, sizeof(head), 0);
+	if (len == sizeof(head) && !memcmp(head, MANIFEST_STRIPE, len))
+		return true;
+
+	return len >= (ssize_t)sizeof(MANIFEST_MIRROR) - 1 &&
+	       !memcmp(head, MANIFEST_MIRROR, sizeof(MANIFEST_MIRROR) - 1);
+}
+
+/* Parse the first line of a manifest */
+static int manifest_layout(struct manifest_layout *layout, const char *line)
+{
+	char policy[32] = "shortest-queue", extra;
+	size_t len;
+
+	if (sscanf(line, MANIFEST_STRIPE "%zu %c", &layout->unit,
+		   &extra) == 1 && layout->unit > 0) {
+		layout->mirror = false;
+		return 0;
+	}
+
+	len = sizeof(MANIFEST_MIRROR) - 1;
+	if (strncmp(line, MANIFEST_MIRROR, len) ||
+	    (line[len] != '\0' && !isspace((unsigned char)line[len])) ||
+	    sscanf(line + len, " %31s %c", policy, &extra) > 1)
+		return -1;
+	layout->mirror = true;
+	if (!strcmp(policy, "shortest-queue"))
+		layout->policy = DISK_MIRROR_SHORTEST_QUEUE;
+	else if (!strcmp(policy, "round-robin"))
+		layout->policy = DISK_MIRROR_ROUND_ROBIN;
+	else
+		return -1;
+
+	return 0;
+}
+
+/* Build the path of @member, relative to the directory of @manifest */
+static int manifest_member_path(char *path, const char *manifest,
+				const char *member)
+{
+	const char *slash = strrchr(manifest, '/');
+	int dirlen = slash && member[0] != '/' ? slash - manifest + 1 : 0;
+	int len;
+
+	len = snprintf(path, PATH_MAX, "%.*s%s", dirlen, manifest, member);
+	if (len < 0 || len >= PATH_MAX) {
+		manifest_error("member path too long '%s'", member);
+		return -1;
+	}
+
+	return 0;
+}
+
+struct disk *disk_manifest_open(const char *manifest,
+				enum block_backend backend, int depth)
+{
+	char line[PATH_MAX], path[PATH_MAX], state[PATH_MAX];
+	struct disk **members = NULL, **grown, *d = NULL;
+	struct manifest_layout layout;
+	bool header = false;
+	int nmembers = 0, i;
+	FILE *f;
+
+	if (depth >= DISK_MANIFEST_MAX_DEPTH) {
+		manifest_error("manifests nested too deeply at '%s'", manifest);
+		return NULL;
+	}
+
+	f = fopen(manifest, "r");
+	if (!f) {
+		perror("fopen");
+		return NULL;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '\0' || line[0] == '#')
+			continue;
+
+		if (!header) {
+			if (manifest_layout(&layout, line)) {
+				manifest_error("invalid layout '%s'", line);
+				goto fail;
+			}
+			header = true;
+			continue;
+		}
+
+		if (manifest_member_path(path, manifest, line))
+			goto fail;
+		grown = realloc(members, (nmembers + 1) * sizeof(*members));
+		if (!grown) {
+			perror("realloc");
+			goto fail;
+		}
+		members = grown;
+		members[nmembers] = disk_open_depth(path, backend, depth + 1);
+		if (!members[nmembers])
+			goto fail;
+		nmembers++;
+	}
+	fclose(f);
+	f = NULL;
+
+	if (nmembers == 0) {
+		manifest_error("no member in '%s'", manifest);
+		goto fail;
+	}
+
+	d = malloc(sizeof(*d));
+	if (!d) {
+		perror("malloc");
+		goto fail;
+	}
+	d->fd = -1;
+	d->priv = NULL;
+
+	if (layout.mirror &&
+	    snprintf(state, sizeof(state), "%s" MANIFEST_STATE,
+		     manifest) >= (int)sizeof(state)) {
+		manifest_error("manifest path too long '%s'", manifest);
+		goto fail;
+	}
+	if (layout.mirror &&
+	    disk_mirror_open(d, members, nmembers, layout.policy, state)) {
+		manifest_error("cannot mirror '%s'", manifest);
+		goto fail;
+	}
+	if (!layout.mirror &&
+	    disk_stripe_open(d, members, nmembers, layout.unit)) {
+		manifest_error("cannot stripe '%s'", manifest);
+		goto fail;
+	}
+
+	return d;
+
+fail:
+	if (f)
+		fclose(f);
+	for (i = 0; i < nmembers; i++)
+		disk_close(members[i]);
+	free(members);
+	free(d);
+	return NULL;
+}
@@ -0,0 +1,529 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "disk.h"
+#include "disk_backend.h"
+
+#define mirror_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+/*
+ * Every member holds a full copy of the disk. Writes go to every member that
+ * is not stale, reads to a single in-sync member picked by the read policy. A
+ * member whose transfer fails becomes stale and is left out until it is
+ * resynchronized from an in-sync member, while the others carry on.
+ *
+ * Resynchronization copies the disk a chunk at a time. The target member
+ * receives writes during the copy, and each chunk is copied while writes are
+ * held off, so that a write never lands between the read and the write of the
+ * copy of its blocks.
+ *
+ * Members out of sync are recorded in a state file, so that they stay left out
+ * when the disk is opened again. It holds the number of members, then the
+ * index of each member out of sync, and only exists while one is:
+ *
+ *	members <number of members>
+ *	stale <member index>
+ *	...
+ *
+ * The file is replaced as a whole and made durable before the transfer that
+ * left the member behind reports success. Until a change could be recorded,
+ * writes and syncs fail.
+ */
+
+/* Blocks copied at a time by a resynchronization */
+#define MIRROR_RESYNC_BLOCKS 256
+
+/* States of a member */
+enum mirror_state {
+	MIRROR_IN_SYNC,
+	MIRROR_RESYNC,
+	MIRROR_STALE,
+};
+
+struct mirror {
+	int nmembers;
+	struct disk **members;
+	enum disk_mirror_policy policy;
+
+	/* Per member state and number of reads in flight */
+	int *state;
+	unsigned int *inflight;
+
+	/* Next member of the round-robin policy */
+	unsigned int next;
+
+	/* Held for reading by writes, for writing to change states or copy */
+	pthread_rwlock_t lock;
+
+	/* State file, or NULL, and whether its last update failed */
+	char *state_path;
+	bool unrecorded;
+	pthread_mutex_t record_lock;
+};
+
+static int mirror_state(struct mirror *m, int i)
+{
+	return __atomic_load_n(&m->state[i], __ATOMIC_ACQUIRE);
+}
+
+static void mirror_set_state(struct mirror *m, int i, int state)
+{
+	__atomic_store_n(&m->state[i], state, __ATOMIC_RELEASE);
+}
+
+/* Make the entry of @path in its directory durable */
+static int mirror_sync_dir(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	char dir[PATH_MAX];
+	int fd, ret;
+
+	if (!slash)
+		snprintf(dir, sizeof(dir), ".");
+	else
+		snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path + 1),
+			 path);
+
+	fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		perror("open");
+		return -1;
+	}
+	ret = fsync(fd);
+	if (ret)
+		perror("fsync");
+	close(fd);
+
+	return ret;
+}
+
+/* Replace the state file with the members currently out of sync */
+static int mirror_write_state(struct mirror *m)
+{
+	char tmp[PATH_MAX];
+	bool stale = false;
+	FILE *f;
+	int i, ret;
+
+	for (i = 0; i < m->nmembers; i++)
+		if (mirror_state(m, i) != MIRROR_IN_SYNC)
+			stale = true;
+	if (!stale) {
+		if (unlink(m->state_path) && errno != ENOENT) {
+			perror("unlink");
+			return -1;
+		}
+		return mirror_sync_dir(m->state_path);
+	}
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", m->state_path) >=
+	    (int)sizeof(tmp)) {
+		mirror_error("path too long '%s'", m->state_path);
+		return -1;
+	}
+	f = fopen(tmp, "w");
+	if (!f) {
+		perror("fopen");
+		return -1;
+	}
+	fprintf(f, "members %d\n", m->nmembers);
+	for (i = 0; i < m->nmembers; i++)
+		if (mirror_state(m, i) != MIRROR_IN_SYNC)
+			fprintf(f, "stale %d\n", i);
+	ret = fflush(f) || fsync(fileno(f));
+	if (fclose(f) || ret) {
+		perror("fsync");
+		unlink(tmp);
+		return -1;
+	}
+	if (rename(tmp, m->state_path)) {
+		perror("rename");
+		unlink(tmp);
+		return -1;
+	}
+
+	return mirror_sync_dir(m->state_path);
+}
+
+/* Record the member states, remembering a failure to retry it later */
+static int mirror_record(struct mirror *m)
+{
+	int ret;
+
+	if (!m->state_path)
+		return 0;
+
+	pthread_mutex_lock(&m->record_lock);
+	ret = mirror_write_state(m);
+	if (ret)
+		mirror_error("cannot record member states in '%s'",
+			     m->state_path);
+	__atomic_store_n(&m->unrecorded, ret != 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&m->record_lock);
+
+	return ret;
+}
+
+/* Retry recording member states if an earlier attempt failed */
+static int mirror_recorded(struct mirror *m)
+{
+	if (!__atomic_load_n(&m->unrecorded, __ATOMIC_ACQUIRE))
+		return 0;
+
+	return mirror_record(m);
+}
+
+static int mirror_fail(struct mirror *m, int i)
+{
+	if (mirror_state(m, i) != MIRROR_STALE)
+		mirror_error("member %d is out of sync and needs a resync", i);
+	mirror_set_state(m, i, MIRROR_STALE);
+
+	return mirror_record(m);
+}
+
+/* Pick an in-sync member to read from, or -1 if there is none */
+static int mirror_pick(struct mirror *m)
+{
+	unsigned int load, best_load = UINT32_MAX;
+	int i, j, best = -1;
+
+	if (m->policy == DISK_MIRROR_ROUND_ROBIN) {
+		i = __atomic_fetch_add(&m->next, 1, __ATOMIC_RELAXED) %
+		    m->nmembers;
+		for (j = 0; j < m->nmembers; j++, i = (i + 1) % m->nmembers)
+			if (mirror_state(m, i) == MIRROR_IN_SYNC)
+				return i;
+		return -1;
+	}
+
+	for (i = 0; i < m->nmembers; i++) {
+		if (mirror_state(m, i) != MIRROR_IN_SYNC)
+			continue;
+		load = __atomic_load_n(&m->inflight[i], __ATOMIC_RELAXED);
+		if (load < best_load) {
+			best = i;
+			best_load = load;
+		}
+	}
+
+	return best;
+}
+
+/* Read from in-sync members until one of them succeeds */
+static int mirror_readv(struct disk *d, const struct iovec *iov, int iovcnt,
+			off_t off)
+{
+	struct mirror *m = d->priv;
+	struct disk *member;
+	int i, ret;
+
+	while ((i = mirror_pick(m)) >= 0) {
+		member = m->members[i];
+		__atomic_add_fetch(&m->inflight[i], 1, __ATOMIC_RELAXED);
+		ret = member->ops->readv(member, iov, iovcnt, off);
+		__atomic_sub_fetch(&m->inflight[i], 1, __ATOMIC_RELAXED);
+		if (ret == 0)
+			return 0;
+		mirror_fail(m, i);
+	}
+
+	mirror_error("no member left in sync");
+	return -1;
+}
+
+/* Write to every member not stale, succeeding if an in-sync one did */
+static int mirror_writev(struct disk *d, const struct iovec *iov, int iovcnt,
+			 off_t off)
+{
+	struct mirror *m = d->priv;
+	struct disk *member;
+	bool written = false;
+	int i, state;
+
+	pthread_rwlock_rdlock(&m->lock);
+	for (i = 0; i < m->nmembers; i++) {
+		state = mirror_state(m, i);
+		if (state == MIRROR_STALE)
+			continue;
+
+		member = m->members[i];
+		if (member->ops->writev(member, iov, iovcnt, off))
+			mirror_fail(m, i);
+		else if (state == MIRROR_IN_SYNC)
+			written = true;
+	}
+	pthread_rwlock_unlock(&m->lock);
+
+	/* A member left behind must not be trusted by the next open */
+	return written && !mirror_recorded(m) ? 0 : -1;
+}
+
+static int mirror_read(struct disk *d, void *buf, size_t len, off_t off)
+{
+	struct iovec iov = { .iov_base = buf, .iov_len = len };
+
+	return mirror_readv(d, &iov, 1, off);
+}
+
+static int mirror_write(struct disk *d, const void *buf, size_t len, off_t off)
+{
+	struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+
+	return mirror_writev(d, &iov, 1, off);
+}
+
+static int mirror_sync(struct disk *d)
+{
+	struct mirror *m = d->priv;
+	bool synced = false;
+	int i, state;
+
+	pthread_rwlock_rdlock(&m->lock);
+	for (i = 0; i < m->nmembers; i++) {
+		state = mirror_state(m, i);
+		if (state == MIRROR_STALE)
+			continue;
+
+		if (m->members[i]->ops->sync(m->members[i]))
+			mirror_fail(m, i);
+		else if (state == MIRROR_IN_SYNC)
+			synced = true;
+	}
+	pthread_rwlock_unlock(&m->lock);
+
+	return synced && !mirror_recorded(m) ? 0 : -1;
+}
+
+static void mirror_unregister_buffer(struct disk *d)
+{
+	struct mirror *m = d->priv;
+	int i;
+
+	for (i = 0; i < m->nmembers; i++)
+		disk_unregister_buffer(m->members[i]);
+}
+
+/* Every member transfers from and to the same buffers */
+static int mirror_register_buffer(struct disk *d, void *buf, size_t len)
+{
+	struct mirror *m = d->priv;
+	int i;
+
+	for (i = 0; i < m->nmembers; i++) {
+		if (disk_register_buffer(m->members[i], buf, len)) {
+			mirror_unregister_buffer(d);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int mirror_resync(struct disk *d, int target)
+{
+	struct mirror *m = d->priv;
+	struct disk *member;
+	size_t block, n;
+	char *buf;
+	int src = -1, i, ret = 0;
+
+	if (target < 0 || target >= m->nmembers) {
+		mirror_error("invalid member %d", target);
+		return -1;
+	}
+
+	buf = malloc(MIRROR_RESYNC_BLOCKS * BLOCK_SIZE);
+	if (!buf) {
+		perror("malloc");
+		return -1;
+	}
+
+	/* From now on, writes also go to the target */
+	pthread_rwlock_wrlock(&m->lock);
+	for (i = 0; i < m->nmembers && src < 0; i++)
+		if (i != target && mirror_state(m, i) == MIRROR_IN_SYNC)
+			src = i;
+	if (src >= 0)
+		mirror_set_state(m, target, MIRROR_RESYNC);
+	pthread_rwlock_unlock(&m->lock);
+	if (src < 0) {
+		mirror_error("no other member in sync");
+		free(buf);
+		return -1;
+	}
+
+	for (block = 0; block < d->bcount && ret == 0; block += n) {
+		n = d->bcount - block;
+		if (n > MIRROR_RESYNC_BLOCKS)
+			n = MIRROR_RESYNC_BLOCKS;
+
+		pthread_rwlock_wrlock(&m->lock);
+		member = m->members[src];
+		ret = member->ops->read(member, buf, n * BLOCK_SIZE,
+					(off_t)block * BLOCK_SIZE);
+		if (ret)
+			mirror_fail(m, src);
+		member = m->members[target];
+		if (!ret)
+			ret = member->ops->write(member, buf, n * BLOCK_SIZE,
+						 (off_t)block * BLOCK_SIZE);
+		if (!ret && mirror_state(m, target) == MIRROR_STALE)
+			ret = -1;
+		pthread_rwlock_unlock(&m->lock);
+	}
+
+	/* Only copies that reached stable storage count */
+	member = m->members[target];
+	if (!ret)
+		ret = member->ops->sync(member);
+
+	pthread_rwlock_wrlock(&m->lock);
+	mirror_set_state(m, target, ret ? MIRROR_STALE : MIRROR_IN_SYNC);
+	if (!ret)
+		ret = mirror_record(m);
+	pthread_rwlock_unlock(&m->lock);
+
+	free(buf);
+	return ret;
+}
+
+static void mirror_free(struct mirror *m)
+{
+	free(m->state_path);
+	free(m->state);
+	free(m->inflight);
+	free(m);
+}
+
+static void mirror_close(struct disk *d)
+{
+	struct mirror *m = d->priv;
+	int i;
+
+	for (i = 0; i < m->nmembers; i++)
+		disk_close(m->members[i]);
+	free(m->members);
+	pthread_rwlock_destroy(&m->lock);
+	pthread_mutex_destroy(&m->record_lock);
+	mirror_free(m);
+	d->priv = NULL;
+}
+
+static const struct disk_ops disk_mirror_ops = {
+	.read = mirror_read,
+	.write = mirror_write,
+	.readv = mirror_readv,
+	.writev = mirror_writev,
+	.sync = mirror_sync,
+	.register_buffer = mirror_register_buffer,
+	.unregister_buffer = mirror_unregister_buffer,
+	.resync = mirror_resync,
+	.close = mirror_close,
+};
+
+/* Leave out the members recorded out of sync by an earlier run */
+static int mirror_read_state(struct mirror *m)
+{
+	char line[64];
+	bool in_sync = false;
+	int i, n = -1;
+	FILE *f;
+
+	f = fopen(m->state_path, "r");
+	if (!f) {
+		if (errno == ENOENT)
+			return 0;
+		perror("fopen");
+		return -1;
+	}
+
+	if (!fgets(line, sizeof(line), f) ||
+	    sscanf(line, "members %d", &n) != 1 || n != m->nmembers) {
+		mirror_error("'%s' does not describe %d members",
+			     m->state_path, m->nmembers);
+		fclose(f);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "stale %d", &i) != 1 || i < 0 ||
+		    i >= m->nmembers) {
+			mirror_error("invalid line '%s' in '%s'", line,
+				     m->state_path);
+			fclose(f);
+			return -1;
+		}
+		mirror_error("member %d is out of sync and needs a resync", i);
+		mirror_set_state(m, i, MIRROR_STALE);
+	}
+	fclose(f);
+
+	for (i = 0; i < m->nmembers; i++)
+		if (mirror_state(m, i) == MIRROR_IN_SYNC)
+			in_sync = true;
+	if (!in_sync) {
+		mirror_error("no member in sync");
+		return -1;
+	}
+
+	return 0;
+}
+
+int disk_mirror_open(struct disk *d, struct disk **members, int nmembers,
+		     enum disk_mirror_policy policy, const char *state_path)
+{
+	struct mirror *m;
+	size_t bcount = SIZE_MAX;
+	int i;
+
+	if (nmembers < 1)
+		return -1;
+
+	/* The disk is as large as the smallest member */
+	for (i = 0; i < nmembers; i++)
+		if (members[i]->bcount < bcount)
+			bcount = members[i]->bcount;
+	if (bcount == 0)
+		return -1;
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return -1;
+	m->state = calloc(nmembers, sizeof(*m->state));
+	m->inflight = calloc(nmembers, sizeof(*m->inflight));
+	if (state_path)
+		m->state_path = strdup(state_path);
+	if (!m->state || !m->inflight || (state_path && !m->state_path)) {
+		mirror_free(m);
+		return -1;
+	}
+	m->nmembers = nmembers;
+	m->members = members;
+	m->policy = policy;
+	if (m->state_path && mirror_read_state(m)) {
+		mirror_free(m);
+		return -1;
+	}
+	pthread_rwlock_init(&m->lock, NULL);
+	pthread_mutex_init(&m->record_lock, NULL);
+
+	d->bcount = bcount;
+	/* Transfers go through the members, the disk itself is never mapped */
+	d->backend = members[0]->backend == BLOCK_BACKEND_MMAP ?
+		     BLOCK_BACKEND_SYSCALL : members[0]->backend;
+	d->ops = &disk_mirror_ops;
+	d->priv = m;
+
+	return 0;
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "disk.h"
+#include "disk_backend.h"
+
+/*
+ * The whole image is mapped shared, so transfers are plain copies to and from
+ * the page cache and the kernel writes dirty pages back on its own. Callers
+ * never access the same block concurrently when one of them writes it, so
+ * copies need no locking.
+ */
+
+static size_t mmap_len(struct disk *d)
+{
+	return d->bcount * BLOCK_SIZE;
+}
+
+static int mmap_read(struct disk *d, void *buf, size_t len, off_t off)
+{
+	memcpy(buf, (char *)d->priv + off, len);
+	return 0;
+}
+
+static int mmap_write(struct disk *d, const void *buf, size_t len, off_t off)
+{
+	memcpy((char *)d->priv + off, buf, len);
+	return 0;
+}
+
+static int mmap_readv(struct disk *d, const struct iovec *iov, int iovcnt,
+		      off_t off)
+{
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(iov[i].iov_base, (char *)d->priv + off, iov[i].iov_len);
+		off += iov[i].iov_len;
+	}
+
+	return 0;
+}
+
+static int mmap_writev(struct disk *d, const struct iovec *iov, int iovcnt,
+		       off_t off)
+{
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		memcpy((char *)d->priv + off, iov[i].iov_base, iov[i].iov_len);
+		off += iov[i].iov_len;
+	}
+
+	return 0;
+}
+
+static int mmap_sync(struct disk *d)
+{
+	if (msync(d->priv, mmap_len(d), MS_SYNC) < 0) {
+		perror("msync");
+		return -1;
+	}
+
+	return 0;
+}
+
+static const void *mmap_map(struct disk *d, size_t block)
+{
+	return (const char *)d->priv + block * BLOCK_SIZE;
+}
+
+static void mmap_close(struct disk *d)
+{
+	/* Whatever was written reaches the image before it is closed */
+	mmap_sync(d);
+	munmap(d->priv, mmap_len(d));
+	d->priv = NULL;
+}
+
+static const struct disk_ops disk_mmap_ops = {
+	.read = mmap_read,
+	.write = mmap_write,
+	.readv = mmap_readv,
+	.writev = mmap_writev,
+	.sync = mmap_sync,
+	.map = mmap_map,
+	.close = mmap_close,
+};
+
+int disk_mmap_open(struct disk *d)
+{
+	void *base;
+
+	/* An empty mapping is not allowed */
+	if (d->bcount == 0)
+		return -1;
+
+	base = mmap(NULL, mmap_len(d), PROT_READ | PROT_WRITE, MAP_SHARED,
+		    d->fd, 0);
+	if (base == MAP_FAILED)
+		return -1;
+
+	d->backend = BLOCK_BACKEND_MMAP;
+	d->ops = &disk_mmap_ops;
+	d->priv = base;
+
+	return 0;
+}
@@ -0,0 +1,424 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "disk.h"
+#include "disk_backend.h"
+
+/*
+ * Logical blocks are laid out in stripe units of consecutive blocks, given to
+ * the members in turn: unit u lives on member u % n, as the (u / n)-th unit of
+ * that member. The blocks a transfer needs from one member are thus always
+ * consecutive on it, so a transfer splits into at most one part per member.
+ * Parts run in parallel: the caller runs one of them itself and hands the
+ * others to a worker thread per member.
+ */
+
+/* Transfers with up to this many parts and pieces need no allocation */
+#define STRIPE_STACK_PARTS 16
+#define STRIPE_STACK_PIECES 64
+
+/* Part of a transfer that one member serves */
+struct stripe_part {
+	struct iovec *iov;
+	int iovcnt;
+	off_t off;
+	int member;
+	bool write;
+	struct stripe_req *req;
+	struct stripe_part *next;
+};
+
+/* Parts of a transfer still running on workers */
+struct stripe_req {
+	int pending;
+	int ret;
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+};
+
+/* Worker of one member and its queue of parts */
+struct stripe_worker {
+	pthread_t thread;
+	struct disk *member;
+	struct stripe_part *head;
+	struct stripe_part *tail;
+	bool stop;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+};
+
+struct stripe {
+	size_t unit;
+	int nmembers;
+	struct disk **members;
+	struct stripe_worker *workers;
+};
+
+static int stripe_part_run(struct disk *member, const struct stripe_part *p)
+{
+	if (p->write)
+		return member->ops->writev(member, p->iov, p->iovcnt, p->off);
+
+	return member->ops->readv(member, p->iov, p->iovcnt, p->off);
+}
+
+static void *stripe_worker(void *arg)
+{
+	struct stripe_worker *w = arg;
+	struct stripe_part *p;
+	struct stripe_req *req;
+	int ret;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (!w->head && !w->stop)
+			pthread_cond_wait(&w->wake, &w->lock);
+		if (!w->head)
+			break;
+
+		p = w->head;
+		w->head = p->next;
+		pthread_mutex_unlock(&w->lock);
+
+		ret = stripe_part_run(w->member, p);
+
+		req = p->req;
+		pthread_mutex_lock(&req->lock);
+		if (ret)
+			req->ret = -1;
+		if (--req->pending == 0)
+			pthread_cond_signal(&req->done);
+		pthread_mutex_unlock(&req->lock);
+
+		pthread_mutex_lock(&w->lock);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+static void stripe_queue(struct stripe_worker *w, struct stripe_part *p)
+{
+	p->next = NULL;
+	pthread_mutex_lock(&w->lock);
+	if (w->head)
+		w->tail->next = p;
+	else
+		w->head = p;
+	w->tail = p;
+	pthread_cond_signal(&w->wake);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/*
+ * Split @io into the parts of @parts, one per member. Without @fill, only
+ * count the buffer pieces of each part, so that their arrays can be sized.
+ */
+static void stripe_split(struct stripe *s, const struct block_io *io,
+			 struct stripe_part *parts, bool fill)
+{
+	const struct iovec *iov = io->iov;
+	size_t block = io->block, left = 0, skip = 0;
+	size_t unit, nblocks, len, n;
+	struct stripe_part *p;
+	int i;
+
+	for (i = 0; i < io->iovcnt; i++)
+		left += iov[i].iov_len;
+	left /= BLOCK_SIZE;
+
+	while (left > 0) {
+		unit = block / s->unit;
+		p = &parts[unit % s->nmembers];
+		if (p->iovcnt == 0)
+			p->off = (off_t)((unit / s->nmembers) * s->unit +
+					 block % s->unit) * BLOCK_SIZE;
+
+		nblocks = s->unit - block % s->unit;
+		if (nblocks > left)
+			nblocks = left;
+		block += nblocks;
+		left -= nblocks;
+
+		for (len = nblocks * BLOCK_SIZE; len > 0; len -= n) {
+			while (skip == iov->iov_len) {
+				iov++;
+				skip = 0;
+			}
+			n = iov->iov_len - skip;
+			if (n > len)
+				n = len;
+			if (fill) {
+				p->iov[p->iovcnt].iov_base =
+					(char *)iov->iov_base + skip;
+				p->iov[p->iovcnt].iov_len = n;
+			}
+			p->iovcnt++;
+			skip += n;
+		}
+	}
+}
+
+static int stripe_batch(struct disk *d, const struct block_io *ios, int nios,
+			bool write)
+{
+	struct stripe *s = d->priv;
+	struct stripe_part stack_parts[STRIPE_STACK_PARTS];
+	struct iovec stack_pieces[STRIPE_STACK_PIECES];
+	struct stripe_part *parts = stack_parts, *local = NULL;
+	struct stripe_req req = { .ret = 0 };
+	struct iovec *pieces = stack_pieces;
+	size_t npieces = 0;
+	int nparts = nios * s->nmembers;
+	bool queued;
+	int i, ret;
+
+	if (nios == 0)
+		return 0;
+
+	if (nparts > STRIPE_STACK_PARTS) {
+		parts = calloc(nparts, sizeof(*parts));
+		if (!parts) {
+			perror("calloc");
+			return -1;
+		}
+	} else {
+		memset(parts, 0, nparts * sizeof(*parts));
+	}
+	for (i = 0; i < nios; i++)
+		stripe_split(s, &ios[i], &parts[i * s->nmembers], false);
+	for (i = 0; i < nparts; i++)
+		npieces += parts[i].iovcnt;
+
+	if (npieces > STRIPE_STACK_PIECES) {
+		pieces = malloc(npieces * sizeof(*pieces));
+		if (!pieces) {
+			perror("malloc");
+			if (parts != stack_parts)
+				free(parts);
+			return -1;
+		}
+	}
+	for (npieces = 0, i = 0; i < nparts; i++) {
+		parts[i].iov = pieces + npieces;
+		npieces += parts[i].iovcnt;
+		parts[i].iovcnt = 0;
+	}
+	for (i = 0; i < nios; i++)
+		stripe_split(s, &ios[i], &parts[i * s->nmembers], true);
+
+	/* Every part but the caller's is counted before any of them starts */
+	for (i = 0; i < nparts; i++) {
+		parts[i].member = i % s->nmembers;
+		parts[i].write = write;
+		parts[i].req = &req;
+		if (parts[i].iovcnt > 0 && !local)
+			local = &parts[i];
+		else if (parts[i].iovcnt > 0)
+			req.pending++;
+	}
+
+	queued = req.pending > 0;
+	if (queued) {
+		pthread_mutex_init(&req.lock, NULL);
+		pthread_cond_init(&req.done, NULL);
+		for (i = 0; i < nparts; i++)
+			if (parts[i].iovcnt > 0 && &parts[i] != local)
+				stripe_queue(&s->workers[parts[i].member],
+					     &parts[i]);
+	}
+
+	ret = local ? stripe_part_run(s->members[local->member], local) : 0;
+
+	if (queued) {
+		pthread_mutex_lock(&req.lock);
+		while (req.pending > 0)
+			pthread_cond_wait(&req.done, &req.lock);
+		pthread_mutex_unlock(&req.lock);
+		pthread_mutex_destroy(&req.lock);
+		pthread_cond_destroy(&req.done);
+	}
+
+	if (pieces != stack_pieces)
+		free(pieces);
+	if (parts != stack_parts)
+		free(parts);
+
+	return ret || req.ret ? -1 : 0;
+}
+
+static int stripe_readv(struct disk *d, const struct iovec *iov, int iovcnt,
+			off_t off)
+{
+	struct block_io io = {
+		.block = off / BLOCK_SIZE, .iov = iov, .iovcnt = iovcnt
+	};
+
+	return stripe_batch(d, &io, 1, false);
+}
+
+static int stripe_writev(struct disk *d, const struct iovec *iov, int iovcnt,
+			 off_t off)
+{
+	struct block_io io = {
+		.block = off / BLOCK_SIZE, .iov = iov, .iovcnt = iovcnt
+	};
+
+	return stripe_batch(d, &io, 1, true);
+}
+
+static int stripe_read(struct disk *d, void *buf, size_t len, off_t off)
+{
+	struct iovec iov = { .iov_base = buf, .iov_len = len };
+
+	return stripe_readv(d, &iov, 1, off);
+}
+
+static int stripe_write(struct disk *d, const void *buf, size_t len, off_t off)
+{
+	struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+
+	return stripe_writev(d, &iov, 1, off);
+}
+
+static int stripe_sync(struct disk *d)
+{
+	struct stripe *s = d->priv;
+	int i, ret = 0;
+
+	for (i = 0; i < s->nmembers; i++)
+		if (s->members[i]->ops->sync(s->members[i]))
+			ret = -1;
+
+	return ret;
+}
+
+static void stripe_unregister_buffer(struct disk *d)
+{
+	struct stripe *s = d->priv;
+	int i;
+
+	for (i = 0; i < s->nmembers; i++)
+		disk_unregister_buffer(s->members[i]);
+}
+
+/* Every member transfers parts of the same buffers */
+static int stripe_register_buffer(struct disk *d, void *buf, size_t len)
+{
+	struct stripe *s = d->priv;
+	int i;
+
+	for (i = 0; i < s->nmembers; i++) {
+		if (disk_register_buffer(s->members[i], buf, len)) {
+			stripe_unregister_buffer(d);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Stop the first @nworkers workers, then close every member */
+static void stripe_free(struct stripe *s, int nworkers)
+{
+	struct stripe_worker *w;
+	int i;
+
+	for (i = 0; i < nworkers; i++) {
+		w = &s->workers[i];
+		pthread_mutex_lock(&w->lock);
+		w->stop = true;
+		pthread_cond_signal(&w->wake);
+		pthread_mutex_unlock(&w->lock);
+		pthread_join(w->thread, NULL);
+		pthread_mutex_destroy(&w->lock);
+		pthread_cond_destroy(&w->wake);
+	}
+
+	for (i = 0; i < s->nmembers; i++)
+		disk_close(s->members[i]);
+	free(s->members);
+	free(s->workers);
+	free(s);
+}
+
+static void stripe_close(struct disk *d)
+{
+	struct stripe *s = d->priv;
+
+	stripe_free(s, s->nmembers);
+	d->priv = NULL;
+}
+
+static const struct disk_ops disk_stripe_ops = {
+	.read = stripe_read,
+	.write = stripe_write,
+	.readv = stripe_readv,
+	.writev = stripe_writev,
+	.batch = stripe_batch,
+	.sync = stripe_sync,
+	.register_buffer = stripe_register_buffer,
+	.unregister_buffer = stripe_unregister_buffer,
+	.close = stripe_close,
+};
+
+int disk_stripe_open(struct disk *d, struct disk **members, int nmembers,
+		     size_t unit)
+{
+	struct stripe *s;
+	size_t rows = SIZE_MAX;
+	int i;
+
+	if (nmembers < 1 || unit == 0)
+		return -1;
+
+	/* Every member holds as many whole units as the smallest one */
+	for (i = 0; i < nmembers; i++)
+		if (members[i]->bcount / unit < rows)
+			rows = members[i]->bcount / unit;
+	if (rows == 0)
+		return -1;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -1;
+	s->workers = calloc(nmembers, sizeof(*s->workers));
+	if (!s->workers) {
+		free(s);
+		return -1;
+	}
+	s->unit = unit;
+	s->nmembers = nmembers;
+	s->members = members;
+
+	for (i = 0; i < nmembers; i++) {
+		s->workers[i].member = members[i];
+		pthread_mutex_init(&s->workers[i].lock, NULL);
+		pthread_cond_init(&s->workers[i].wake, NULL);
+		if (pthread_create(&s->workers[i].thread, NULL, stripe_worker,
+				   &s->workers[i])) {
+			pthread_mutex_destroy(&s->workers[i].lock);
+			pthread_cond_destroy(&s->workers[i].wake);
+			/* The members stay with the caller */
+			s->nmembers = 0;
+			s->members = NULL;
+			stripe_free(s, i);
+			return -1;
+		}
+	}
+
+	d->bcount = rows * unit * nmembers;
+	/* Transfers go through the members, the disk itself is never mapped */
+	d->backend = members[0]->backend == BLOCK_BACKEND_MMAP ?
+		     BLOCK_BACKEND_SYSCALL : members[0]->backend;
+	d->ops = &disk_stripe_ops;
+	d->priv = s;
+
+	return 0;
+}
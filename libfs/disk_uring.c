@@ -0,0 +1,597 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * io_uring is driven through its raw system calls, so that no library is
+ * needed. Builds for systems without it only keep the system call backend.
+ */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && \
+	defined(__NR_io_uring_register)
+#define DISK_HAVE_URING
+#endif
+#endif
+#endif
+
+/* <linux/fs.h>, pulled in by <linux/io_uring.h>, has a BLOCK_SIZE of its own */
+#undef BLOCK_SIZE
+
+#include "disk.h"
+#include "disk_backend.h"
+
+#ifdef DISK_HAVE_URING
+
+/* Number of submission queue entries */
+#define URING_ENTRIES 256
+
+/* Largest number of requests submitted and waited for together */
+#define URING_BATCH 64
+
+/* Largest number of buffers of a vectored request (UIO_MAXIOV) */
+#define URING_IOV_MAX 1024
+
+/* Kernel features the backend relies on, all present since Linux 5.6 */
+#define URING_FEATURES (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | \
+			IORING_FEAT_SUBMIT_STABLE | IORING_FEAT_RW_CUR_POS)
+
+/* One transfer, described by the iovec array it reads into or writes from */
+struct uring_req {
+	const struct iovec *iov;
+	int iovcnt;
+	off_t off;
+	bool write;
+};
+
+/* Completion of one transfer, filled in by whichever thread reaps it */
+struct uring_op {
+	int res;
+	bool done;
+};
+
+/* Requests waiting to be submitted together */
+struct uring_batch {
+	struct uring_req reqs[URING_BATCH];
+	int n;
+	int ret;
+};
+
+/*
+ * Ring instance. Submitters fill entries and publish the tail under @sq_lock.
+ * Completions are reaped under @cq_lock, and only while no thread sits in the
+ * kernel waiting for them (@reaping), so that the completions a waiter counts
+ * on are never taken away from under it.
+ */
+struct uring {
+	int fd;
+
+	/* Submission ring */
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	struct io_uring_sqe *sqes;
+
+	/* Completion ring */
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* Mappings shared with the kernel */
+	void *ring_map;
+	size_t ring_len;
+	size_t sqes_len;
+
+	/* Registered buffer, if any */
+	char *buf;
+	size_t buf_len;
+
+	pthread_mutex_t sq_lock;
+	pthread_mutex_t cq_lock;
+	pthread_cond_t cq_cond;
+	unsigned int waiters;
+	bool reaping;
+	bool broken;
+};
+
+static int uring_enter(struct uring *r, unsigned int to_submit,
+		       unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, r->fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+static bool uring_retry(void)
+{
+	return errno == EINTR || errno == EAGAIN || errno == EBUSY;
+}
+
+/* Hand every posted completion to its transfer, with @cq_lock held */
+static void uring_reap(struct uring *r)
+{
+	unsigned int head = *r->cq_head;
+	unsigned int tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail) {
+		struct io_uring_cqe *cqe = &r->cqes[head & r->cq_mask];
+		struct uring_op *op = (void *)(uintptr_t)cqe->user_data;
+
+		op->res = cqe->res;
+		op->done = true;
+		head++;
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&r->cq_cond);
+}
+
+/* Reap what is there if nobody waits in the kernel, for a full ring */
+static void uring_drain(struct uring *r)
+{
+	pthread_mutex_lock(&r->cq_lock);
+	if (!r->reaping)
+		uring_reap(r);
+	pthread_mutex_unlock(&r->cq_lock);
+}
+
+static bool uring_fixed(struct uring *r, const struct uring_req *req)
+{
+	const char *base = req->iov[0].iov_base;
+	const char *end = r->buf + r->buf_len;
+
+	return req->iovcnt == 1 && r->buf && base >= r->buf && base < end &&
+	       req->iov[0].iov_len <= (size_t)(end - base);
+}
+
+static void uring_prep(struct uring *r, struct io_uring_sqe *sqe,
+		       const struct uring_req *req, struct uring_op *op)
+{
+	memset(sqe, 0, sizeof(*sqe));
+
+	/* Single buffers are plain transfers, from registered memory if they can */
+	if (uring_fixed(r, req)) {
+		sqe->opcode = req->write ? IORING_OP_WRITE_FIXED :
+			IORING_OP_READ_FIXED;
+		sqe->buf_index = 0;
+	} else if (req->iovcnt == 1) {
+		sqe->opcode = req->write ? IORING_OP_WRITE : IORING_OP_READ;
+	} else {
+		sqe->opcode = req->write ? IORING_OP_WRITEV : IORING_OP_READV;
+	}
+	if (req->iovcnt == 1) {
+		sqe->addr = (uintptr_t)req->iov[0].iov_base;
+		sqe->len = req->iov[0].iov_len;
+	} else {
+		sqe->addr = (uintptr_t)req->iov;
+		sqe->len = req->iovcnt;
+	}
+
+	/* The image is registered file 0 */
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->fd = 0;
+	sqe->off = req->off;
+	sqe->user_data = (uintptr_t)op;
+}
+
+/* Queue the requests, return the ring position after the last one or -1 */
+static int uring_queue(struct uring *r, const struct uring_req *reqs,
+		       struct uring_op *ops, int n, unsigned int *last)
+{
+	unsigned int tail;
+	int i;
+
+	pthread_mutex_lock(&r->sq_lock);
+	if (r->broken) {
+		pthread_mutex_unlock(&r->sq_lock);
+		return -1;
+	}
+
+	tail = *r->sq_tail;
+	for (i = 0; i < n; i++) {
+		/* A full ring holds entries of other threads, submit them */
+		while (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) ==
+		       r->sq_entries) {
+			if (uring_enter(r, r->sq_entries, 0, 0) >= 0)
+				continue;
+			if (!uring_retry()) {
+				perror("io_uring_enter");
+				pthread_mutex_unlock(&r->sq_lock);
+				return -1;
+			}
+			uring_drain(r);
+		}
+
+		ops[i].done = false;
+		uring_prep(r, &r->sqes[tail & r->sq_mask], &reqs[i], &ops[i]);
+		tail++;
+		__atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&r->sq_lock);
+
+	*last = tail;
+	return 0;
+}
+
+/*
+ * Submit the entries queued up to @last and wait for @ops. The thread that
+ * finds nobody waiting in the kernel submits and waits with a single
+ * io_uring_enter(), the others only submit and sleep until it reaps.
+ */
+static int uring_wait(struct uring *r, struct uring_op *ops, int n,
+		      unsigned int last)
+{
+	unsigned int remaining, pending, min;
+	bool wait;
+	int i, ret;
+
+	pthread_mutex_lock(&r->cq_lock);
+	r->waiters++;
+	while (!r->broken) {
+		if (!r->reaping)
+			uring_reap(r);
+
+		remaining = 0;
+		for (i = 0; i < n; i++)
+			remaining += !ops[i].done;
+		if (remaining == 0)
+			break;
+
+		/* Entries up to ours that the kernel has not consumed yet */
+		pending = last - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+		if ((int)pending < 0)
+			pending = 0;
+
+		if (r->reaping && pending == 0) {
+			pthread_cond_wait(&r->cq_cond, &r->cq_lock);
+			continue;
+		}
+
+		/* Wake up for each completion when others wait as well */
+		wait = !r->reaping;
+		min = 0;
+		if (wait) {
+			r->reaping = true;
+			min = r->waiters > 1 ? 1 : remaining;
+		}
+		pthread_mutex_unlock(&r->cq_lock);
+		ret = uring_enter(r, pending, min,
+				  wait ? IORING_ENTER_GETEVENTS : 0);
+		pthread_mutex_lock(&r->cq_lock);
+		if (wait) {
+			r->reaping = false;
+			pthread_cond_broadcast(&r->cq_cond);
+		}
+
+		/* Transfers still in flight can never be reaped from now on */
+		if (ret < 0 && !uring_retry()) {
+			perror("io_uring_enter");
+			r->broken = true;
+			pthread_cond_broadcast(&r->cq_cond);
+		}
+	}
+	r->waiters--;
+	ret = r->broken ? -1 : 0;
+	pthread_mutex_unlock(&r->cq_lock);
+
+	return ret;
+}
+
+/*
+ * Complete a request of which the first @done bytes were transferred with the
+ * system call helpers, which resume short transfers and report errors.
+ */
+static int uring_finish(struct disk *d, const struct uring_req *req,
+			size_t done)
+{
+	const struct iovec *iov = req->iov;
+	int iovcnt = req->iovcnt;
+	off_t off = req->off + done;
+	char *base;
+	size_t len;
+
+	while (iovcnt > 0 && done >= iov->iov_len) {
+		done -= iov->iov_len;
+		iov++;
+		iovcnt--;
+	}
+	if (iovcnt == 0)
+		return 0;
+
+	base = (char *)iov->iov_base + done;
+	len = iov->iov_len - done;
+	if (req->write ? disk_pwrite(d, base, len, off) :
+	    disk_pread(d, base, len, off))
+		return -1;
+	if (iovcnt == 1)
+		return 0;
+
+	off += len;
+	return req->write ? disk_pwritev(d, iov + 1, iovcnt - 1, off) :
+		disk_preadv(d, iov + 1, iovcnt - 1, off);
+}
+
+/* Run up to %URING_BATCH requests concurrently and wait for all of them */
+static int uring_run(struct disk *d, const struct uring_req *reqs, int n)
+{
+	struct uring *r = d->priv;
+	struct uring_op ops[URING_BATCH];
+	unsigned int last;
+	size_t len;
+	int i, j, ret = 0;
+
+	if (uring_queue(r, reqs, ops, n, &last) ||
+	    uring_wait(r, ops, n, last))
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		if (ops[i].res < 0) {
+			errno = -ops[i].res;
+			perror(reqs[i].write ? "io_uring write" :
+			       "io_uring read");
+			ret = -1;
+			continue;
+		}
+
+		/* Short transfers are resumed synchronously */
+		len = 0;
+		for (j = 0; j < reqs[i].iovcnt; j++)
+			len += reqs[i].iov[j].iov_len;
+		if ((size_t)ops[i].res < len &&
+		    uring_finish(d, &reqs[i], ops[i].res))
+			ret = -1;
+	}
+
+	return ret;
+}
+
+static void uring_batch_add(struct disk *d, struct uring_batch *b,
+			    const struct iovec *iov, int iovcnt, off_t off,
+			    bool write)
+{
+	int cnt, i;
+
+	/* Long vectors are split in requests the kernel accepts */
+	while (b->ret == 0 && iovcnt > 0) {
+		if (b->n == URING_BATCH) {
+			b->ret = uring_run(d, b->reqs, b->n);
+			b->n = 0;
+		}
+
+		cnt = iovcnt < URING_IOV_MAX ? iovcnt : URING_IOV_MAX;
+		b->reqs[b->n].iov = iov;
+		b->reqs[b->n].iovcnt = cnt;
+		b->reqs[b->n].off = off;
+		b->reqs[b->n].write = write;
+		b->n++;
+
+		for (i = 0; i < cnt; i++)
+			off += iov[i].iov_len;
+		iov += cnt;
+		iovcnt -= cnt;
+	}
+}
+
+static int uring_batch_run(struct disk *d, struct uring_batch *b)
+{
+	if (b->ret == 0 && b->n > 0)
+		b->ret = uring_run(d, b->reqs, b->n);
+
+	return b->ret;
+}
+
+static int uring_readv(struct disk *d, const struct iovec *iov, int iovcnt,
+		       off_t off)
+{
+	struct uring_batch b = { .n = 0, .ret = 0 };
+
+	uring_batch_add(d, &b, iov, iovcnt, off, false);
+	return uring_batch_run(d, &b);
+}
+
+static int uring_writev(struct disk *d, const struct iovec *iov, int iovcnt,
+			off_t off)
+{
+	struct uring_batch b = { .n = 0, .ret = 0 };
+
+	uring_batch_add(d, &b, iov, iovcnt, off, true);
+	return uring_batch_run(d, &b);
+}
+
+static int uring_read(struct disk *d, void *buf, size_t len, off_t off)
+{
+	struct iovec iov = { .iov_base = buf, .iov_len = len };
+
+	/* A request length is 32 bits wide */
+	if (len > INT_MAX)
+		return disk_pread(d, buf, len, off);
+
+	return uring_readv(d, &iov, 1, off);
+}
+
+static int uring_write(struct disk *d, const void *buf, size_t len, off_t off)
+{
+	struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+
+	if (len > INT_MAX)
+		return disk_pwrite(d, buf, len, off);
+
+	return uring_writev(d, &iov, 1, off);
+}
+
+static int uring_batch(struct disk *d, const struct block_io *ios, int nios,
+		       bool write)
+{
+	struct uring_batch b = { .n = 0, .ret = 0 };
+	int i;
+
+	for (i = 0; i < nios; i++)
+		uring_batch_add(d, &b, ios[i].iov, ios[i].iovcnt,
+				(off_t)ios[i].block * BLOCK_SIZE, write);
+
+	return uring_batch_run(d, &b);
+}
+
+static int uring_sync(struct disk *d)
+{
+	return disk_syscall_ops.sync(d);
+}
+
+static int uring_register_buffer(struct disk *d, void *buf, size_t len)
+{
+	struct uring *r = d->priv;
+	struct iovec iov = { .iov_base = buf, .iov_len = len };
+	int ret = 0;
+
+	/* No transfer picks the buffer up while it changes */
+	pthread_mutex_lock(&r->sq_lock);
+	if (r->buf)
+		syscall(__NR_io_uring_register, r->fd,
+			IORING_UNREGISTER_BUFFERS, NULL, 0);
+	r->buf = NULL;
+	r->buf_len = 0;
+	if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS,
+		    &iov, 1) == 0) {
+		r->buf = buf;
+		r->buf_len = len;
+	} else {
+		ret = -1;
+	}
+	pthread_mutex_unlock(&r->sq_lock);
+
+	return ret;
+}
+
+static void uring_unregister_buffer(struct disk *d)
+{
+	struct uring *r = d->priv;
+
+	pthread_mutex_lock(&r->sq_lock);
+	if (r->buf)
+		syscall(__NR_io_uring_register, r->fd,
+			IORING_UNREGISTER_BUFFERS, NULL, 0);
+	r->buf = NULL;
+	r->buf_len = 0;
+	pthread_mutex_unlock(&r->sq_lock);
+}
+
+static void uring_free(struct uring *r)
+{
+	if (r->sqes && r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->sqes_len);
+	if (r->ring_map && r->ring_map != MAP_FAILED)
+		munmap(r->ring_map, r->ring_len);
+	if (r->fd >= 0)
+		close(r->fd);
+	free(r);
+}
+
+static void uring_close(struct disk *d)
+{
+	struct uring *r = d->priv;
+
+	pthread_mutex_destroy(&r->sq_lock);
+	pthread_mutex_destroy(&r->cq_lock);
+	pthread_cond_destroy(&r->cq_cond);
+	uring_free(r);
+	d->priv = NULL;
+}
+
+static const struct disk_ops disk_uring_ops = {
+	.read = uring_read,
+	.write = uring_write,
+	.readv = uring_readv,
+	.writev = uring_writev,
+	.batch = uring_batch,
+	.sync = uring_sync,
+	.register_buffer = uring_register_buffer,
+	.unregister_buffer = uring_unregister_buffer,
+	.close = uring_close,
+};
+
+int disk_uring_open(struct disk *d)
+{
+	struct io_uring_params p;
+	struct uring *r;
+	size_t sq_len, cq_len;
+	char *ring;
+	unsigned int i;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return -1;
+
+	/* Kernels without io_uring, or with it disabled, fail right here */
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (r->fd < 0 || (p.features & URING_FEATURES) != URING_FEATURES) {
+		uring_free(r);
+		return -1;
+	}
+
+	/* Both rings share one mapping, the entries have their own */
+	sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	r->ring_len = sq_len > cq_len ? sq_len : cq_len;
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->ring_map = mmap(NULL, r->ring_len, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->ring_map == MAP_FAILED || r->sqes == MAP_FAILED) {
+		uring_free(r);
+		return -1;
+	}
+
+	ring = r->ring_map;
+	r->sq_head = (unsigned int *)(ring + p.sq_off.head);
+	r->sq_tail = (unsigned int *)(ring + p.sq_off.tail);
+	r->sq_mask = *(unsigned int *)(ring + p.sq_off.ring_mask);
+	r->sq_entries = p.sq_entries;
+	r->cq_head = (unsigned int *)(ring + p.cq_off.head);
+	r->cq_tail = (unsigned int *)(ring + p.cq_off.tail);
+	r->cq_mask = *(unsigned int *)(ring + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+	/* Submission slot i always holds entry i */
+	for (i = 0; i < p.sq_entries; i++)
+		((unsigned int *)(ring + p.sq_off.array))[i] = i;
+
+	/* Register the image so that requests skip the file table lookup */
+	if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_FILES,
+		    &d->fd, 1) < 0) {
+		uring_free(r);
+		return -1;
+	}
+
+	pthread_mutex_init(&r->sq_lock, NULL);
+	pthread_mutex_init(&r->cq_lock, NULL);
+	pthread_cond_init(&r->cq_cond, NULL);
+
+	d->backend = BLOCK_BACKEND_IO_URING;
+	d->ops = &disk_uring_ops;
+	d->priv = r;
+
+	return 0;
+}
+
+#else /* !DISK_HAVE_URING */
+
+int disk_uring_open(struct disk *d)
+{
+	(void)d;
+	return -1;
+}
+
+#endif /* DISK_HAVE_URING */
@@ -1,19 +1,34 @@
 #include <assert.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/uio.h>
 
+#include "aio.h"
+#include "alloc.h"
+#include "cache.h"
+#include "dir.h"
 #include "disk.h"
+#include "disk_ext.h"
 #include "fs.h"
+#include "fs_ext.h"
+#include "journal.h"
 
 
 #define FS_SIGNATURE 6000536558536704837
 
 #define FAT_EOC 0xFFFF
 
+//never a data block, stands for a fat entry whose block could not be read
+#define FAT_ERROR 0xFFFE
+
+#define SUMMARY_MAGIC 0x4D4D5553 /* "SUMM" */
+
 #define MAX_FILENAME 16
 
 #define EMPTY '\0'
@@ -28,19 +43,24 @@ struct __attribute__((__packed__)) superblock_t {
   uint16_t data_blk_idx;
   uint16_t data_blk;
   uint8_t fat_blk_count;
-  uint8_t padding[BLOCK_SIZE - 17];
-};
 
-//create superblock instance
-struct superblock_t *superblock;
+  //optional metadata journal between the root directory and the data blocks
+  uint32_t journal_magic;
+  uint16_t journal_blk;
+  uint16_t journal_blk_count;
+
+  //free space summary, only valid while the magic is set
+  uint32_t summary_magic;
+  uint16_t summary_free_blk;
+  uint8_t summary_free_rdir;
+  uint8_t padding[BLOCK_SIZE - 32];
+};
 
 //fat block struct
 struct __attribute__((__packed__)) fat_block_entry_t {
   uint16_t directory;
 };
 
-//create fat_block structure 
-struct fat_block_entry_t *fat_block_arr;
 struct __attribute__((__packed__)) root_dir_entry_t {
   uint8_t filename[MAX_FILENAME];
   uint32_t size;
@@ -48,596 +68,2136 @@ struct __attribute__((__packed__)) root_dir_entry_t {
   uint8_t padding[10];
 };
 
-//create root_dir instance
-struct root_dir_entry_t root_dir[FS_FILE_MAX_COUNT];
-
 //create file directory entries
 struct file_info {
   size_t offset;
   int loc;
+
+  //cursor remembering the data block of the last logical block accessed
+  size_t cur_lblk;
+  uint16_t cur_pblk;
+
+  //offset a sequential read would start at, current read-ahead window and
+  //first logical block not read ahead yet
+  size_t ra_next;
+  size_t ra_window;
+  size_t ra_end;
 };
 
-//create file directory instance
-struct file_info file_directory[FS_OPEN_MAX_COUNT];
+//run of physically consecutive data blocks of a file
+struct extent {
+  uint32_t lblk;
+  uint16_t pblk;
+  uint16_t len;
+};
 
-bool validmount = false;
+//extent list of a file, built on first seek and kept up to date until delete
+struct extent_index {
+  struct extent *ext;
+  size_t count;
+  size_t cap;
+  bool valid;
+};
 
-void close_fd(void) {
+//capacity of the block cache of the next mount
+size_t cache_blocks = FS_CACHE_DEFAULT_BLOCKS;
+
+//allocation policy and reservation window size of the next mount
+enum fs_alloc_policy alloc_policy = FS_ALLOC_FIRST_FIT;
+size_t alloc_window = 0;
+
+//how many metadata changes trigger a write back
+unsigned int flush_interval = FS_FLUSH_DEFAULT_INTERVAL;
+
+//smallest and largest read-ahead windows, in blocks
+#define READAHEAD_MIN_BLOCKS 4
+size_t readahead_max = FS_READAHEAD_DEFAULT_BLOCKS;
+
+//block backend used at next mount
+enum block_backend io_backend = BLOCK_BACKEND_SYSCALL;
+
+//whether the next mount reads the fat up front or block by block on demand
+enum fs_fat_mode fat_mode = FS_FAT_EAGER;
+
+//number of mounted volumes, the settings above only change while there is
+//none so that volumes read them without locking
+static unsigned int volume_count;
+static pthread_mutex_t config_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//mounted volume, everything that belongs to one disk
+struct fs_volume {
+  struct disk *disk;
+  struct block_cache *cache;
+  struct free_map *map;
+  struct dir_index *dir;
+  struct journal *journal;
+  struct superblock_t *superblock;
+  struct fat_block_entry_t *fat_block_arr;
+  struct root_dir_entry_t root_dir[FS_FILE_MAX_COUNT];
+  struct file_info file_directory[FS_OPEN_MAX_COUNT];
+
+  //extent index, one per root directory entry
+  struct extent_index file_extents[FS_FILE_MAX_COUNT];
+
+  //last data block of each file once known, FAT_EOC otherwise
+  uint16_t file_tail[FS_FILE_MAX_COUNT];
+
+  bool validmount;
+
+  //dirty flags of the fat blocks and of the root directory
+  bool *fat_dirty;
+  bool rdir_dirty;
+
+  //fat blocks read from disk so far, the free-space map needs all of them
+  bool *fat_loaded;
+  bool map_loaded;
+
+  //whether the free counts in the superblock are valid, and whether the
+  //superblock on disk still holds a summary
+  bool summary_loaded;
+  bool summary_on_disk;
+
+  //metadata changes since the last write back
+  unsigned int meta_ops;
+
+  //locks, always taken in this order:
+  //mount lock, held for writing by mount and unmount and for reading otherwise
+  //directory lock, for the root directory entries and the descriptor table
+  //descriptor locks, for the offset, cursor and read-ahead state of each fd
+  //file locks, held for reading by readers of a file and for writing by writers
+  //metadata lock, for the fat, the allocator, file sizes and write back
+  //fat lock, for reading fat blocks on first use
+  pthread_rwlock_t mount_lock;
+  pthread_mutex_t dir_lock;
+  pthread_mutex_t fd_locks[FS_OPEN_MAX_COUNT];
+  pthread_rwlock_t file_locks[FS_FILE_MAX_COUNT];
+  pthread_mutex_t meta_lock;
+  pthread_mutex_t fat_lock;
+};
 
-  //iterate through file directory and close them
-  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
-    file_directory[i].loc = -1;
-  }
-}
+//create the volume behind the calls of fs.h
+static struct fs_volume default_fs = {
+  .mount_lock = PTHREAD_RWLOCK_INITIALIZER,
+  .dir_lock = PTHREAD_MUTEX_INITIALIZER,
+  .fd_locks = {
+    [0 ... FS_OPEN_MAX_COUNT - 1] = PTHREAD_MUTEX_INITIALIZER
+  },
+  .file_locks = {
+    [0 ... FS_FILE_MAX_COUNT - 1] = PTHREAD_RWLOCK_INITIALIZER
+  },
+  .meta_lock = PTHREAD_MUTEX_INITIALIZER,
+  .fat_lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
-int fs_mount(const char *diskname) {
+int load_fat(struct fs_volume *fs, int first, int count) {
 
-  //check if disk exists
-  int safe = block_disk_open(diskname);
-  if (safe != 0) {
+  //read the runs of fat blocks that are not in memory yet
+  int ret = 0;
+  pthread_mutex_lock(&fs->fat_lock);
+  int i = first;
+  while (i < first + count && ret == 0) {
+    if (fs->fat_loaded[i]) {
+      i++;
+      continue;
+    }
 
-    return -1;
+    int run = 1;
+    while (i + run < first + count && !fs->fat_loaded[i + run]) {
+      run++;
+    }
+    ret = disk_read_multi(fs->disk, i + 1, run,
+                          &fs->fat_block_arr[i * FAT_SIZE]);
+    for (int j = i; ret == 0 && j < i + run; j++) {
+      __atomic_store_n(&fs->fat_loaded[j], true, __ATOMIC_RELEASE);
+    }
+    i += run;
   }
+  pthread_mutex_unlock(&fs->fat_lock);
 
-  //allocate space for superblock and read 
-  superblock = calloc(BLOCK_SIZE, 1);
-  if (superblock == NULL) {
-    return -1;
-  }
-  if (block_read(0, superblock) == -1) {
-    block_disk_close();
-    return -1;
-  }
+  return ret;
+}
 
-  //place root directory into appropriate array
-  if (block_read(superblock->rdir_blk, root_dir) == -1) {
+uint16_t get_fat(struct fs_volume *fs, uint16_t idx) {
 
-    block_disk_close();
-    return -1;
+  //read the entry's fat block on first use, a chain cannot go on without it
+  int blk = idx / FAT_SIZE;
+  if (!__atomic_load_n(&fs->fat_loaded[blk], __ATOMIC_ACQUIRE) &&
+      load_fat(fs, blk, 1) == -1) {
+    return FAT_ERROR;
   }
 
-  //make a fat block array and read from superblock
-  fat_block_arr = malloc((superblock->fat_blk_count) * BLOCK_SIZE);
-  for (int i = 0; i < superblock->fat_blk_count; i++) {
+  return fs->fat_block_arr[idx].directory;
+}
 
-    if (block_read(i + 1, &fat_block_arr[i * FAT_SIZE]) == -1) {
+int load_map(struct fs_volume *fs) {
 
-      return -1;
-    }
+  //the free-space map is filled in before the first change to the fat
+  if (fs->map_loaded) {
+    return 0;
   }
-
-  //check signature
-  if (superblock->signature != FS_SIGNATURE) {
+  if (load_fat(fs, 0, fs->superblock->fat_blk_count) == -1) {
     return -1;
   }
 
-  //check number of blocks
-  if (superblock->total_blk_count != block_disk_count()) {
-    return -1;
+  //from the free fat entries
+  for (int i = 0; i < fs->superblock->data_blk; i++) {
+    if (fs->fat_block_arr[i].directory == 0) {
+      alloc_release(fs->map, i);
+    }
   }
 
-  //close all open files
-  close_fd();
-
-  //global state for later calls
-  validmount = true;
-
+  fs->map_loaded = true;
   return 0;
 }
 
-int fs_umount(void) {
+void set_fat(struct fs_volume *fs, uint16_t idx, uint16_t value) {
 
-  //check if there are any open files
-  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
-    if (file_directory[i].loc != -1) {
+  //change the entry and remember which fat block needs writing
+  fs->fat_block_arr[idx].directory = value;
+  fs->fat_dirty[idx / FAT_SIZE] = true;
+}
 
-      return -1;  
-    }
-  }
+void drop_extents(struct fs_volume *fs, int loc) {
 
-  //check if state is invalid
-  if (validmount == false) {
+  //forget the extent list of a file
+  free(fs->file_extents[loc].ext);
+  memset(&fs->file_extents[loc], 0, sizeof(fs->file_extents[loc]));
+}
 
-    return -1;
-  }
+int add_extent_block(struct fs_volume *fs, int loc, uint16_t pblk) {
 
-  //mark as unmounted
-  validmount = false;
+  struct extent_index *index = &fs->file_extents[loc];
+
+  //grow the last extent if the block follows it on disk
+  if (index->count > 0) {
+    struct extent *last = &index->ext[index->count - 1];
+    if (last->pblk + last->len == pblk && last->len < UINT16_MAX) {
 
+      last->len++;
+      return 0;
+    }
+  }
 
-  //write back fat blocks
-  for (int i = 0; i < superblock->fat_blk_count; i++) {
-    if (block_write(i + 1, &fat_block_arr[i * FAT_SIZE]) == -1) {
+  //otherwise start a new extent after it
+  if (index->count == index->cap) {
+    size_t cap = index->cap ? 2 * index->cap : 8;
+    struct extent *ext = realloc(index->ext, cap * sizeof(*ext));
+    if (ext == NULL) {
       return -1;
     }
+    index->ext = ext;
+    index->cap = cap;
   }
 
-  //write back root directory
-  block_write(superblock->rdir_blk, root_dir);
+  uint32_t lblk = 0;
+  if (index->count > 0) {
+    lblk = index->ext[index->count - 1].lblk + index->ext[index->count - 1].len;
+  }
+  index->ext[index->count].lblk = lblk;
+  index->ext[index->count].pblk = pblk;
+  index->ext[index->count].len = 1;
+  index->count++;
+  return 0;
+}
 
-  //close disk
-  int safe = block_disk_close();
+int build_extents(struct fs_volume *fs, int loc) {
 
-  //check if closed
-  if (safe != 0) {
+  //walk the chain once and merge consecutive data blocks into extents
+  drop_extents(fs, loc);
+  uint16_t iter = fs->root_dir[loc].first_idx;
+  while (iter != FAT_EOC) {
+    if (iter == FAT_ERROR || add_extent_block(fs, loc, iter) == -1) {
 
-    return -1;
+      drop_extents(fs, loc);
+      return -1;
+    }
+    iter = get_fat(fs, iter);
   }
 
+  fs->file_extents[loc].valid = true;
   return 0;
 }
 
-int fs_info(void) {
+uint16_t lookup_extent(struct fs_volume *fs, int loc, size_t block,
+                       size_t *last_blk, uint16_t *last) {
 
-  //check if there is a disk mounted
-  if (validmount == false) {
-    return -1;
+  struct extent_index *index = &fs->file_extents[loc];
+  if (index->count == 0) {
+    return FAT_EOC;
   }
-  printf("FS Info:\n");
-  printf("total_blk_count=%d\n", superblock->total_blk_count);
-  printf("fat_blk_count=%d\n", superblock->fat_blk_count);
-  printf("rdir_blk=%d\n", superblock->rdir_blk);
-  printf("data_blk=%d\n", superblock->data_blk_idx);
-  printf("data_blk_count=%d\n", superblock->data_blk);
-
-  //iterate over fat blocks and count open ones
-  int free_fats = 0;
-  for (int i = 0; i < superblock->data_blk; i++) {
-    if (fat_block_arr[i].directory == 0) {
 
-      free_fats++;
+  //binary search for the last extent starting at or before the block
+  size_t low = 0;
+  size_t high = index->count;
+  while (high - low > 1) {
+    size_t mid = (low + high) / 2;
+    if (index->ext[mid].lblk <= block) {
+      low = mid;
+    } else {
+      high = mid;
     }
   }
-  printf("fat_free_ratio=%d/%d\n", free_fats, superblock->data_blk);
-
-  //iterate over root directory and count open ones
-  int empty_rdir = 0;
-  for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
-    if (root_dir[i].filename[0] == EMPTY) {
 
-      empty_rdir++;
-    }
+  struct extent *ext = &index->ext[low];
+  if (block < (size_t)ext->lblk + ext->len) {
+    return ext->pblk + (block - ext->lblk);
   }
-  printf("rdir_free_ratio=%d/%d\n", empty_rdir, FS_FILE_MAX_COUNT);
 
-  return 0;
+  //past the end of the file, report its last block
+  ext = &index->ext[index->count - 1];
+  *last_blk = ext->lblk + ext->len - 1;
+  *last = ext->pblk + ext->len - 1;
+  return FAT_EOC;
 }
 
-int findempty(struct root_dir_entry_t *arr) {
+void close_fd(struct fs_volume *fs) {
 
-  //iterate over root directory and find the empty filename
-  for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
+  //iterate through file directory and close them
+  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+    fs->file_directory[i].loc = -1;
+  }
+}
 
-    if (arr[i].filename[0] == EMPTY) {
+void release_volume(struct fs_volume *fs) {
 
-      return i;
-    }
+  //tear down whatever part of the volume was set up, then close the disk
+  if (fs->dir != NULL) {
+    dir_index_destroy(fs->dir);
+  }
+  if (fs->cache != NULL) {
+    cache_destroy(fs->cache);
+  }
+  if (fs->map != NULL) {
+    alloc_destroy(fs->map);
+  }
+  if (fs->journal != NULL) {
+    journal_destroy(fs->journal);
+  }
+  free(fs->fat_dirty);
+  free(fs->fat_loaded);
+  free(fs->fat_block_arr);
+  free(fs->superblock);
+  if (fs->disk != NULL) {
+    disk_close(fs->disk);
   }
 
-  return -1;
+  fs->dir = NULL;
+  fs->cache = NULL;
+  fs->map = NULL;
+  fs->journal = NULL;
+  fs->fat_dirty = NULL;
+  fs->fat_loaded = NULL;
+  fs->fat_block_arr = NULL;
+  fs->superblock = NULL;
+  fs->disk = NULL;
+
+  pthread_mutex_lock(&config_lock);
+  volume_count--;
+  pthread_mutex_unlock(&config_lock);
 }
 
-int findfile(struct root_dir_entry_t *arr, const char *filename) {
-
-  //iterate over files and find corresponding file location
-  for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
-
-    if (strcmp((char *)arr[i].filename, filename) == 0) {
+int mount_disk(struct fs_volume *fs, const char *diskname) {
 
-      return i;
-      break;
-    }
+  //a volume holds one disk at a time
+  if (fs->validmount) {
+    return -1;
   }
 
-  return -1;
-}
-
-int fs_create(const char *filename) {
+  //count the volume as mounted before reading the settings it uses
+  pthread_mutex_lock(&config_lock);
+  volume_count++;
+  pthread_mutex_unlock(&config_lock);
 
-  //check legitimacy of request
-  if (validmount == false) {
+  //check if disk exists
+  fs->disk = disk_open(diskname, io_backend);
+  if (fs->disk == NULL) {
 
+    release_volume(fs);
     return -1;
   }
-  if (superblock == NULL) {
 
+  //allocate space for superblock and read 
+  fs->superblock = calloc(BLOCK_SIZE, 1);
+  if (fs->superblock == NULL) {
+    release_volume(fs);
+    return -1;
+  }
+  if (disk_read(fs->disk, 0, fs->superblock) == -1) {
+    release_volume(fs);
     return -1;
   }
-  if (strlen(filename) > MAX_FILENAME && filename != NULL && filename[strlen(filename)] == '\0') {
 
+  //check signature
+  if (fs->superblock->signature != FS_SIGNATURE) {
+    release_volume(fs);
     return -1;
   }
 
-  //find the next open spot in the root directory
-  int insert = findempty(root_dir);
+  //check number of blocks, the journal must not write past the disk
+  if (fs->superblock->total_blk_count != disk_count(fs->disk) ||
+      fs->superblock->data_blk_idx > fs->superblock->total_blk_count) {
+    release_volume(fs);
+    return -1;
+  }
 
-  //see if file is already in the root directory
-  int exists = findfile(root_dir, filename);
-  if (insert != -1 && exists == -1) {
-
-    //copy file info to root directory and write to block
-    strcpy((char *)root_dir[insert].filename, filename);
-    root_dir[insert].size = 0;
-    root_dir[insert].first_idx = FAT_EOC;
-    block_write(superblock->rdir_blk, root_dir);
-    return 0;
+  //replay the journal, if the disk has one, before reading any metadata
+  size_t journal_blk_count = 0;
+  if (fs->superblock->journal_magic == JOURNAL_MAGIC &&
+      fs->superblock->journal_blk == fs->superblock->rdir_blk + 1 &&
+      fs->superblock->journal_blk + fs->superblock->journal_blk_count ==
+      fs->superblock->data_blk_idx) {
+    journal_blk_count = fs->superblock->journal_blk_count;
+  }
+  fs->journal = journal_init(fs->disk, fs->superblock->journal_blk,
+                             journal_blk_count);
+
+  //every dirty fat block and the root directory must fit in one transaction
+  if (fs->journal == NULL ||
+      (journal_enabled(fs->journal) && journal_capacity(fs->journal) <
+       (size_t)fs->superblock->fat_blk_count + 1) ||
+      journal_replay(fs->journal, fs->superblock->data_blk_idx) == -1) {
+    release_volume(fs);
+    return -1;
   }
 
-  return -1;
-}
+  //place root directory into appropriate array
+  if (disk_read(fs->disk, fs->superblock->rdir_blk, fs->root_dir) == -1) {
 
-int fs_delete(const char *filename) {
+    release_volume(fs);
+    return -1;
+  }
 
-  //check legitimacy of request
-  if (validmount == false) {
+  //make a fat block array, its blocks are read later
+  fs->fat_block_arr = malloc((fs->superblock->fat_blk_count) * BLOCK_SIZE);
+  fs->fat_loaded = calloc(fs->superblock->fat_blk_count,
+                          sizeof(*fs->fat_loaded));
+  if (fs->fat_block_arr == NULL || fs->fat_loaded == NULL) {
+    release_volume(fs);
+    return -1;
+  }
 
+  //nothing needs writing back yet
+  fs->fat_dirty = calloc(fs->superblock->fat_blk_count,
+                         sizeof(*fs->fat_dirty));
+  if (fs->fat_dirty == NULL) {
+    release_volume(fs);
+    return -1;
+  }
+  fs->rdir_dirty = false;
+  fs->meta_ops = 0;
+
+  //the summary left by the last unmount or sync stands in for the map until
+  //it is filled in
+  fs->summary_on_disk = fs->superblock->summary_magic == SUMMARY_MAGIC;
+  fs->summary_loaded = fs->summary_on_disk &&
+                       fs->superblock->summary_free_blk <=
+                       fs->superblock->data_blk;
+
+  //read the whole fat and fill the free-space map now, or on first use
+  fs->map = alloc_init(fs->superblock->data_blk, FS_FILE_MAX_COUNT,
+                       alloc_policy, alloc_window);
+  if (fs->map == NULL) {
+    release_volume(fs);
+    return -1;
+  }
+  fs->map_loaded = false;
+  if (fat_mode == FS_FAT_EAGER && load_map(fs) == -1) {
+    release_volume(fs);
     return -1;
   }
 
-  //see if file is in root directory
-  int exists = findfile(root_dir, filename);
-  if (exists != -1) {
+  //set up the block cache for data blocks
+  fs->cache = cache_init(fs->disk, cache_blocks);
+  if (fs->cache == NULL) {
+    release_volume(fs);
+    return -1;
+  }
 
-    //reset the info at the directory and iterate through fat blocks and clear them
-    memset((char *)root_dir[exists].filename, 0,
-           strlen((char *)root_dir[exists].filename));
-    root_dir[exists].size = 0;
-    uint16_t iter = root_dir[exists].first_idx + superblock->data_blk_idx;
-    uint16_t prev;
-    while (iter != FAT_EOC) {
-      prev = fat_block_arr[iter].directory;
-      fat_block_arr[iter].directory = 0;
-      iter = prev;
+  //index the root directory, lowest free entries on top of the stack
+  fs->dir = dir_index_init();
+  if (fs->dir == NULL) {
+    release_volume(fs);
+    return -1;
+  }
+  for (int i = FS_FILE_MAX_COUNT - 1; i >= 0; i--) {
+    if (fs->root_dir[i].filename[0] == EMPTY) {
+      dir_slot_release(fs->dir, i);
+    } else {
+      dir_index_insert(fs->dir, (char *)fs->root_dir[i].filename, i);
     }
+  }
 
-    //reset first index and write to block
-    root_dir[exists].first_idx = FAT_EOC;
-    block_write(superblock->rdir_blk, root_dir);
+  //a summary that disagrees with the root directory is not trusted either
+  if (fs->superblock->summary_free_rdir != dir_slot_free_count(fs->dir)) {
+    fs->summary_loaded = false;
+  }
 
-    return 0;
+  //close all open files, no extent list or tail is known yet
+  close_fd(fs);
+  memset(fs->file_extents, 0, sizeof(fs->file_extents));
+  for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
+    fs->file_tail[i] = FAT_EOC;
   }
 
-  return exists;
-}
+  //global state for later calls
+  fs->validmount = true;
 
-void printinfo(struct root_dir_entry_t *entry) {
+  return 0;
+}
 
-  //print info from entry
-  if (entry != NULL) {
+int fs_mount(const char *diskname) {
 
-    printf("file: %s, ", entry->filename);
-    printf("size: %d, ", entry->size);
-    printf("data_blk: %d\n", entry->first_idx);
-  }
+  pthread_rwlock_wrlock(&default_fs.mount_lock);
+  int ret = mount_disk(&default_fs, diskname);
+  pthread_rwlock_unlock(&default_fs.mount_lock);
+  return ret;
 }
 
-int fs_ls(void) {
-
-  //mount ls
-  if (validmount == false) {
+void free_volume(struct fs_volume *fs) {
 
-    return -1;
+  //destroy the locks of a volume from fs_mount_h() and free it
+  pthread_rwlock_destroy(&fs->mount_lock);
+  pthread_mutex_destroy(&fs->dir_lock);
+  pthread_mutex_destroy(&fs->meta_lock);
+  pthread_mutex_destroy(&fs->fat_lock);
+  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+    pthread_mutex_destroy(&fs->fd_locks[i]);
   }
-
-  //iterate over root directory and print
-  printf("FS Ls:\n");
   for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
-
-    struct root_dir_entry_t *entry = &root_dir[i];
-    if (entry->filename[0] != EMPTY) {
-      printinfo(entry);
-    }
+    pthread_rwlock_destroy(&fs->file_locks[i]);
   }
-
-  return 0;
+  free(fs);
 }
 
-int findemptyindir(struct file_info *arr) {
+struct fs_volume *fs_mount_h(const char *diskname) {
 
-  //iterate over array and find which file directory is empty
+  struct fs_volume *fs = calloc(1, sizeof(*fs));
+  if (fs == NULL) {
+    return NULL;
+  }
+  pthread_rwlock_init(&fs->mount_lock, NULL);
+  pthread_mutex_init(&fs->dir_lock, NULL);
+  pthread_mutex_init(&fs->meta_lock, NULL);
+  pthread_mutex_init(&fs->fat_lock, NULL);
   for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
-    if (arr[i].loc == -1) {
+    pthread_mutex_init(&fs->fd_locks[i], NULL);
+  }
+  for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
+    pthread_rwlock_init(&fs->file_locks[i], NULL);
+  }
 
-      return i;
-      break;
-    }
+  pthread_rwlock_wrlock(&fs->mount_lock);
+  int ret = mount_disk(fs, diskname);
+  pthread_rwlock_unlock(&fs->mount_lock);
+  if (ret == -1) {
+    free_volume(fs);
+    return NULL;
   }
 
-  return -1;
+  return fs;
 }
 
-int fs_open(const char *filename) {
-  
-  //check prerequisities
-  if (validmount == false && strlen(filename) < MAX_FILENAME  &&filename != NULL && filename[strlen(filename)] == '\0') {
+int flush_journaled(struct fs_volume *fs) {
 
-    return -1;
+  //gather the dirty metadata blocks
+  size_t targets[UINT8_MAX + 1];
+  const void *images[UINT8_MAX + 1];
+  size_t count = 0;
+  for (int i = 0; i < fs->superblock->fat_blk_count; i++) {
+    if (fs->fat_dirty[i]) {
+      targets[count] = i + 1;
+      images[count++] = &fs->fat_block_arr[i * FAT_SIZE];
+    }
+  }
+  if (fs->rdir_dirty) {
+    targets[count] = fs->superblock->rdir_blk;
+    images[count++] = fs->root_dir;
   }
 
-  //find next open directory
-  int open_directory = findemptyindir(file_directory);
-
-  //find if it exists
-  int exists = findfile(root_dir, filename);
-
-  //if it exists and there is an open directory, set the file descriptor information accordingly
-  if (exists == -1 || open_directory == -1) {
-
+  //commit them as one transaction, mount made sure the journal holds them
+  if (journal_commit(fs->journal, targets, images, count) == -1) {
     return -1;
   }
 
-  file_directory[open_directory].loc = exists;
-  file_directory[open_directory].offset = 0;
+  memset(fs->fat_dirty, false,
+         fs->superblock->fat_blk_count * sizeof(*fs->fat_dirty));
+  fs->rdir_dirty = false;
+  fs->meta_ops = 0;
   return 0;
 }
 
-int fs_close(int fd) {
+int free_blocks(struct fs_volume *fs) {
 
-  //if the file directory exists, reset the information
-  if (validmount == false || fd > FS_OPEN_MAX_COUNT || fd < 0 ){
-    return -1;
+  //until the map is filled in nothing was allocated or freed since mount
+  if (fs->map_loaded) {
+    return alloc_free_count(fs->map);
   }
-
-  int location = file_directory[fd].loc;
-  if (location != -1) {
-
-    file_directory[fd].loc = -1;
-    return 0;
+  if (fs->summary_loaded) {
+    return fs->superblock->summary_free_blk;
   }
 
   return -1;
 }
 
-int fs_stat(int fd) {
+int drop_summary(struct fs_volume *fs) {
 
-  //if the file directory exists, retrieve the information
-  if (validmount == false || fd > FS_OPEN_MAX_COUNT){
+  //nothing to do unless metadata is about to change on disk
+  bool dirty = fs->rdir_dirty;
+  for (int i = 0; i < fs->superblock->fat_blk_count && !dirty; i++) {
+    dirty = fs->fat_dirty[i];
+  }
+  if (!fs->summary_on_disk || !dirty) {
+    return 0;
+  }
 
+  //clear the summary on disk before the counts it holds go stale
+  fs->superblock->summary_magic = 0;
+  if (disk_write(fs->disk, 0, fs->superblock) == -1 ||
+      disk_sync(fs->disk) == -1) {
     return -1;
   }
+  fs->summary_on_disk = false;
+  return 0;
+}
 
-  //print the size of the file based on its respective location 
-  int location = file_directory[fd].loc;
-  if (location != -1 && validmount) {
+int write_summary(struct fs_volume *fs) {
+
+  //keep the summary on disk if still valid, or if the count is unknown
+  int free_blk = free_blocks(fs);
+  if ((fs->summary_on_disk && fs->summary_loaded) || free_blk == -1) {
+    return 0;
+  }
 
-    return (root_dir[location].size);
+  //make the metadata durable before the summary describing it
+  fs->superblock->summary_magic = SUMMARY_MAGIC;
+  fs->superblock->summary_free_blk = free_blk;
+  fs->superblock->summary_free_rdir = dir_slot_free_count(fs->dir);
+  if (disk_sync(fs->disk) == -1 ||
+      disk_write(fs->disk, 0, fs->superblock) == -1) {
+    return -1;
   }
-  return -1;
+  fs->summary_on_disk = true;
+  fs->summary_loaded = true;
+  return 0;
 }
 
-int fs_lseek(int fd, size_t offset) {
+int flush_metadata(struct fs_volume *fs) {
 
-  //if the file directory exists, change the offset
-  if (validmount == false || fd > FS_OPEN_MAX_COUNT) {
+  if (drop_summary(fs) == -1) {
     return -1;
   }
 
-  //check if the fd is open, then ensure the offset is less than the size and change the offset 
-  if (file_directory[fd].loc != -1) {
+  //journaled disks log metadata before writing it in place
+  if (journal_enabled(fs->journal)) {
+    return flush_journaled(fs);
+  }
 
-    uint32_t size = root_dir[file_directory[fd].loc].size;
-    if (offset <= size) {
+  //gather runs of consecutive dirty fat blocks and the root directory
+  struct iovec iov[UINT8_MAX + 1];
+  struct block_io ios[UINT8_MAX + 1];
+  int count = 0;
+  int i = 0;
+  while (i < fs->superblock->fat_blk_count) {
+    if (!fs->fat_dirty[i]) {
+      i++;
+      continue;
+    }
 
-      file_directory[fd].offset = offset;
-      return 0;
+    int run = 1;
+    while (i + run < fs->superblock->fat_blk_count && fs->fat_dirty[i + run]) {
+      run++;
     }
+    iov[count].iov_base = &fs->fat_block_arr[i * FAT_SIZE];
+    iov[count].iov_len = run * BLOCK_SIZE;
+    ios[count].block = i + 1;
+    count++;
+    i += run;
+  }
+  if (fs->rdir_dirty) {
+    iov[count].iov_base = fs->root_dir;
+    iov[count].iov_len = BLOCK_SIZE;
+    ios[count].block = fs->superblock->rdir_blk;
+    count++;
   }
 
-  return -1;
+  //write them back as one batch
+  for (int j = 0; j < count; j++) {
+    ios[j].iov = &iov[j];
+    ios[j].iovcnt = 1;
+  }
+  if (disk_writev_batch(fs->disk, ios, count) == -1) {
+    return -1;
+  }
+
+  memset(fs->fat_dirty, false,
+         fs->superblock->fat_blk_count * sizeof(*fs->fat_dirty));
+  fs->rdir_dirty = false;
+  fs->meta_ops = 0;
+  return 0;
 }
 
-//initialize bounce buffer
-uint8_t bounce[BLOCK_SIZE];
+int write_back(struct fs_volume *fs) {
 
-size_t find_data_blk(int fd) {
+  //write back dirty data blocks before the metadata pointing at them
+  if (cache_flush(fs->cache) == -1) {
+    return -1;
+  }
 
-  //get offset and block offset is on in the file
-  size_t offset = file_directory[fd].offset;
-  int block = offset / BLOCK_SIZE;
+  return flush_metadata(fs);
+}
 
-  //get the starting index from the root directory
-  uint16_t start = (uint16_t)root_dir[file_directory[fd].loc].first_idx;
+int metadata_changed(struct fs_volume *fs) {
 
-  //if it doesn't exist in the root directory
-  if (start == FAT_EOC) {
-    return FAT_EOC;
+  //count the operation and write back once the interval is reached
+  if (flush_interval != 0 && ++fs->meta_ops >= flush_interval) {
+    return write_back(fs);
   }
 
-  //iterate through and return the block it on in the file directory
-  while (block > 0) {
-    if (start == FAT_EOC) {
-      return block;
-    }
+  return 0;
+}
 
-    int block = start / FAT_SIZE;
-    if (block < superblock->fat_blk_count) {
+int umount_disk(struct fs_volume *fs) {
 
-      start = fat_block_arr[block].directory;
-      block--;
-    } else {
+  //check if there are any open files
+  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+    if (fs->file_directory[i].loc != -1) {
 
-      return start;
+      return -1;  
     }
   }
 
-  return start;
-}
-int extend(int fd) {
+  //check if state is invalid
+  if (fs->validmount == false) {
 
-  //get latest block in chain
-  size_t insert = root_dir[file_directory[fd].loc].first_idx;
-  if (insert != FAT_EOC) {
-    while (fat_block_arr[insert].directory != FAT_EOC) {
-      insert = fat_block_arr[insert].directory;
-    }
+    return -1;
   }
 
-  //iterate and find new place in fat blocks
-  for (int i = 0; i < superblock->data_blk; i++) {
-    if (fat_block_arr[i].directory == 0) {
-
-      //if new file, add to root directory
-      if (root_dir[file_directory[fd].loc].first_idx == FAT_EOC) {
+  //write back cached data blocks and metadata, leaving an empty journal,
+  //then the free space summary for the next mount; on failure the volume
+  //stays mounted so that the unmount can be retried
+  if (write_back(fs) == -1 || journal_clear(fs->journal) == -1 ||
+      write_summary(fs) == -1) {
+    return -1;
+  }
 
-        root_dir[file_directory[fd].loc].first_idx = i;
-      } else {
+  //mark as unmounted
+  fs->validmount = false;
+  for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
+    drop_extents(fs, i);
+  }
 
-        //set current last pointer to new space
-        fat_block_arr[insert].directory = i;
-      }
+  //close disk
+  release_volume(fs);
 
-      //set new space to FAT_EOC to show end
-      fat_block_arr[i].directory = FAT_EOC;
-      return i;
+  return 0;
+}
 
-    }
-  }
+int fs_umount(void) {
 
-  return -1;
+  //queued requests would outlive the volume
+  pthread_rwlock_wrlock(&default_fs.mount_lock);
+  int ret = aio_busy(NULL) ? -1 : umount_disk(&default_fs);
+  pthread_rwlock_unlock(&default_fs.mount_lock);
+  return ret;
 }
-int fs_write(int fd, void *buf, size_t count) {
 
-  //check preqrequisites
-  if (buf == NULL || fd > FS_OPEN_MAX_COUNT || file_directory[fd].loc == -1 ||
-      validmount == false) {
+int fs_umount_h(struct fs_volume *fs) {
+
+  if (fs == NULL) {
+    return -1;
+  }
+
+  pthread_rwlock_wrlock(&fs->mount_lock);
+  int ret = aio_busy(fs) ? -1 : umount_disk(fs);
+  pthread_rwlock_unlock(&fs->mount_lock);
+  if (ret == -1) {
+    return -1;
+  }
+
+  free_volume(fs);
+  return 0;
+}
+
+int lock_fd(struct fs_volume *fs, int fd) {
+
+  //hold the mount for reading, then the descriptor if it is open
+  pthread_rwlock_rdlock(&fs->mount_lock);
+  if (fs->validmount == false || fd < 0 || fd >= FS_OPEN_MAX_COUNT) {
+    pthread_rwlock_unlock(&fs->mount_lock);
+    return -1;
+  }
+  pthread_mutex_lock(&fs->fd_locks[fd]);
+  if (fs->file_directory[fd].loc == -1) {
+    pthread_mutex_unlock(&fs->fd_locks[fd]);
+    pthread_rwlock_unlock(&fs->mount_lock);
+    return -1;
+  }
+
+  return fs->file_directory[fd].loc;
+}
+
+void unlock_fd(struct fs_volume *fs, int fd) {
+
+  pthread_mutex_unlock(&fs->fd_locks[fd]);
+  pthread_rwlock_unlock(&fs->mount_lock);
+}
+
+int fs_cache_config(size_t nblocks) {
+
+  //the capacity cannot change under a mounted file system
+  pthread_mutex_lock(&config_lock);
+  int ret = -1;
+  if (volume_count == 0) {
+    cache_blocks = nblocks;
+    ret = 0;
+  }
+  pthread_mutex_unlock(&config_lock);
+  return ret;
+}
+
+int fs_alloc_config(enum fs_alloc_policy policy, size_t window) {
+
+  if (policy != FS_ALLOC_FIRST_FIT && policy != FS_ALLOC_NEXT_FIT &&
+      policy != FS_ALLOC_BEST_FIT) {
+    return -1;
+  }
+
+  //nor can the policy
+  pthread_mutex_lock(&config_lock);
+  int ret = -1;
+  if (volume_count == 0) {
+    alloc_policy = policy;
+    alloc_window = window;
+    ret = 0;
+  }
+  pthread_mutex_unlock(&config_lock);
+  return ret;
+}
+
+int fs_flush_config(unsigned int interval) {
+
+  //nor can the interval
+  pthread_mutex_lock(&config_lock);
+  int ret = -1;
+  if (volume_count == 0) {
+    flush_interval = interval;
+    ret = 0;
+  }
+  pthread_mutex_unlock(&config_lock);
+  return ret;
+}
+
+int fs_readahead_config(size_t nblocks) {
+
+  //nor can the read-ahead window
+  pthread_mutex_lock(&config_lock);
+  int ret = -1;
+  if (volume_count == 0) {
+    readahead_max = nblocks;
+    ret = 0;
+  }
+  pthread_mutex_unlock(&config_lock);
+  return ret;
+}
+
+int fs_io_config(enum fs_io_backend backend) {
+
+  enum block_backend block;
+  switch (backend) {
+  case FS_IO_SYSCALL:
+    block = BLOCK_BACKEND_SYSCALL;
+    break;
+  case FS_IO_URING:
+    block = BLOCK_BACKEND_IO_URING;
+    break;
+  case FS_IO_MMAP:
+    block = BLOCK_BACKEND_MMAP;
+    break;
+  case FS_IO_DIRECT:
+    block = BLOCK_BACKEND_DIRECT;
+    break;
+  default:
+    return -1;
+  }
+
+  pthread_mutex_lock(&config_lock);
+  int ret = -1;
+  if (volume_count == 0) {
+    io_backend = block;
+    ret = 0;
+  }
+  pthread_mutex_unlock(&config_lock);
+  return ret;
+}
+
+int fs_fat_config(enum fs_fat_mode mode) {
+
+  if (mode != FS_FAT_EAGER && mode != FS_FAT_LAZY) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&config_lock);
+  int ret = -1;
+  if (volume_count == 0) {
+    fat_mode = mode;
+    ret = 0;
+  }
+  pthread_mutex_unlock(&config_lock);
+  return ret;
+}
+
+int fs_sync_h(struct fs_volume *fs) {
+
+  //check if there is a disk mounted
+  pthread_rwlock_rdlock(&fs->mount_lock);
+  if (fs->validmount == false) {
+    pthread_rwlock_unlock(&fs->mount_lock);
+    return -1;
+  }
+
+  //write back, then leave the free space summary for monitoring and mount
+  pthread_mutex_lock(&fs->dir_lock);
+  pthread_mutex_lock(&fs->meta_lock);
+  int ret = write_back(fs);
+  if (ret == 0) {
+    ret = write_summary(fs);
+  }
+  pthread_mutex_unlock(&fs->meta_lock);
+  pthread_mutex_unlock(&fs->dir_lock);
+  pthread_rwlock_unlock(&fs->mount_lock);
+  return ret;
+}
+
+int fs_sync(void) {
+
+  return fs_sync_h(&default_fs);
+}
+
+int fs_cache_stats_h(struct fs_volume *fs, struct fs_cache_stats *stats) {
+
+  //check if there is a disk mounted
+  pthread_rwlock_rdlock(&fs->mount_lock);
+  if (fs->validmount == false || stats == NULL) {
+    pthread_rwlock_unlock(&fs->mount_lock);
+    return -1;
+  }
+
+  cache_stats(fs->cache, stats);
+  pthread_rwlock_unlock(&fs->mount_lock);
+  return 0;
+}
+
+int fs_cache_stats(struct fs_cache_stats *stats) {
+
+  return fs_cache_stats_h(&default_fs, stats);
+}
+
+int get_info(struct fs_volume *fs, struct fs_info_stats *stats) {
+
+  //check if there is a disk mounted
+  if (fs->validmount == false) {
+    return -1;
+  }
+
+  //the free-space map keeps count of open fat blocks, the summary stands in
+  //for it until it is filled in, and only then does the fat get scanned
+  int free_fats = free_blocks(fs);
+  if (free_fats == -1) {
+    if (load_map(fs) == -1) {
+      return -1;
+    }
+    free_fats = alloc_free_count(fs->map);
+  }
+
+  stats->total_blk_count = fs->superblock->total_blk_count;
+  stats->fat_blk_count = fs->superblock->fat_blk_count;
+  stats->rdir_blk = fs->superblock->rdir_blk;
+  stats->data_blk = fs->superblock->data_blk_idx;
+  stats->data_blk_count = fs->superblock->data_blk;
+  stats->fat_free = free_fats;
+  stats->rdir_free = dir_slot_free_count(fs->dir);
+  return 0;
+}
+
+int show_info(struct fs_volume *fs) {
+
+  struct fs_info_stats stats;
+  if (get_info(fs, &stats) == -1) {
+    return -1;
+  }
+
+  printf("FS Info:\n");
+  printf("total_blk_count=%zu\n", stats.total_blk_count);
+  printf("fat_blk_count=%zu\n", stats.fat_blk_count);
+  printf("rdir_blk=%zu\n", stats.rdir_blk);
+  printf("data_blk=%zu\n", stats.data_blk);
+  printf("data_blk_count=%zu\n", stats.data_blk_count);
+  printf("fat_free_ratio=%zu/%zu\n", stats.fat_free, stats.data_blk_count);
+  printf("rdir_free_ratio=%zu/%d\n", stats.rdir_free, FS_FILE_MAX_COUNT);
+
+  return 0;
+}
+
+int fs_info_h(struct fs_volume *fs) {
+
+  pthread_rwlock_rdlock(&fs->mount_lock);
+  pthread_mutex_lock(&fs->dir_lock);
+  pthread_mutex_lock(&fs->meta_lock);
+  int ret = show_info(fs);
+  pthread_mutex_unlock(&fs->meta_lock);
+  pthread_mutex_unlock(&fs->dir_lock);
+  pthread_rwlock_unlock(&fs->mount_lock);
+  return ret;
+}
+
+int fs_info(void) {
+
+  return fs_info_h(&default_fs);
+}
+
+int fs_info_stats_h(struct fs_volume *fs, struct fs_info_stats *stats) {
+
+  if (stats == NULL) {
+    return -1;
+  }
+
+  pthread_rwlock_rdlock(&fs->mount_lock);
+  pthread_mutex_lock(&fs->dir_lock);
+  pthread_mutex_lock(&fs->meta_lock);
+  int ret = get_info(fs, stats);
+  pthread_mutex_unlock(&fs->meta_lock);
+  pthread_mutex_unlock(&fs->dir_lock);
+  pthread_rwlock_unlock(&fs->mount_lock);
+  return ret;
+}
+
+int fs_info_stats(struct fs_info_stats *stats) {
+
+  return fs_info_stats_h(&default_fs, stats);
+}
+
+int create_file(struct fs_volume *fs, const char *filename) {
+
+  //check legitimacy of request
+  if (fs->validmount == false) {
+
+    return -1;
+  }
+  if (fs->superblock == NULL) {
+
+    return -1;
+  }
+  if (filename == NULL || filename[0] == EMPTY ||
+      strlen(filename) >= MAX_FILENAME) {
+
+    return -1;
+  }
+
+  //see if file is already in the root directory
+  if (dir_index_find(fs->dir, filename) != -1) {
+
+    return -1;
+  }
+
+  //take the next open spot in the root directory
+  int insert = dir_slot_take(fs->dir);
+  if (insert == -1) {
+
+    return -1;
+  }
+
+  //copy file info to root directory, index it and mark it for write back
+  strcpy((char *)fs->root_dir[insert].filename, filename);
+  fs->root_dir[insert].size = 0;
+  fs->root_dir[insert].first_idx = FAT_EOC;
+  dir_index_insert(fs->dir, filename, insert);
+  fs->rdir_dirty = true;
+  return metadata_changed(fs);
+}
+
+int fs_create_h(struct fs_volume *fs, const char *filename) {
+
+  pthread_rwlock_rdlock(&fs->mount_lock);
+  pthread_mutex_lock(&fs->dir_lock);
+  pthread_mutex_lock(&fs->meta_lock);
+  int ret = create_file(fs, filename);
+  pthread_mutex_unlock(&fs->meta_lock);
+  pthread_mutex_unlock(&fs->dir_lock);
+  pthread_rwlock_unlock(&fs->mount_lock);
+  return ret;
+}
+
+int fs_create(const char *filename) {
+
+  return fs_create_h(&default_fs, filename);
+}
+
+int delete_file(struct fs_volume *fs, const char *filename) {
+
+  //check legitimacy of request
+  if (fs->validmount == false) {
+
+    return -1;
+  }
+
+  //see if file is in root directory
+  if (filename == NULL) {
+
+    return -1;
+  }
+  int exists = dir_index_find(fs->dir, filename);
+
+  //an open file cannot be deleted, its descriptors point into its chain
+  for (int i = 0; exists != -1 && i < FS_OPEN_MAX_COUNT; i++) {
+    if (fs->file_directory[i].loc == exists) {
+
+      return -1;
+    }
+  }
+
+  //freeing blocks needs the free-space map
+  if (exists != -1 && load_map(fs) == -1) {
+    return -1;
+  }
+
+  if (exists != -1) {
+
+    //unindex the file, reset the info at the directory and iterate through fat blocks and clear them
+    dir_index_remove(fs->dir, filename);
+    dir_slot_release(fs->dir, exists);
+    memset((char *)fs->root_dir[exists].filename, 0,
+           strlen((char *)fs->root_dir[exists].filename));
+    fs->root_dir[exists].size = 0;
+    uint16_t iter = fs->root_dir[exists].first_idx;
+    uint16_t prev;
+    while (iter != FAT_EOC) {
+      prev = get_fat(fs, iter);
+      set_fat(fs, iter, 0);
+      alloc_release(fs->map, iter);
+      iter = prev;
+    }
+
+    //reset first index, forget the extents and tail and mark for write back
+    fs->root_dir[exists].first_idx = FAT_EOC;
+    fs->file_tail[exists] = FAT_EOC;
+    drop_extents(fs, exists);
+    fs->rdir_dirty = true;
+    return metadata_changed(fs);
+  }
+
+  return exists;
+}
+
+int fs_delete_h(struct fs_volume *fs, const char *filename) {
+
+  //wait for transfers still running on the file after its last close
+  pthread_rwlock_rdlock(&fs->mount_lock);
+  pthread_mutex_lock(&fs->dir_lock);
+  int loc = -1;
+  if (fs->validmount && filename != NULL) {
+    loc = dir_index_find(fs->dir, filename);
+  }
+  if (loc != -1) {
+    pthread_rwlock_wrlock(&fs->file_locks[loc]);
+  }
+  pthread_mutex_lock(&fs->meta_lock);
+  int ret = delete_file(fs, filename);
+  pthread_mutex_unlock(&fs->meta_lock);
+  if (loc != -1) {
+    pthread_rwlock_unlock(&fs->file_locks[loc]);
+  }
+  pthread_mutex_unlock(&fs->dir_lock);
+  pthread_rwlock_unlock(&fs->mount_lock);
+  return ret;
+}
+
+int fs_delete(const char *filename) {
+
+  return fs_delete_h(&default_fs, filename);
+}
+
+void printinfo(struct root_dir_entry_t *entry) {
+
+  //print info from entry
+  if (entry != NULL) {
+
+    printf("file: %s, ", entry->filename);
+    printf("size: %d, ", entry->size);
+    printf("data_blk: %d\n", entry->first_idx);
+  }
+}
+
+int list_files(struct fs_volume *fs) {
+
+  //mount ls
+  if (fs->validmount == false) {
+
+    return -1;
+  }
+
+  //iterate over root directory and print
+  printf("FS Ls:\n");
+  for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
+
+    struct root_dir_entry_t *entry = &fs->root_dir[i];
+    if (entry->filename[0] != EMPTY) {
+      printinfo(entry);
+    }
+  }
+
+  return 0;
+}
+
+int fs_ls_h(struct fs_volume *fs) {
+
+  pthread_rwlock_rdlock(&fs->mount_lock);
+  pthread_mutex_lock(&fs->dir_lock);
+  pthread_mutex_lock(&fs->meta_lock);
+  int ret = list_files(fs);
+  pthread_mutex_unlock(&fs->meta_lock);
+  pthread_mutex_unlock(&fs->dir_lock);
+  pthread_rwlock_unlock(&fs->mount_lock);
+  return ret;
+}
+
+int fs_ls(void) {
+
+  return fs_ls_h(&default_fs);
+}
+
+int findemptyindir(struct file_info *arr) {
+
+  //iterate over array and find which file directory is empty
+  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+    if (arr[i].loc == -1) {
+
+      return i;
+      break;
+    }
+  }
+
+  return -1;
+}
+
+int open_file(struct fs_volume *fs, const char *filename) {
+  
+  //check prerequisities
+  if (fs->validmount == false || filename == NULL) {
+
+    return -1;
+  }
+
+  //find next open directory
+  int open_directory = findemptyindir(fs->file_directory);
+
+  //find if it exists
+  int exists = dir_index_find(fs->dir, filename);
+
+  //if it exists and there is an open directory, set the file descriptor information accordingly
+  if (exists == -1 || open_directory == -1) {
+
+    return -1;
+  }
+
+  pthread_mutex_lock(&fs->fd_locks[open_directory]);
+  fs->file_directory[open_directory].loc = exists;
+  fs->file_directory[open_directory].offset = 0;
+  fs->file_directory[open_directory].cur_pblk = FAT_EOC;
+  fs->file_directory[open_directory].ra_next = 0;
+  fs->file_directory[open_directory].ra_window = 0;
+  fs->file_directory[open_directory].ra_end = 0;
+  pthread_mutex_unlock(&fs->fd_locks[open_directory]);
+  return open_directory;
+}
+
+int fs_open_h(struct fs_volume *fs, const char *filename) {
+
+  pthread_rwlock_rdlock(&fs->mount_lock);
+  pthread_mutex_lock(&fs->dir_lock);
+  int ret = open_file(fs, filename);
+  pthread_mutex_unlock(&fs->dir_lock);
+  pthread_rwlock_unlock(&fs->mount_lock);
+  return ret;
+}
+
+int fs_open(const char *filename) {
+
+  return fs_open_h(&default_fs, filename);
+}
+
+int close_file(struct fs_volume *fs, int fd) {
+
+  //if the file directory exists, reset the information
+  if (fs->validmount == false || fd >= FS_OPEN_MAX_COUNT || fd < 0 ){
+    return -1;
+  }
+
+  int location = fs->file_directory[fd].loc;
+  if (location != -1) {
+
+    fs->file_directory[fd].loc = -1;
+
+    //the last close gives back the blocks reserved for the file
+    for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+      if (fs->file_directory[i].loc == location) {
+        return 0;
+      }
+    }
+    pthread_mutex_lock(&fs->meta_lock);
+    alloc_release_window(fs->map, location);
+    pthread_mutex_unlock(&fs->meta_lock);
+    return 0;
+  }
+
+  return -1;
+}
+
+int fs_close_h(struct fs_volume *fs, int fd) {
+
+  //wait for calls still using the descriptor
+  pthread_rwlock_rdlock(&fs->mount_lock);
+  pthread_mutex_lock(&fs->dir_lock);
+  if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) {
+    pthread_mutex_unlock(&fs->dir_lock);
+    pthread_rwlock_unlock(&fs->mount_lock);
+    return -1;
+  }
+  pthread_mutex_lock(&fs->fd_locks[fd]);
+  int ret = close_file(fs, fd);
+  pthread_mutex_unlock(&fs->fd_locks[fd]);
+  pthread_mutex_unlock(&fs->dir_lock);
+  pthread_rwlock_unlock(&fs->mount_lock);
+  return ret;
+}
+
+int fs_close(int fd) {
+
+  return fs_close_h(&default_fs, fd);
+}
+
+int fs_stat_h(struct fs_volume *fs, int fd) {
+
+  //if the file directory exists, retrieve the information
+  int location = lock_fd(fs, fd);
+  if (location == -1) {
+
+    return -1;
+  }
+
+  //print the size of the file based on its respective location 
+  pthread_rwlock_rdlock(&fs->file_locks[location]);
+  int size = fs->root_dir[location].size;
+  pthread_rwlock_unlock(&fs->file_locks[location]);
+  unlock_fd(fs, fd);
+  return size;
+}
+
+int fs_stat(int fd) {
+
+  return fs_stat_h(&default_fs, fd);
+}
+
+int seek_file(struct fs_volume *fs, int fd, size_t offset) {
+
+  //if the file directory exists, change the offset
+  if (fs->validmount == false || fd >= FS_OPEN_MAX_COUNT || fd < 0) {
+    return -1;
+  }
+
+  //check if the fd is open, then ensure the offset is less than the size and change the offset 
+  if (fs->file_directory[fd].loc != -1) {
+
+    uint32_t size = fs->root_dir[fs->file_directory[fd].loc].size;
+    if (offset <= size) {
+
+      //seeking means random access, index the file for direct lookups
+      if (!fs->file_extents[fs->file_directory[fd].loc].valid) {
+        build_extents(fs, fs->file_directory[fd].loc);
+      }
+      fs->file_directory[fd].offset = offset;
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+int fs_lseek_h(struct fs_volume *fs, int fd, size_t offset) {
+
+  int loc = lock_fd(fs, fd);
+  if (loc == -1) {
+    return -1;
+  }
+
+  //indexing the file changes it, seeking in an indexed file does not
+  pthread_rwlock_rdlock(&fs->file_locks[loc]);
+  if (!fs->file_extents[loc].valid) {
+    pthread_rwlock_unlock(&fs->file_locks[loc]);
+    pthread_rwlock_wrlock(&fs->file_locks[loc]);
+  }
+  int ret = seek_file(fs, fd, offset);
+  pthread_rwlock_unlock(&fs->file_locks[loc]);
+  unlock_fd(fs, fd);
+  return ret;
+}
+
+int fs_lseek(int fd, size_t offset) {
+
+  return fs_lseek_h(&default_fs, fd, offset);
+}
+
+uint16_t find_data_blk(struct fs_volume *fs, struct file_info *file,
+                       size_t block) {
+
+  //look indexed files up directly
+  if (fs->file_extents[file->loc].valid) {
+
+    size_t last_blk = 0;
+    uint16_t last = FAT_EOC;
+    uint16_t found = lookup_extent(fs, file->loc, block, &last_blk, &last);
+    if (found != FAT_EOC) {
+
+      file->cur_lblk = block;
+      file->cur_pblk = found;
+    } else if (last != FAT_EOC) {
+
+      file->cur_lblk = last_blk;
+      file->cur_pblk = last;
+    }
+    return found;
+  }
+
+  //resume from the cursor unless the block is behind it
+  size_t iter_blk = 0;
+  uint16_t start = fs->root_dir[file->loc].first_idx;
+  if (file->cur_pblk != FAT_EOC && file->cur_lblk <= block) {
+
+    iter_blk = file->cur_lblk;
+    start = file->cur_pblk;
+  }
+
+  //iterate through the chain until the block, remembering the last one seen
+  size_t last_blk = iter_blk;
+  uint16_t last = start;
+  while (iter_blk < block && start != FAT_EOC) {
+
+    last_blk = iter_blk;
+    last = start;
+    start = get_fat(fs, start);
+    iter_blk++;
+    if (start == FAT_ERROR) {
+      return FAT_ERROR;
+    }
+  }
+
+  //leave the cursor on the block, or on the last block if past the end
+  if (start != FAT_EOC) {
+
+    file->cur_lblk = block;
+    file->cur_pblk = start;
+  } else if (last != FAT_EOC) {
+
+    file->cur_lblk = last_blk;
+    file->cur_pblk = last;
+  }
+
+  return start;
+}
+
+int run_length(struct fs_volume *fs, uint16_t start, int max) {
+
+  //count how many blocks of the chain are physically consecutive from start
+  int run = 1;
+  while (run < max) {
+
+    uint16_t next = get_fat(fs, start);
+    if (next == FAT_ERROR) {
+      return -1;
+    }
+    if (next != start + 1) {
+      break;
+    }
+    start++;
+    run++;
+  }
+
+  return run;
+}
+
+uint16_t find_tail(struct fs_volume *fs, int loc) {
+
+  //get latest block in chain, walking it only the first time
+  if (fs->file_tail[loc] == FAT_EOC && fs->root_dir[loc].first_idx != FAT_EOC) {
+    uint16_t iter = fs->root_dir[loc].first_idx;
+    while (get_fat(fs, iter) != FAT_EOC) {
+      iter = get_fat(fs, iter);
+    }
+    fs->file_tail[loc] = iter;
+  }
+
+  return fs->file_tail[loc];
+}
+
+void append_block(struct fs_volume *fs, int loc, uint16_t block) {
+
+  //if new file, add to root directory
+  if (fs->root_dir[loc].first_idx == FAT_EOC) {
+
+    fs->root_dir[loc].first_idx = block;
+    fs->rdir_dirty = true;
+  } else {
+
+    //set current last pointer to new space
+    set_fat(fs, find_tail(fs, loc), block);
+  }
+
+  //set new space to FAT_EOC to show end and remember it as the tail
+  set_fat(fs, block, FAT_EOC);
+  fs->file_tail[loc] = block;
+
+  //keep the extent list in step, or drop it if it cannot grow
+  if (fs->file_extents[loc].valid && add_extent_block(fs, loc, block) == -1) {
+    drop_extents(fs, loc);
+  }
+}
+
+int extend(struct fs_volume *fs, struct file_info *file) {
+
+  //let the allocation policy pick a block close to the end of the file
+  if (load_map(fs) == -1) {
+    return -1;
+  }
+  int loc = file->loc;
+  uint16_t tail = find_tail(fs, loc);
+  size_t i = alloc_block(fs->map, loc, tail == FAT_EOC ? ALLOC_NONE : tail);
+  if (i == ALLOC_NONE) {
     return -1;
   }
 
-  //find the latest block and offset on the block
-  size_t start_block_idx = find_data_blk(fd);
-  int start_block_offset = file_directory[fd].offset % BLOCK_SIZE;
+  append_block(fs, loc, i);
+  return i;
+}
 
-  //initalize iterator variables
-  size_t bytes_copied = 0;
-  int bytes_left = (int)count;
-  while (bytes_left > 0) {
+int fallocate_file(struct fs_volume *fs, int fd, size_t nblocks) {
+
+  //check preqrequisites
+  if (fs->validmount == false || fd < 0 || fd >= FS_OPEN_MAX_COUNT ||
+      fs->file_directory[fd].loc == -1) {
+    return -1;
+  }
+  uint16_t last = FAT_EOC;
+  if (nblocks > 0) {
+    last = find_data_blk(fs, &fs->file_directory[fd], nblocks - 1);
+  }
+  if (last == FAT_ERROR) {
+    return -1;
+  }
+  if (nblocks == 0 || last != FAT_EOC) {
+    return 0;
+  }
 
-    // reset bounce
-    memset(bounce, 0, BLOCK_SIZE);
+  //a failed lookup leaves the cursor on the last block of the file
+  size_t blocks = 0;
+  if (fs->file_directory[fd].cur_pblk != FAT_EOC) {
+    blocks = fs->file_directory[fd].cur_lblk + 1;
+  }
+  if (load_map(fs) == -1 || nblocks - blocks > alloc_free_count(fs->map)) {
+    return -1;
+  }
 
-    // get the number of bytes to copy in block
-    int added_bytes = BLOCK_SIZE - start_block_offset;
+  //append the largest runs the policy can find until the file is big enough
+  int loc = fs->file_directory[fd].loc;
+  while (blocks < nblocks) {
 
-    if (bytes_left < added_bytes) {
-      // last page
-      added_bytes = bytes_left;
+    uint16_t tail = find_tail(fs, loc);
+    size_t len = 0;
+    size_t start = alloc_run(fs->map, loc, tail == FAT_EOC ? ALLOC_NONE : tail,
+                             nblocks - blocks, &len);
+    if (start == ALLOC_NONE) {
+      return -1;
     }
+    for (size_t i = 0; i < len; i++) {
+      append_block(fs, loc, start + i);
+    }
+    blocks += len;
+  }
+
+  return metadata_changed(fs);
+}
 
-    // red block to bounce or make new one
-    if (start_block_idx == FAT_EOC) {
+int fs_fallocate_h(struct fs_volume *fs, int fd, size_t nblocks) {
 
-      int valid = extend(fd);
-      start_block_idx = valid;
+  int loc = lock_fd(fs, fd);
+  if (loc == -1) {
+    return -1;
+  }
 
-      if (valid == -1) {
+  pthread_rwlock_wrlock(&fs->file_locks[loc]);
+  pthread_mutex_lock(&fs->meta_lock);
+  int ret = fallocate_file(fs, fd, nblocks);
+  pthread_mutex_unlock(&fs->meta_lock);
+  pthread_rwlock_unlock(&fs->file_locks[loc]);
+  unlock_fd(fs, fd);
+  return ret;
+}
 
-        return bytes_copied;
-      }
-    } else {
+int fs_fallocate(int fd, size_t nblocks) {
+
+  return fs_fallocate_h(&default_fs, fd, nblocks);
+}
+
+//position in the buffers of a scatter/gather transfer
+struct iov_iter {
+  const struct iovec *iov;
+  int iovcnt;
+  size_t off;
+};
+
+int iov_iter_init(struct iov_iter *iter, const struct iovec *iov, int iovcnt,
+                  size_t *count) {
 
-      block_read(start_block_idx + superblock->data_blk_idx, bounce);
+  //add the buffer lengths up, capped to what an int return can carry
+  if (iovcnt < 0 || (iov == NULL && iovcnt > 0)) {
+    return -1;
+  }
+  *count = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_base == NULL) {
+      return -1;
+    }
+    if (iov[i].iov_len > INT_MAX - *count) {
+      *count = INT_MAX;
+    } else {
+      *count += iov[i].iov_len;
     }
-    // copy part of chunk to end of count to end of buffer
-    memcpy(bounce + start_block_offset, (uint8_t *)buf + bytes_copied,
-           added_bytes);
+  }
 
-    //write to block
-    block_write(start_block_idx + superblock->data_blk_idx, bounce);
+  iter->iov = iov;
+  iter->iovcnt = iovcnt;
+  iter->off = 0;
+  return 0;
+}
 
+void iov_iter_skip_empty(struct iov_iter *iter) {
 
-    //adjust incrementers accordingly
-    bytes_left -= added_bytes;
-    bytes_copied += added_bytes;
+  //move on to the next buffer with bytes left in it
+  while (iter->iovcnt > 0 && iter->off == iter->iov->iov_len) {
+    iter->iov++;
+    iter->iovcnt--;
+    iter->off = 0;
+  }
+}
+
+size_t iov_iter_contig(struct iov_iter *iter, size_t max) {
 
+  //bytes left in the current buffer, at most max
+  iov_iter_skip_empty(iter);
+  if (iter->iovcnt == 0) {
+    return 0;
+  }
+  size_t left = iter->iov->iov_len - iter->off;
+  return left < max ? left : max;
+}
+
+uint8_t *iov_iter_ptr(struct iov_iter *iter) {
+
+  iov_iter_skip_empty(iter);
+  return (uint8_t *)iter->iov->iov_base + iter->off;
+}
+
+void iov_iter_advance(struct iov_iter *iter, size_t len) {
+
+  while (len > 0) {
+    size_t step = iov_iter_contig(iter, len);
+    iter->off += step;
+    len -= step;
+  }
+}
+
+void iov_iter_gather(struct iov_iter *iter, void *dst, size_t len) {
+
+  //copy len bytes out of the buffers into dst
+  while (len > 0) {
+    size_t step = iov_iter_contig(iter, len);
+    memcpy(dst, iov_iter_ptr(iter), step);
+    dst = (uint8_t *)dst + step;
+    iter->off += step;
+    len -= step;
+  }
+}
+
+void iov_iter_scatter(struct iov_iter *iter, const void *src, size_t len) {
+
+  //copy len bytes from src into the buffers
+  while (len > 0) {
+    size_t step = iov_iter_contig(iter, len);
+    memcpy(iov_iter_ptr(iter), src, step);
+    src = (const uint8_t *)src + step;
+    iter->off += step;
+    len -= step;
+  }
+}
+
+int write_at(struct fs_volume *fs, struct file_info *file,
+             struct iov_iter *iter, size_t count, size_t offset) {
+
+  //allocate every block the write will touch, shortening it if the disk is full
+  size_t needed = (offset + count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  uint16_t last = FAT_EOC;
+  if (count > 0) {
+    last = find_data_blk(fs, file, needed - 1);
+  }
+  if (last == FAT_ERROR) {
+    return -1;
+  }
+  if (count > 0 && last == FAT_EOC) {
+
+    //a failed lookup leaves the cursor on the last block of the file
+    pthread_mutex_lock(&fs->meta_lock);
+    size_t blocks = 0;
+    if (file->cur_pblk != FAT_EOC) {
+      blocks = file->cur_lblk + 1;
+    }
+    while (blocks < needed && extend(fs, file) != -1) {
+      blocks++;
+    }
+    if (blocks < needed) {
+      count = blocks * BLOCK_SIZE > offset ? blocks * BLOCK_SIZE - offset : 0;
+    }
+    pthread_mutex_unlock(&fs->meta_lock);
+  }
 
-    //iterate to next block if more exist
-    if (bytes_left > 0) {
+  //find the latest block and offset on the block
+  size_t start_block = offset / BLOCK_SIZE;
+  uint16_t start_block_idx = find_data_blk(fs, file, start_block);
+  size_t start_block_offset = offset % BLOCK_SIZE;
+
+  //initalize iterator variables and the buffer for partial blocks
+  uint8_t bounce[BLOCK_SIZE] __attribute__((aligned(BLOCK_SIZE)));
+  size_t bytes_copied = 0;
+  size_t bytes_left = count;
+  size_t old_size = fs->root_dir[file->loc].size;
+  while (bytes_left > 0 && start_block_idx != FAT_EOC) {
 
-      int block = start_block_idx;
-      if (block < superblock->data_blk) {
+    //a chain that cannot be followed fails the transfer
+    if (start_block_idx == FAT_ERROR) {
+      return -1;
+    }
+    size_t disk_blk = start_block_idx + fs->superblock->data_blk_idx;
+    size_t whole = 0;
+    if (start_block_offset == 0) {
+      whole = iov_iter_contig(iter, bytes_left) / BLOCK_SIZE;
+    }
+    int run = 1;
+    size_t added_bytes = 0;
+    if (whole > 0) {
+
+      //whole blocks go from the user buffer to the disk without being read
+      run = run_length(fs, start_block_idx, whole < FAT_EOC ? whole : FAT_EOC);
+      if (run == -1) {
+        return -1;
+      }
+      added_bytes = run * BLOCK_SIZE;
+      if (cache_write_multi(fs->cache, disk_blk, run,
+                            iov_iter_ptr(iter)) == -1) {
+        break;
+      }
+      iov_iter_advance(iter, added_bytes);
+    } else {
 
-        // move to the next block
-        start_block_idx = fat_block_arr[block].directory;
-        start_block_offset = 0;
-      } else {
+      // get the number of bytes to copy in the block
+      added_bytes = BLOCK_SIZE - start_block_offset;
+      if (bytes_left < added_bytes) {
+        added_bytes = bytes_left;
+      }
 
+      //merge the new bytes with the block content unless they cover all of
+      //it, which past the end of the file is not worth reading
+      if (added_bytes < BLOCK_SIZE) {
+        if (start_block * BLOCK_SIZE < old_size) {
+          if (cache_read(fs->cache, disk_blk, bounce) == -1) {
+            break;
+          }
+        } else {
+          memset(bounce, 0, BLOCK_SIZE);
+        }
+      }
+      iov_iter_gather(iter, bounce + start_block_offset, added_bytes);
+      if (cache_write(fs->cache, disk_blk, bounce) == -1) {
         break;
       }
     }
+
+    //adjust incrementers accordingly
+    bytes_left -= added_bytes;
+    bytes_copied += added_bytes;
+
+    //leave the cursor on the last block of the run and move past it
+    file->cur_lblk = start_block + run - 1;
+    file->cur_pblk = start_block_idx + run - 1;
+    start_block += run;
+    start_block_idx = get_fat(fs, start_block_idx + run - 1);
+    start_block_offset = 0;
   }
 
-  //move offset and change size accordingly
-  file_directory[fd].offset += bytes_copied;
-  root_dir[file_directory[fd].loc].size += bytes_copied;
-  return bytes_copied;
+  //grow size if the write went past the end, failing if its write back does
+  int ret = 0;
+  if (offset + bytes_copied > fs->root_dir[file->loc].size) {
+    pthread_mutex_lock(&fs->meta_lock);
+    fs->root_dir[file->loc].size = offset + bytes_copied;
+    fs->rdir_dirty = true;
+    ret = metadata_changed(fs);
+    pthread_mutex_unlock(&fs->meta_lock);
+  }
+  return ret == -1 ? -1 : (int)bytes_copied;
 }
 
-int fs_read(int fd, void *buf, size_t count) {
+int write_file(struct fs_volume *fs, int fd, const struct iovec *iov,
+               int iovcnt) {
 
   //check preqrequisites
-  if (buf == NULL || fd > FS_OPEN_MAX_COUNT || file_directory[fd].loc == -1 ||
-      validmount == false) {
+  struct iov_iter iter;
+  size_t count = 0;
+  if (fs->validmount == false ||
+      iov_iter_init(&iter, iov, iovcnt, &count) == -1) {
+    return -1;
+  }
+
+  //write at the offset of the descriptor and move it past the bytes written
+  struct file_info *file = &fs->file_directory[fd];
+  int written = write_at(fs, file, &iter, count, file->offset);
+  if (written == -1) {
+    return -1;
+  }
+  file->offset += written;
+  return written;
+}
+
+int fs_write_h(struct fs_volume *fs, int fd, void *buf, size_t count) {
+
+  //a single buffer is a vector of one
+  struct iovec iov = { .iov_base = buf, .iov_len = count };
+  return fs_writev_h(fs, fd, &iov, 1);
+}
+
+int fs_write(int fd, void *buf, size_t count) {
+
+  return fs_write_h(&default_fs, fd, buf, count);
+}
+
+int fs_writev_h(struct fs_volume *fs, int fd, const struct iovec *iov,
+                int iovcnt) {
+
+  int loc = lock_fd(fs, fd);
+  if (loc == -1) {
     return -1;
   }
 
+  pthread_rwlock_wrlock(&fs->file_locks[loc]);
+  int ret = write_file(fs, fd, iov, iovcnt);
+  pthread_rwlock_unlock(&fs->file_locks[loc]);
+  unlock_fd(fs, fd);
+  return ret;
+}
+
+int fs_writev(int fd, const struct iovec *iov, int iovcnt) {
+
+  return fs_writev_h(&default_fs, fd, iov, iovcnt);
+}
+
+void read_ahead(struct fs_volume *fs, struct file_info *file, size_t offset,
+                size_t count) {
+
+  //a read anywhere else than where the last one ended collapses the window
+  bool sequential = offset == file->ra_next;
+  file->ra_next = offset + count;
+  if (!sequential) {
+    file->ra_window = 0;
+    file->ra_end = 0;
+    return;
+  }
+
+  //otherwise the window opens, then doubles on every sequential read
+  if (file->ra_window == 0) {
+    file->ra_window = READAHEAD_MIN_BLOCKS;
+  } else {
+    file->ra_window *= 2;
+  }
+  if (file->ra_window > readahead_max) {
+    file->ra_window = readahead_max;
+  }
+
+  //reads as large as the window need no help
+  if (count >= file->ra_window * BLOCK_SIZE) {
+    return;
+  }
+
+  //top the window up once half of it has been consumed
+  size_t size = fs->root_dir[file->loc].size;
+  size_t next = (offset + count) / BLOCK_SIZE;
+  size_t end = next + file->ra_window;
+  if (end > (size + BLOCK_SIZE - 1) / BLOCK_SIZE) {
+    end = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  }
+  size_t from = file->ra_end > next ? file->ra_end : next;
+  if (from >= end || (from > next && 2 * (end - from) < file->ra_window)) {
+    return;
+  }
+
+  //map the blocks without disturbing the cursor the reads rely on
+  size_t cur_lblk = file->cur_lblk;
+  uint16_t cur_pblk = file->cur_pblk;
+  uint16_t pblk = find_data_blk(fs, file, from);
+  size_t done = 0;
+  while (from + done < end && pblk != FAT_EOC && pblk != FAT_ERROR) {
+
+    int run = run_length(fs, pblk, end - from - done);
+    if (run == -1 ||
+        cache_prefetch(fs->cache, pblk + fs->superblock->data_blk_idx,
+                       run) == -1) {
+      break;
+    }
+    done += run;
+    pblk = get_fat(fs, pblk + run - 1);
+  }
+  file->cur_lblk = cur_lblk;
+  file->cur_pblk = cur_pblk;
+  file->ra_end = from + done;
+}
+
+int read_at(struct fs_volume *fs, struct file_info *file, struct iov_iter *iter,
+            size_t count, size_t offset) {
+
+  //never read past the end of the file
+  size_t size = fs->root_dir[file->loc].size;
+  if (offset >= size) {
+    return 0;
+  }
+  if (count > size - offset) {
+    count = size - offset;
+  }
+
   //find the latest block and offset on the block
-  size_t start_block_idx = find_data_blk(fd);
-  int start_block_offset = file_directory[fd].offset % BLOCK_SIZE;
+  size_t start_block = offset / BLOCK_SIZE;
+  uint16_t start_block_idx = find_data_blk(fs, file, start_block);
+  size_t start_block_offset = offset % BLOCK_SIZE;
 
-  //initialize iterators
+  //initialize iterators and the buffer for partial blocks
+  uint8_t bounce[BLOCK_SIZE] __attribute__((aligned(BLOCK_SIZE)));
   size_t bytes_copied = 0;
-  int bytes_left = (int)count;
-
+  size_t bytes_left = count;
 
   //check if there are bytes left to read and block is valid
-
   while (bytes_left > 0 && start_block_idx != FAT_EOC) {
 
-    // reset bounce
-    memset(bounce, 0, BLOCK_SIZE);
+    //a chain that cannot be followed fails the transfer
+    if (start_block_idx == FAT_ERROR) {
+      return -1;
+    }
+    size_t disk_blk = start_block_idx + fs->superblock->data_blk_idx;
+    const uint8_t *mapped = disk_map(fs->disk, disk_blk);
+    size_t whole = 0;
+    if (start_block_offset == 0) {
+      whole = iov_iter_contig(iter, bytes_left) / BLOCK_SIZE;
+    }
+    int run = 1;
+    size_t added_bytes = 0;
+    if (mapped != NULL) {
+
+      //a mapped disk is copied from in place, a whole run at a time
+      size_t blocks = (start_block_offset + bytes_left + BLOCK_SIZE - 1) /
+                      BLOCK_SIZE;
+      run = run_length(fs, start_block_idx,
+                       blocks < FAT_EOC ? blocks : FAT_EOC);
+      if (run == -1) {
+        return -1;
+      }
+      added_bytes = run * BLOCK_SIZE - start_block_offset;
+      if (bytes_left < added_bytes) {
+        added_bytes = bytes_left;
+      }
+      iov_iter_scatter(iter, mapped + start_block_offset, added_bytes);
+    } else if (whole > 0) {
 
-    // get the number of bytes to copy in block
-    int added_bytes = BLOCK_SIZE - start_block_offset;
+      //whole blocks are read straight into the user buffer, one run at a time
+      run = run_length(fs, start_block_idx, whole < FAT_EOC ? whole : FAT_EOC);
+      if (run == -1) {
+        return -1;
+      }
+      added_bytes = run * BLOCK_SIZE;
+      if (cache_read_multi(fs->cache, disk_blk, run,
+                           iov_iter_ptr(iter)) == -1) {
+        break;
+      }
+      iov_iter_advance(iter, added_bytes);
+    } else {
 
-    if (bytes_left < added_bytes) {
+      // get the number of bytes to copy from the block
+      added_bytes = BLOCK_SIZE - start_block_offset;
+      if (bytes_left < added_bytes) {
+        added_bytes = bytes_left;
+      }
 
-      // last page
-      added_bytes = bytes_left;
+      // read block to bounce and copy the requested part out
+      if (cache_read(fs->cache, disk_blk, bounce) == -1) {
+        break;
+      }
+      iov_iter_scatter(iter, bounce + start_block_offset, added_bytes);
     }
-    
-    // read block to bounce
-    block_read(start_block_idx + superblock->data_blk_idx, bounce);
-
-    // copy start of chunk to end of count to end of buffer
-    memcpy((uint8_t *)buf + bytes_copied, bounce + start_block_offset,
-           added_bytes);
-    added_bytes = strlen((char*) bounce + start_block_offset);
 
     // reduce total blocks left to copy
     bytes_left -= added_bytes;
     bytes_copied += added_bytes;
 
-    //if bytes are left, iterate through
-    if (bytes_left > 0) {
+    //leave the cursor on the last block of the run and move past it
+    file->cur_lblk = start_block + run - 1;
+    file->cur_pblk = start_block_idx + run - 1;
+    start_block += run;
+    start_block_idx = get_fat(fs, start_block_idx + run - 1);
+    start_block_offset = 0;
+  }
+
+  return bytes_copied;
+}
+
+int read_file(struct fs_volume *fs, int fd, const struct iovec *iov,
+              int iovcnt) {
+
+  //check preqrequisites
+  struct iov_iter iter;
+  size_t count = 0;
+  if (fs->validmount == false ||
+      iov_iter_init(&iter, iov, iovcnt, &count) == -1) {
+    return -1;
+  }
+
+  //read at the offset of the descriptor, move it and read ahead of a
+  //sequential reader
+  struct file_info *file = &fs->file_directory[fd];
+  size_t offset = file->offset;
+  int bytes_read = read_at(fs, file, &iter, count, offset);
+  if (bytes_read == -1) {
+    return -1;
+  }
+  file->offset += bytes_read;
+  if (readahead_max > 0) {
+    read_ahead(fs, file, offset, bytes_read);
+  }
+  return bytes_read;
+}
+
+int fs_read_h(struct fs_volume *fs, int fd, void *buf, size_t count) {
 
-      int block = start_block_idx;
+  //a single buffer is a vector of one
+  struct iovec iov = { .iov_base = buf, .iov_len = count };
+  return fs_readv_h(fs, fd, &iov, 1);
+}
 
-      // fat_block_arr[block].directory, superblock->data_blk);
-      if (block < superblock->data_blk &&
-          fat_block_arr[block].directory != FAT_EOC) {
+int fs_read(int fd, void *buf, size_t count) {
 
-        // move to the next block
-        start_block_idx = fat_block_arr[block].directory;
-        start_block_offset = 0;
+  return fs_read_h(&default_fs, fd, buf, count);
+}
 
-      } else {
+int fs_readv_h(struct fs_volume *fs, int fd, const struct iovec *iov,
+               int iovcnt) {
 
-        break;
-      }
+  int loc = lock_fd(fs, fd);
+  if (loc == -1) {
+    return -1;
+  }
+
+  pthread_rwlock_rdlock(&fs->file_locks[loc]);
+  int ret = read_file(fs, fd, iov, iovcnt);
+  pthread_rwlock_unlock(&fs->file_locks[loc]);
+  unlock_fd(fs, fd);
+  return ret;
+}
+
+int fs_readv(int fd, const struct iovec *iov, int iovcnt) {
+
+  return fs_readv_h(&default_fs, fd, iov, iovcnt);
+}
+
+void build_extents_locked(struct fs_volume *fs, int loc) {
+
+  //indexing the file changes it, so it needs the write lock
+  pthread_rwlock_rdlock(&fs->file_locks[loc]);
+  if (!fs->file_extents[loc].valid) {
+    pthread_rwlock_unlock(&fs->file_locks[loc]);
+    pthread_rwlock_wrlock(&fs->file_locks[loc]);
+    if (!fs->file_extents[loc].valid) {
+      build_extents(fs, loc);
     }
+    pthread_rwlock_unlock(&fs->file_locks[loc]);
+    pthread_rwlock_rdlock(&fs->file_locks[loc]);
   }
+}
 
-  //move offset
-  file_directory[fd].offset += bytes_copied;
-  return bytes_copied;
+int fs_pread_h(struct fs_volume *fs, int fd, void *buf, size_t count,
+               size_t offset) {
+
+  int loc = lock_fd(fs, fd);
+  if (loc == -1) {
+    return -1;
+  }
+  struct iovec iov = { .iov_base = buf, .iov_len = count };
+  struct iov_iter iter;
+  if (iov_iter_init(&iter, &iov, 1, &count) == -1) {
+    unlock_fd(fs, fd);
+    return -1;
+  }
+
+  //positional reads look blocks up in the extent index, and work on a copy
+  //of the descriptor so that it is free for other calls during the transfer
+  build_extents_locked(fs, loc);
+  struct file_info file = fs->file_directory[fd];
+  pthread_mutex_unlock(&fs->fd_locks[fd]);
+
+  int ret = read_at(fs, &file, &iter, count, offset);
+  pthread_rwlock_unlock(&fs->file_locks[loc]);
+  pthread_rwlock_unlock(&fs->mount_lock);
+  return ret;
+}
+
+int fs_pread(int fd, void *buf, size_t count, size_t offset) {
+
+  return fs_pread_h(&default_fs, fd, buf, count, offset);
+}
+
+int fs_pwrite_h(struct fs_volume *fs, int fd, const void *buf, size_t count,
+                size_t offset) {
+
+  int loc = lock_fd(fs, fd);
+  if (loc == -1) {
+    return -1;
+  }
+
+  //a file cannot have holes, so the write has to start within it
+  struct iovec iov = { .iov_base = (void *)buf, .iov_len = count };
+  struct iov_iter iter;
+  pthread_rwlock_wrlock(&fs->file_locks[loc]);
+  if (iov_iter_init(&iter, &iov, 1, &count) == -1 ||
+      offset > fs->root_dir[loc].size) {
+    pthread_rwlock_unlock(&fs->file_locks[loc]);
+    unlock_fd(fs, fd);
+    return -1;
+  }
+
+  //positional writes look blocks up in the extent index, and work on a copy
+  //of the descriptor so that it is free for other calls during the transfer
+  if (!fs->file_extents[loc].valid) {
+    build_extents(fs, loc);
+  }
+  struct file_info file = fs->file_directory[fd];
+  pthread_mutex_unlock(&fs->fd_locks[fd]);
+
+  int ret = write_at(fs, &file, &iter, count, offset);
+  pthread_rwlock_unlock(&fs->file_locks[loc]);
+  pthread_rwlock_unlock(&fs->mount_lock);
+  return ret;
+}
+
+int fs_pwrite(int fd, const void *buf, size_t count, size_t offset) {
+
+  return fs_pwrite_h(&default_fs, fd, buf, count, offset);
 }
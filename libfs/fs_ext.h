@@ -0,0 +1,500 @@
+#ifndef _FS_EXT_H
+#define _FS_EXT_H
+
+/*
+ * Extensions to the file system interface of fs.h. They operate on the file
+ * system mounted with fs_mount() and follow the same error conventions. The
+ * fs_*_h() variants at the end of this file operate on a volume mounted with
+ * fs_mount_h() instead, so that several disks can be used at once.
+ *
+ * Every function of fs.h and of this file may be called from several threads
+ * at once. Reads of a file run in parallel with each other, while writes to a
+ * file exclude every other access to it. Calls on different files only
+ * contend on file system metadata and the block cache. fs_mount() and
+ * fs_umount() wait for every other call to return. Calls on different volumes
+ * share no state. The *_config() functions fail while any file system is
+ * mounted, and apply to every volume mounted afterwards.
+ */
+
+#include <stddef.h> /* for size_t definition */
+#include <stdint.h> /* for uint64_t definition */
+#include <sys/uio.h> /* for struct iovec definition */
+
+/**
+ * fs_pread - Read from a file at a given offset
+ * @fd: File descriptor
+ * @buf: Data buffer to be filled with data
+ * @count: Number of bytes of data to be read
+ * @offset: Offset in the file to read from
+ *
+ * Like fs_read(), but read from @offset instead of the file offset of @fd,
+ * which is left untouched. Several threads can read through the same @fd at
+ * once.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if @buf is NULL. Otherwise
+ * return the number of bytes actually read, which is 0 if @offset is at or
+ * past the end of the file.
+ */
+int fs_pread(int fd, void *buf, size_t count, size_t offset);
+
+/**
+ * fs_pwrite - Write to a file at a given offset
+ * @fd: File descriptor
+ * @buf: Data buffer to write in the file
+ * @count: Number of bytes of data to be written
+ * @offset: Offset in the file to write to
+ *
+ * Like fs_write(), but write at @offset instead of the file offset of @fd,
+ * which is left untouched. Writes to a file are still serialized with every
+ * other access to it.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if @buf is NULL, or if
+ * @offset is past the end of the file. Otherwise return the number of bytes
+ * actually written.
+ */
+int fs_pwrite(int fd, const void *buf, size_t count, size_t offset);
+
+/**
+ * fs_readv - Read from a file into several buffers
+ * @fd: File descriptor
+ * @iov: Buffers to be filled with data, in order
+ * @iovcnt: Number of buffers in @iov
+ *
+ * Like fs_read(), but scatter the data read over the buffers of @iov, each
+ * filled completely before the next one. A block spanning several buffers is
+ * read once.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if @iovcnt is negative or
+ * a buffer of @iov is NULL. Otherwise return the number of bytes actually
+ * read.
+ */
+int fs_readv(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * fs_writev - Write to a file from several buffers
+ * @fd: File descriptor
+ * @iov: Buffers holding the data to write, in order
+ * @iovcnt: Number of buffers in @iov
+ *
+ * Like fs_write(), but gather the data from the buffers of @iov as if they
+ * were one. A block touched by several buffers is read and written once, and
+ * whole blocks lying within one buffer are written without being copied.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if @iovcnt is negative or
+ * a buffer of @iov is NULL. Otherwise return the number of bytes actually
+ * written.
+ */
+int fs_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/** Largest number of asynchronous requests that can be in flight */
+#define FS_AIO_MAX_DEPTH 256
+
+/**
+ * enum fs_aio_opcode - Asynchronous operations
+ * @FS_AIO_READ: fs_pread() of the request's buffer
+ * @FS_AIO_WRITE: fs_pwrite() of the request's buffer
+ * @FS_AIO_SYNC: fs_sync(), the other fields are ignored
+ */
+enum fs_aio_opcode {
+	FS_AIO_READ,
+	FS_AIO_WRITE,
+	FS_AIO_SYNC,
+};
+
+/**
+ * struct fs_aio_req - Asynchronous request
+ * @opcode: Operation to perform
+ * @fd: File descriptor
+ * @buf: Data buffer to read into or write from
+ * @count: Number of bytes to transfer
+ * @offset: Offset in the file to transfer at
+ * @user_data: Left untouched, for the caller to identify the request
+ * @result: Set on completion to what the matching synchronous call returned
+ *
+ * A request and its buffer belong to the queue from fs_aio_submit() until
+ * fs_aio_reap() hands the request back.
+ */
+struct fs_aio_req {
+	enum fs_aio_opcode opcode;
+	int fd;
+	void *buf;
+	size_t count;
+	size_t offset;
+	void *user_data;
+	int result;
+};
+
+/**
+ * fs_aio_setup - Create the asynchronous request queue
+ * @depth: Number of requests that can be in flight at once
+ *
+ * Requests are served by a pool of @depth worker threads, so that up to
+ * @depth requests, on the same or different files, run concurrently. Requests
+ * follow the locking rules of the synchronous calls: reads of a file overlap,
+ * writes to a file are serialized with every other access to it, and requests
+ * run in no particular order. Each volume has its own queue, see
+ * fs_aio_setup_h(), which must be torn down before the volume is unmounted:
+ * fs_umount() and fs_umount_h() fail while it is set up.
+ *
+ * Return: -1 if a queue already exists, if @depth is 0 or larger than
+ * %FS_AIO_MAX_DEPTH, or if the queue cannot be created. 0 otherwise.
+ */
+int fs_aio_setup(unsigned int depth);
+
+/**
+ * fs_aio_teardown - Destroy the asynchronous request queue
+ *
+ * Return: -1 if there is no queue or if requests are still in flight (not yet
+ * reaped). 0 otherwise.
+ */
+int fs_aio_teardown(void);
+
+/**
+ * fs_aio_submit - Queue asynchronous requests
+ * @reqs: Requests to queue
+ * @nreqs: Number of requests in @reqs
+ *
+ * Queue requests in order until @nreqs are queued or @depth requests are in
+ * flight. Never blocks.
+ *
+ * Return: -1 if there is no queue, or if @reqs is NULL. Otherwise the number
+ * of requests queued, which may be less than @nreqs.
+ */
+int fs_aio_submit(struct fs_aio_req **reqs, unsigned int nreqs);
+
+/**
+ * fs_aio_reap - Collect completed asynchronous requests
+ * @reqs: Filled with the completed requests
+ * @min: Number of completed requests to wait for
+ * @max: Largest number of requests to collect
+ *
+ * Wait until at least @min requests have completed, or as many as are in
+ * flight if that is fewer, then collect up to @max of them. Their @result
+ * field holds the outcome. A @min of 0 polls without waiting.
+ *
+ * Return: -1 if there is no queue, or if @reqs is NULL. Otherwise the number
+ * of requests collected.
+ */
+int fs_aio_reap(struct fs_aio_req **reqs, unsigned int min, unsigned int max);
+
+/** Default number of blocks held by the block cache */
+#define FS_CACHE_DEFAULT_BLOCKS 256
+
+/**
+ * struct fs_cache_stats - Block cache statistics
+ * @capacity: Number of blocks the cache can hold
+ * @used: Number of blocks currently cached
+ * @dirty: Number of cached blocks not yet written back
+ * @hits: Block lookups served from the cache
+ * @misses: Block lookups that had to go to the disk
+ * @evictions: Blocks dropped to make room for other blocks
+ * @writebacks: Dirty blocks written to the disk (evictions and flushes)
+ * @prefetched: Blocks loaded ahead of use by sequential read-ahead
+ */
+struct fs_cache_stats {
+	size_t capacity;
+	size_t used;
+	size_t dirty;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t writebacks;
+	uint64_t prefetched;
+};
+
+/**
+ * fs_cache_config - Set the size of the block cache
+ * @nblocks: Number of blocks the cache can hold
+ *
+ * Set the capacity of the write-back block cache used by the next fs_mount().
+ * The default capacity is %FS_CACHE_DEFAULT_BLOCKS. A capacity of 0 disables
+ * caching and sends every block transfer straight to the disk.
+ *
+ * Return: -1 if a file system is currently mounted. 0 otherwise.
+ */
+int fs_cache_config(size_t nblocks);
+
+/**
+ * fs_cache_stats - Get block cache statistics
+ * @stats: Structure to be filled with the statistics
+ *
+ * Counters are reset by fs_mount().
+ *
+ * Return: -1 if no FS is currently mounted, or if @stats is NULL. 0 otherwise.
+ */
+int fs_cache_stats(struct fs_cache_stats *stats);
+
+/** Default largest read-ahead window, in blocks */
+#define FS_READAHEAD_DEFAULT_BLOCKS 32
+
+/**
+ * fs_readahead_config - Set the largest sequential read-ahead window
+ * @nblocks: Largest number of blocks read ahead of a sequential reader
+ *
+ * Each file descriptor tracks whether it is read sequentially. While it is,
+ * blocks following the ones just read are loaded into the block cache ahead
+ * of time, within a window that starts small and doubles on every sequential
+ * read up to @nblocks. A seek collapses the window. An @nblocks of 0 disables
+ * read-ahead, as does disabling the cache. The default is
+ * %FS_READAHEAD_DEFAULT_BLOCKS.
+ *
+ * Return: -1 if a file system is currently mounted. 0 otherwise.
+ */
+int fs_readahead_config(size_t nblocks);
+
+/**
+ * enum fs_io_backend - Ways of transferring blocks to and from the disk
+ * @FS_IO_SYSCALL: One positional system call per transfer
+ * @FS_IO_URING: io_uring, with batches of transfers submitted and waited for
+ * with a single system call
+ * @FS_IO_MMAP: The whole disk mapped in memory. fs_read() copies straight from
+ * the mapping, and the block cache is disabled since the mapping already is
+ * one. Written data reaches the disk on fs_sync() and fs_umount().
+ * @FS_IO_DIRECT: One system call per transfer, bypassing the page cache of the
+ * host with O_DIRECT, so that the block cache (see fs_cache_config()) is the
+ * only copy of the disk in memory
+ */
+enum fs_io_backend {
+	FS_IO_SYSCALL,
+	FS_IO_URING,
+	FS_IO_MMAP,
+	FS_IO_DIRECT,
+};
+
+/**
+ * fs_io_config - Set how blocks are transferred to and from the disk
+ * @backend: Backend used by the next fs_mount()
+ *
+ * Builds or kernels without io_uring support, disks that cannot be mapped and
+ * file systems without direct transfers fall back to %FS_IO_SYSCALL, which is
+ * the default.
+ *
+ * Return: -1 if @backend is invalid, or if a file system is currently mounted.
+ * 0 otherwise.
+ */
+int fs_io_config(enum fs_io_backend backend);
+
+/** Default number of metadata changes between two write backs */
+#define FS_FLUSH_DEFAULT_INTERVAL 64
+
+/**
+ * fs_flush_config - Set how often metadata is written back
+ * @interval: Number of metadata-changing operations between write backs
+ *
+ * FAT and root directory changes are tracked per block and only modified
+ * blocks are written back. Write back happens once @interval operations that
+ * changed metadata (file creations and deletions, writes that grew a file)
+ * have accumulated since the last one, as well as on fs_sync() and
+ * fs_umount(). An @interval of 1 writes metadata back after every change, and
+ * 0 only on fs_sync() and fs_umount(). The default interval is
+ * %FS_FLUSH_DEFAULT_INTERVAL.
+ *
+ * Return: -1 if a file system is currently mounted. 0 otherwise.
+ */
+int fs_flush_config(unsigned int interval);
+
+/**
+ * fs_sync - Flush the file system to disk
+ *
+ * Write back every dirty cached block as well as the modified FAT blocks and
+ * the root directory if it changed, so that the virtual disk file reflects the
+ * current state of the file system. fs_umount() implies fs_sync().
+ *
+ * On a disk formatted with a metadata journal, the modified metadata blocks
+ * are committed to the journal as one atomic transaction before being written
+ * in place, so a crash leaves either the old or the new metadata after the
+ * next fs_mount(). fs_mount() refuses a disk whose journal cannot hold every
+ * FAT block and the root directory in one transaction.
+ *
+ * The free data block and root directory entry counts are then saved in the
+ * superblock, for fs_info() to report after the next fs_mount() without
+ * reading the FAT (see fs_fat_config()).
+ *
+ * Return: -1 if no FS is currently mounted, or if writing to the virtual disk
+ * fails. 0 otherwise.
+ */
+int fs_sync(void);
+
+/**
+ * enum fs_alloc_policy - Data block allocation policies
+ * @FS_ALLOC_FIRST_FIT: Lowest-numbered free block, as the reference
+ * implementation does
+ * @FS_ALLOC_NEXT_FIT: Block following the file's last block, or else the
+ * first free block after it
+ * @FS_ALLOC_BEST_FIT: Block following the file's last block, or else the
+ * start of the smallest free extent large enough
+ */
+enum fs_alloc_policy {
+	FS_ALLOC_FIRST_FIT,
+	FS_ALLOC_NEXT_FIT,
+	FS_ALLOC_BEST_FIT,
+};
+
+/**
+ * fs_alloc_config - Set the data block allocation policy
+ * @policy: Allocation policy
+ * @window: Size of the per-file reservation window, in blocks
+ *
+ * Set the policy used by the next fs_mount() to pick new data blocks when a
+ * file grows. With a non-zero @window, a file that needs a new block also
+ * reserves up to @window free blocks right after it, so that files growing at
+ * the same time do not interleave on disk. Reservations live in memory only and
+ * are given back when the last descriptor of the file is closed, or whenever
+ * the disk would otherwise be full. The default is %FS_ALLOC_FIRST_FIT with no
+ * window.
+ *
+ * Return: -1 if a file system is currently mounted, or if @policy is invalid. 0
+ * otherwise.
+ */
+int fs_alloc_config(enum fs_alloc_policy policy, size_t window);
+
+/**
+ * fs_fallocate - Preallocate data blocks for a file
+ * @fd: File descriptor
+ * @nblocks: Number of blocks the file should hold
+ *
+ * Allocate data blocks so that the file referenced by file descriptor @fd
+ * holds at least @nblocks blocks. New blocks are laid out contiguously after
+ * the file's last block when possible, else in as few free extents as
+ * possible. The file size is not changed: preallocated blocks are used by
+ * subsequent fs_write() calls past the end of the file.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if there are not enough
+ * free blocks on disk, in which case no block is allocated. 0 otherwise.
+ */
+int fs_fallocate(int fd, size_t nblocks);
+
+/**
+ * enum fs_fat_mode - Ways of reading the FAT at mount
+ * @FS_FAT_EAGER: Read every FAT block and build the free-space map during
+ * fs_mount()
+ * @FS_FAT_LAZY: Read each FAT block the first time a file needs it, and the
+ * whole FAT only when a file first grows or is deleted
+ */
+enum fs_fat_mode {
+	FS_FAT_EAGER,
+	FS_FAT_LAZY,
+};
+
+/**
+ * fs_fat_config - Set how the FAT is read
+ * @mode: FAT mode used by the next fs_mount()
+ *
+ * With %FS_FAT_LAZY, fs_mount() takes the same time whatever the size of the
+ * disk. fs_sync() and fs_umount() leave a summary of the free data blocks and
+ * root directory entries in the superblock, from which fs_info() reports them
+ * until the whole FAT has to be read. The summary is cleared from the disk
+ * before the next metadata write back, so it never outlives the FAT it
+ * describes, and ignored if it disagrees with the root directory. With
+ * %FS_IO_MMAP, reading a FAT block copies it from the mapped image. The default
+ * is %FS_FAT_EAGER.
+ *
+ * Return: -1 if @mode is invalid, or if a file system is currently mounted. 0
+ * otherwise.
+ */
+int fs_fat_config(enum fs_fat_mode mode);
+
+/**
+ * struct fs_info_stats - File system information, as displayed by fs_info()
+ * @total_blk_count: Number of blocks of the virtual disk
+ * @fat_blk_count: Number of FAT blocks
+ * @rdir_blk: Index of the root directory block
+ * @data_blk: Index of the first data block
+ * @data_blk_count: Number of data blocks
+ * @fat_free: Number of free data blocks
+ * @rdir_free: Number of free root directory entries
+ */
+struct fs_info_stats {
+	size_t total_blk_count;
+	size_t fat_blk_count;
+	size_t rdir_blk;
+	size_t data_blk;
+	size_t data_blk_count;
+	size_t fat_free;
+	size_t rdir_free;
+};
+
+/**
+ * fs_info_stats - Get information about the file system
+ * @stats: Structure to be filled with the information
+ *
+ * Like fs_info(), without printing. Free counts are kept up to date in memory
+ * as files change, so this does not scan the FAT or the root directory, except
+ * for reading the whole FAT once after a lazy fs_mount() that found no valid
+ * summary (see fs_fat_config()).
+ *
+ * Return: -1 if no FS is currently mounted, or if @stats is NULL, or if reading
+ * the FAT fails. 0 otherwise.
+ */
+int fs_info_stats(struct fs_info_stats *stats);
+
+struct fs_volume;
+
+/**
+ * fs_mount_h - Mount a file system as a separate volume
+ * @diskname: Name of the virtual disk file
+ *
+ * Like fs_mount(), but mount the file system onto a new volume, independent
+ * from the one used by fs_mount() and from any other volume. Each volume has
+ * its own open file table, block cache and metadata, so a disk must not be
+ * mounted by more than one volume at a time.
+ *
+ * Return: NULL if the virtual disk file @diskname cannot be opened, or if no
+ * valid file system can be located, or if memory runs out. Otherwise a handle
+ * to the new volume.
+ */
+struct fs_volume *fs_mount_h(const char *diskname);
+
+/**
+ * fs_umount_h - Unmount a volume
+ * @fs: Volume handle
+ *
+ * Like fs_umount(), on the volume @fs. On success, @fs is freed and must not
+ * be used anymore. On failure @fs stays mounted, and the call can be retried.
+ *
+ * Return: -1 if @fs is NULL, or if there are still open file descriptors on
+ * it, or if it has an asynchronous request queue, or if writing back to the
+ * virtual disk fails. 0 otherwise.
+ */
+int fs_umount_h(struct fs_volume *fs);
+
+/*
+ * Each of the following functions behaves like the call of the same name
+ * without the _h suffix, on the volume @fs instead of the one of fs_mount().
+ * File descriptors are only valid on the volume that returned them.
+ */
+int fs_info_h(struct fs_volume *fs);
+int fs_info_stats_h(struct fs_volume *fs, struct fs_info_stats *stats);
+int fs_create_h(struct fs_volume *fs, const char *filename);
+int fs_delete_h(struct fs_volume *fs, const char *filename);
+int fs_ls_h(struct fs_volume *fs);
+int fs_open_h(struct fs_volume *fs, const char *filename);
+int fs_close_h(struct fs_volume *fs, int fd);
+int fs_stat_h(struct fs_volume *fs, int fd);
+int fs_lseek_h(struct fs_volume *fs, int fd, size_t offset);
+int fs_write_h(struct fs_volume *fs, int fd, void *buf, size_t count);
+int fs_read_h(struct fs_volume *fs, int fd, void *buf, size_t count);
+int fs_pread_h(struct fs_volume *fs, int fd, void *buf, size_t count,
+	       size_t offset);
+int fs_pwrite_h(struct fs_volume *fs, int fd, const void *buf, size_t count,
+		size_t offset);
+int fs_readv_h(struct fs_volume *fs, int fd, const struct iovec *iov,
+	       int iovcnt);
+int fs_writev_h(struct fs_volume *fs, int fd, const struct iovec *iov,
+		int iovcnt);
+int fs_cache_stats_h(struct fs_volume *fs, struct fs_cache_stats *stats);
+int fs_sync_h(struct fs_volume *fs);
+int fs_fallocate_h(struct fs_volume *fs, int fd, size_t nblocks);
+int fs_aio_setup_h(struct fs_volume *fs, unsigned int depth);
+int fs_aio_teardown_h(struct fs_volume *fs);
+int fs_aio_submit_h(struct fs_volume *fs, struct fs_aio_req **reqs,
+		    unsigned int nreqs);
+int fs_aio_reap_h(struct fs_volume *fs, struct fs_aio_req **reqs,
+		  unsigned int min, unsigned int max);
+
+#endif /* _FS_EXT_H */
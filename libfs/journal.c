@@ -0,0 +1,271 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "disk.h"
+#include "disk_ext.h"
+#include "journal.h"
+
+#define JOURNAL_HEADER_MAGIC 0x4448524A /* "JRHD" */
+#define JOURNAL_COMMIT_MAGIC 0x4D43524A /* "JRCM" */
+
+//most home blocks a header block can list
+#define JOURNAL_MAX_TARGETS ((BLOCK_SIZE - 14) / 2)
+
+//header block struct, first block of a transaction
+struct __attribute__((__packed__)) journal_header_t {
+  uint32_t magic;
+  uint64_t seq;
+  uint16_t count;
+  uint16_t target[JOURNAL_MAX_TARGETS];
+};
+
+//commit block struct, last block of a transaction
+struct __attribute__((__packed__)) journal_commit_t {
+  uint32_t magic;
+  uint64_t seq;
+  uint32_t checksum;
+  uint8_t padding[BLOCK_SIZE - 16];
+};
+
+//journal struct, one per mounted disk
+struct journal {
+  struct disk *disk;
+  size_t start;
+  size_t capacity;
+  uint64_t seq;
+  struct journal_header_t *header;
+  struct journal_commit_t *commit;
+  struct iovec *iov;
+  struct block_io *ios;
+};
+
+//crc-32 table, built once for every volume
+static uint32_t crc32_table[256];
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static void crc32_init(void) {
+
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) {
+      c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    }
+    crc32_table[i] = c;
+  }
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len) {
+
+  //table driven crc-32, the table is complete before any thread uses it
+  pthread_once(&crc32_once, crc32_init);
+
+  crc = ~crc;
+  while (len--) {
+    crc = crc32_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static uint32_t checksum(struct journal *journal, const void *const *images,
+                         size_t count) {
+
+  uint32_t crc = crc32_update(0, (const uint8_t *)journal->header, BLOCK_SIZE);
+  for (size_t i = 0; i < count; i++) {
+    crc = crc32_update(crc, images[i], BLOCK_SIZE);
+  }
+  return crc;
+}
+
+static int write_home(struct journal *journal, const size_t *targets,
+                      const void *const *images, size_t count) {
+
+  //write the images home, consecutive targets with one vectored transfer
+  //and all of them as one batch
+  size_t nruns = 0;
+  size_t i = 0;
+  while (i < count) {
+
+    size_t run = 0;
+    while (i + run < count && targets[i + run] == targets[i] + run) {
+      journal->iov[i + run].iov_base = (void *)images[i + run];
+      journal->iov[i + run].iov_len = BLOCK_SIZE;
+      run++;
+    }
+
+    journal->ios[nruns].block = targets[i];
+    journal->ios[nruns].iov = &journal->iov[i];
+    journal->ios[nruns].iovcnt = run;
+    nruns++;
+    i += run;
+  }
+
+  return disk_writev_batch(journal->disk, journal->ios, nruns);
+}
+
+struct journal *journal_init(struct disk *disk, size_t start,
+                             size_t nblocks) {
+
+  struct journal *journal = calloc(1, sizeof(*journal));
+  if (journal == NULL) {
+    return NULL;
+  }
+  journal->disk = disk;
+  if (nblocks < JOURNAL_MIN_BLOCKS) {
+    return journal;
+  }
+
+  //a transaction is a header, the images and a commit block
+  journal->start = start;
+  journal->capacity = nblocks - 2;
+  if (journal->capacity > JOURNAL_MAX_TARGETS) {
+    journal->capacity = JOURNAL_MAX_TARGETS;
+  }
+
+  journal->header = calloc(1, BLOCK_SIZE);
+  journal->commit = calloc(1, BLOCK_SIZE);
+  journal->iov = calloc(journal->capacity + 2, sizeof(*journal->iov));
+  journal->ios = calloc(journal->capacity, sizeof(*journal->ios));
+  if (journal->header == NULL || journal->commit == NULL ||
+      journal->iov == NULL || journal->ios == NULL) {
+    journal_destroy(journal);
+    return NULL;
+  }
+
+  return journal;
+}
+
+void journal_destroy(struct journal *journal) {
+
+  free(journal->header);
+  free(journal->commit);
+  free(journal->iov);
+  free(journal->ios);
+  free(journal);
+}
+
+bool journal_enabled(struct journal *journal) {
+
+  return journal->capacity > 0;
+}
+
+size_t journal_capacity(struct journal *journal) {
+
+  return journal->capacity;
+}
+
+int journal_replay(struct journal *journal, size_t limit) {
+
+  if (!journal_enabled(journal)) {
+    return 0;
+  }
+
+  //an empty or torn header means there is nothing to replay
+  if (disk_read(journal->disk, journal->start, journal->header) == -1) {
+    return -1;
+  }
+  journal->seq = journal->header->seq;
+  size_t count = journal->header->count;
+  if (journal->header->magic != JOURNAL_HEADER_MAGIC || count == 0 ||
+      count > journal->capacity) {
+    return 0;
+  }
+
+  //read the images and the commit block
+  uint8_t *data = malloc((count + 1) * BLOCK_SIZE);
+  size_t *targets = malloc(count * sizeof(*targets));
+  const void **images = malloc(count * sizeof(*images));
+  if (data == NULL || targets == NULL || images == NULL) {
+    free(data);
+    free(targets);
+    free(images);
+    return -1;
+  }
+  int ret = disk_read_multi(journal->disk, journal->start + 1, count + 1, data);
+
+  //replay only a fully committed transaction
+  struct journal_commit_t *commit = (void *)(data + count * BLOCK_SIZE);
+  for (size_t i = 0; ret == 0 && i < count; i++) {
+    targets[i] = journal->header->target[i];
+    images[i] = data + i * BLOCK_SIZE;
+    if (targets[i] == 0 || targets[i] >= limit) {
+      ret = -1;
+    }
+  }
+  if (ret == 0 && commit->magic == JOURNAL_COMMIT_MAGIC &&
+      commit->seq == journal->header->seq &&
+      commit->checksum == checksum(journal, images, count)) {
+
+    ret = write_home(journal, targets, images, count);
+    if (ret == 0) {
+      ret = disk_sync(journal->disk);
+    }
+  }
+
+  free(data);
+  free(targets);
+  free(images);
+  if (ret == -1) {
+    return -1;
+  }
+
+  return journal_clear(journal);
+}
+
+int journal_commit(struct journal *journal, const size_t *targets,
+                   const void *const *images, size_t count) {
+
+  if (count > journal->capacity) {
+    return -1;
+  }
+  if (count == 0) {
+    return 0;
+  }
+
+  //fill in the header and the commit block
+  memset(journal->header, 0, BLOCK_SIZE);
+  journal->header->magic = JOURNAL_HEADER_MAGIC;
+  journal->header->seq = ++journal->seq;
+  journal->header->count = count;
+  for (size_t i = 0; i < count; i++) {
+    journal->header->target[i] = targets[i];
+  }
+  journal->commit->magic = JOURNAL_COMMIT_MAGIC;
+  journal->commit->seq = journal->seq;
+  journal->commit->checksum = checksum(journal, images, count);
+
+  //log the whole transaction in one transfer and make it durable
+  journal->iov[0].iov_base = journal->header;
+  journal->iov[0].iov_len = BLOCK_SIZE;
+  for (size_t i = 0; i < count; i++) {
+    journal->iov[i + 1].iov_base = (void *)images[i];
+    journal->iov[i + 1].iov_len = BLOCK_SIZE;
+  }
+  journal->iov[count + 1].iov_base = journal->commit;
+  journal->iov[count + 1].iov_len = BLOCK_SIZE;
+  if (disk_writev(journal->disk, journal->start, journal->iov,
+                  count + 2) == -1 ||
+      disk_sync(journal->disk) == -1) {
+    return -1;
+  }
+
+  //checkpoint, durable before the next transaction overwrites the log
+  if (write_home(journal, targets, images, count) == -1) {
+    return -1;
+  }
+  return disk_sync(journal->disk);
+}
+
+int journal_clear(struct journal *journal) {
+
+  if (!journal_enabled(journal)) {
+    return 0;
+  }
+
+  //keep the sequence number so a later commit never reuses one
+  memset(journal->header, 0, BLOCK_SIZE);
+  journal->header->seq = journal->seq;
+  return disk_write(journal->disk, journal->start, journal->header);
+}
@@ -0,0 +1,98 @@
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+/*
+ * Write-ahead journal for metadata blocks (FAT and root directory). Each
+ * commit logs full images of the modified blocks to a reserved region of the
+ * disk, makes them durable, and only then writes them to their home
+ * location. A transaction interrupted by a crash is either ignored (not fully
+ * logged) or replayed at the next mount (fully logged).
+ *
+ * On disk, a transaction is a header block listing the home block of every
+ * image, the images themselves, and a commit block carrying a checksum of the
+ * header and images. All of it is written with a single vectored transfer.
+ */
+
+#include <stdbool.h>
+#include <stddef.h> /* for size_t definition */
+
+/** Identifies a journal region in the superblock */
+#define JOURNAL_MAGIC 0x4C4E524A /* "JRNL" */
+
+/** Smallest usable journal: header, one image and commit block */
+#define JOURNAL_MIN_BLOCKS 3
+
+struct disk;
+struct journal;
+
+/**
+ * journal_init - Attach the journal region of a mounted disk
+ * @disk: Disk holding the journal region
+ * @start: Index of the first block of the journal region
+ * @nblocks: Number of blocks of the journal region, 0 if there is none
+ *
+ * Return: NULL if memory for the journal cannot be allocated. The new journal
+ * otherwise.
+ */
+struct journal *journal_init(struct disk *disk, size_t start, size_t nblocks);
+
+/**
+ * journal_destroy - Detach a journal region
+ * @journal: Journal to detach
+ */
+void journal_destroy(struct journal *journal);
+
+/**
+ * journal_enabled - Tell whether metadata must go through the journal
+ * @journal: Journal of the disk
+ *
+ * Return: true if a journal region is attached. false otherwise.
+ */
+bool journal_enabled(struct journal *journal);
+
+/**
+ * journal_capacity - Get the largest number of blocks a transaction can log
+ * @journal: Journal of the disk
+ *
+ * Return: the number of images that fit in one transaction.
+ */
+size_t journal_capacity(struct journal *journal);
+
+/**
+ * journal_replay - Replay the last committed transaction
+ * @journal: Journal of the disk
+ * @limit: Home blocks must be below this index (start of the data blocks)
+ *
+ * If the journal holds a complete transaction whose checksum matches, write
+ * its images to their home blocks, then clear the journal.
+ *
+ * Return: -1 if the transaction is corrupted in a way that cannot be a torn
+ * write, or if writing to the disk fails. 0 otherwise.
+ */
+int journal_replay(struct journal *journal, size_t limit);
+
+/**
+ * journal_commit - Log and write back metadata blocks atomically
+ * @journal: Journal of the disk
+ * @targets: Home block of every image
+ * @images: Block images, %BLOCK_SIZE bytes each
+ * @count: Number of images, at most journal_capacity()
+ *
+ * Return: -1 if @count is too large, or if writing to the disk fails. 0
+ * otherwise.
+ */
+int journal_commit(struct journal *journal, const size_t *targets,
+                   const void *const *images, size_t count);
+
+/**
+ * journal_clear - Mark the journal empty
+ * @journal: Journal of the disk
+ *
+ * Called on clean unmount so that a stale transaction is never replayed over
+ * changes made by a journal-unaware implementation.
+ *
+ * Return: -1 if writing to the disk fails. 0 otherwise.
+ */
+int journal_clear(struct journal *journal);
+
+#endif /* _JOURNAL_H */